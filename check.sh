@@ -0,0 +1,211 @@
+#!/bin/sh
+# End-to-end checks of a built fsg, run against small sites generated into a temporary
+# directory. Usage: ./check.sh [path/to/fsg], defaults to build/fsg
+set -u
+
+FSG=${1:-build/fsg}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+FAILURES=0
+
+pass() { echo "ok:   $1"; }
+fail() { echo "FAIL: $1"; FAILURES=$((FAILURES+1)); }
+
+# check <description> <command...>, passes when the command succeeds
+check() {
+    desc=$1; shift
+    if "$@" >/dev/null 2>&1; then pass "$desc"; else fail "$desc"; fi
+}
+
+# writes a minimal site with one page and two posts to $1
+make_site() {
+    mkdir -p "$1/_templates" "$1/_posts" "$1/css"
+
+    cat > "$1/_templates/default.html" <<'EOF'
+<!DOCTYPE html>
+<html><head><title><!-- fsg: section page.title; --></title><link rel="stylesheet" href="/css/style.css"></head>
+<body><!-- fsg: section content; --></body></html>
+EOF
+    cat > "$1/_templates/post.html" <<'EOF'
+<html><head><title><!-- fsg: section post.title; --></title><link rel="stylesheet" href="/css/style.css"></head>
+<body><article><!-- fsg: section post.content; --></article></body></html>
+EOF
+    cat > "$1/_templates/post_brief_block.html" <<'EOF'
+<div><a href="<!-- fsg: section post.url; -->"><!-- fsg: section post.title; --></a><!-- fsg: section post.brief; --></div>
+EOF
+    cat > "$1/_templates/post_brief_inline.html" <<'EOF'
+<div><a href="<!-- fsg: section post.url; -->"><!-- fsg: section post.title; --></a><!-- fsg: section post.brief; --></div>
+EOF
+    cat > "$1/_templates/post_full_block.html" <<'EOF'
+<article><h1><!-- fsg: section post.title; --></h1><!-- fsg: section post.content; --></article>
+EOF
+    cat > "$1/_templates/posts_tag.html" <<'EOF'
+<html><head><title><!-- fsg: section tag.str; --></title></head><body><!-- fsg: section posts.brief; --></body></html>
+EOF
+    cat > "$1/index.html" <<'EOF'
+<!-- fsg: template default.content; title "Home"; -->
+<h1>Posts</h1>
+<!-- fsg: section posts.brief; -->
+EOF
+    cat > "$1/_posts/first.html" <<'EOF'
+<!-- fsg: title "First"; created "2024-01-01"; tags "perf"; -->
+<p>The first post, about zebras.</p>
+<img src="/img/a.png" alt="first">
+<img src="/img/b.png" alt='say "hi"' hidden data-x="1">
+<img SRC="/img/c.png" Loading="eager" DECODING="sync">
+EOF
+    cat > "$1/_posts/second.html" <<'EOF'
+<!-- fsg: title "Second"; created "2024-02-02"; tags "perf"; -->
+<p>The second post, about giraffes.</p>
+```
+let s = `stray; okapis and tapirs
+```
+EOF
+    echo "body { color: black; }" > "$1/css/style.css"
+    echo "<svg xmlns='http://www.w3.org/2000/svg'/>" > "$1/logo.svg"
+    echo "first" > "$1/robots.txt"
+}
+
+# pack_aligned PACK, succeeds when every body in the pack starts on a page boundary
+pack_aligned() {
+    count=$(od -An -tu4 -j12 -N4 "$1")
+    i=0
+    while [ "$i" -lt "$count" ]; do
+        offset=$(od -An -tu8 -j$((32 + i*48)) -N8 "$1")
+        [ $((offset % 4096)) -eq 0 ] || return 1
+        i=$((i+1))
+    done
+}
+
+if [ ! -x "$FSG" ]; then
+    echo "no fsg binary at '$FSG'"
+    exit 1
+fi
+
+SITE=$TMP/site
+make_site "$SITE"
+
+### attributes of rewritten post images, all but the first get lazy loading
+OUT=$TMP/out_attributes
+"$FSG" generate -src="$SITE" -output="$OUT" >/dev/null 2>&1
+check "single-quoted attribute with a \" is escaped" grep -qF 'alt="say &quot;hi&quot;"' "$OUT/posts/first.html"
+check "valueless attributes are emitted bare" grep -qE '<img [^>]* hidden data-x="1"' "$OUT/posts/first.html"
+check "no attribute value is left unterminated" sh -c "! grep -qF 'alt=\"say \"hi\"' '$OUT/posts/first.html'"
+check "attributes are recognised regardless of case" sh -c "! grep -E '<img SRC[^>]*(loading|decoding)=' '$OUT/posts/first.html'"
+
+### option validation
+check "-image-widths=0 is rejected" sh -c "! '$FSG' generate -src='$SITE' -output='$TMP/out_widths' -image-widths=0"
+check "negative -image-widths are rejected" sh -c "! '$FSG' generate -src='$SITE' -output='$TMP/out_widths' -image-widths=320,-1"
+check "-bench-templates=0 is rejected" sh -c "! '$FSG' generate -src='$SITE' -output='$TMP/out_bench' -bench-templates=0"
+check "negative -bench-templates are rejected" sh -c "! '$FSG' generate -src='$SITE' -output='$TMP/out_bench' -bench-templates=-1"
+
+### search terms are plain words of the rendered text, tags and entities skipped
+OUT=$TMP/out_search
+"$FSG" generate -src="$SITE" -output="$OUT" -search-shards=4 -cache="$TMP/cache_search" >/dev/null 2>&1
+check "-search-shards implies -search" test -f "$OUT/search/docs.json"
+check "words are indexed" grep -q '"zebras"' "$OUT"/search/*.json
+check "words after a stray backtick are indexed" grep -q '"tapirs"' "$OUT"/search/*.json
+check "tag names aren't indexed" sh -c "! grep -q '\"article\"' '$OUT'/search/*.json"
+check "terms are cached under the tokenizer's version" sh -c "ls '$TMP/cache_search/search' | grep -q '^v2-'"
+
+OUT=$TMP/out_search_uncached
+mkdir -p "$TMP/cache_uncached"
+touch "$TMP/cache_uncached/search"
+"$FSG" generate -src="$SITE" -output="$OUT" -search -memory-budget=1 -cache="$TMP/cache_uncached" >/dev/null 2>&1
+check "posts whose terms can't be cached are still indexed" grep -q '"zebras"' "$OUT"/search/*.json
+
+### the daemon renders with its own options, so it refuses requests made with others
+OUT=$TMP/out_daemon
+"$FSG" daemon -src="$SITE" -output="$OUT" -cache="$TMP/cache_daemon" -minify >/dev/null 2>&1 &
+DAEMON=$!
+sleep 1
+check "daemon handles a request with its options" "$FSG" generate -src="$SITE" -output="$OUT" -cache="$TMP/cache_daemon" -minify -daemon
+check "daemon refuses a request with other options" sh -c "! '$FSG' generate -src='$SITE' -output='$OUT' -cache='$TMP/cache_daemon' -daemon"
+kill $DAEMON
+wait $DAEMON 2>/dev/null
+
+### the page-weight report lists every page and fails the build when one is over budget
+REPORT_SITE=$TMP/site_report
+cp -R "$SITE" "$REPORT_SITE"
+{
+    echo '<!-- fsg: template default.content; title "Big"; -->'
+    i=0
+    while [ "$i" -lt 40 ]; do echo "<p>A paragraph long enough to push this page over a kilobyte.</p>"; i=$((i+1)); done
+} > "$REPORT_SITE/big.html"
+
+OUT=$TMP/out_report
+check "a page over budget fails the build" sh -c "! '$FSG' generate -src='$REPORT_SITE' -output='$OUT' -report='$TMP/report.json' -max-html-kb=1"
+check "report lists the pages" grep -qF '"url": "/big.html"' "$TMP/report.json"
+check "report flags the page over budget" grep -qF '"over_budget": true' "$TMP/report.json"
+check "a generous budget passes the build" "$FSG" generate -src="$REPORT_SITE" -output="$OUT" -report="$TMP/report.json" -max-html-kb=1000
+check "report without a path is written to stdout" sh -c "'$FSG' generate -src='$REPORT_SITE' -output='$OUT' -report 2>/dev/null | grep -qF '\"pages\"'"
+check "-report only matches exactly" sh -c "! '$FSG' generate -src='$REPORT_SITE' -output='$OUT' -reports 2>/dev/null | grep -qF '\"pages\"'"
+
+### the daemon applies the report options of each request, across generations
+OUT=$TMP/out_report_daemon
+"$FSG" daemon -src="$REPORT_SITE" -output="$OUT" -cache="$TMP/cache_report" >/dev/null 2>&1 &
+DAEMON=$!
+sleep 1
+check "daemon fails a request with a page over its budget" sh -c "cd '$TMP' && ! '$FSG' generate -src='$REPORT_SITE' -output='$OUT' -cache='$TMP/cache_report' -daemon -report=daemon_report.json -max-html-kb=1"
+check "daemon writes a relative report path from the client's directory" grep -qF '"over_budget": true' "$TMP/daemon_report.json"
+check "daemon keeps failing while the page is over budget" sh -c "! '$FSG' generate -src='$REPORT_SITE' -output='$OUT' -cache='$TMP/cache_report' -daemon -report='$TMP/daemon_report.json' -max-html-kb=1"
+check "daemon passes a request with a generous budget" "$FSG" generate -src="$REPORT_SITE" -output="$OUT" -cache="$TMP/cache_report" -daemon -report="$TMP/daemon_report.json" -max-html-kb=1000
+check "daemon sends a report without a path back to the client" sh -c "'$FSG' generate -src='$REPORT_SITE' -output='$OUT' -cache='$TMP/cache_report' -daemon -report 2>/dev/null | grep -qF '\"url\": \"/big.html\"'"
+kill $DAEMON
+wait $DAEMON 2>/dev/null
+
+### bundled scripts keep regex literals after a condition or a block verbatim
+JS_SITE=$TMP/site_js
+OUT=$TMP/out_js
+cp -R "$SITE" "$JS_SITE"
+mkdir -p "$JS_SITE/js"
+sed -i 's|</head>|<script defer src="/js/app.js"></script></head>|' "$JS_SITE/_templates/default.html"
+cat > "$JS_SITE/js/app.js" <<'EOF'
+if (x) /a  b/.test(s);
+if (y) { f(); } /e  f\/\/g/.exec(s);
+var z = (a) / 2 / (b);
+EOF
+"$FSG" generate -src="$JS_SITE" -output="$OUT" -bundle -cache="$TMP/cache_js" >/dev/null 2>&1
+check "regex after a condition is kept" grep -qF '/a  b/.test(s)' "$OUT"/js/bundle-*.js
+check "regex after a block is kept" grep -qF '/e  f\/\/g/.exec(s)' "$OUT"/js/bundle-*.js
+check "division after an expression is minified" grep -qF 'var z=(a)/2/(b);' "$OUT"/js/bundle-*.js
+
+### a cache and pack inside the source directory aren't pages
+OUT=$TMP/out_inside
+"$FSG" generate -src="$SITE" -output="$OUT" -search -cache="$SITE/cache" -pack="$SITE/site.pack" >/dev/null 2>&1
+"$FSG" generate -src="$SITE" -output="$OUT" -search -cache="$SITE/cache" -pack="$SITE/site.pack" >/dev/null 2>&1
+check "cache inside src isn't copied to the output" test ! -e "$OUT/cache"
+check "pack inside src isn't copied to the output" test ! -e "$OUT/site.pack"
+rm -rf "$SITE/cache" "$SITE/site.pack"
+
+### packs hold every servable file of the output, and the server remaps a rebuilt one
+OUT=$TMP/out_pack
+PACK=$TMP/site.pack
+"$FSG" generate -src="$SITE" -output="$OUT" -fingerprint -pack="$PACK" >/dev/null 2>&1
+check "pack starts with its magic and version" sh -c "[ \"\$(head -c 8 '$PACK')\" = FSGPACK1 ] && [ \$(od -An -tu4 -j8 -N4 '$PACK') -eq 1 ]"
+check "pack has an entry for every file in the output" sh -c "[ \$(od -An -tu4 -j12 -N4 '$PACK') -eq \$(find '$OUT' -type f | wc -l) ]"
+check "pack bodies are page aligned" pack_aligned "$PACK"
+
+PORT=$((20000 + $$ % 10000))
+"$FSG" server -pack="$PACK" -port=$PORT >/dev/null 2>&1 &
+SERVER=$!
+sleep 1
+CSS=$(cd "$OUT" && ls css/style.*.css | head -n 1)
+check "svg is served with its type" sh -c "curl -sI http://127.0.0.1:$PORT/logo.svg | grep -qi '^content-type: image/svg+xml'"
+check "fingerprinted files from a pack are immutable" sh -c "curl -sI http://127.0.0.1:$PORT/$CSS | grep -qi '^cache-control:.*immutable'"
+check "other files from a pack are not" sh -c "! curl -sI http://127.0.0.1:$PORT/css/style.css | grep -qi '^cache-control'"
+
+echo "second" > "$SITE/robots.txt"
+"$FSG" generate -src="$SITE" -output="$OUT" -fingerprint -pack="$PACK" >/dev/null 2>&1
+sleep 2
+check "server remaps a rebuilt pack" sh -c "curl -s http://127.0.0.1:$PORT/robots.txt | grep -q second"
+kill $SERVER
+wait $SERVER 2>/dev/null
+
+echo
+if [ "$FAILURES" -gt 0 ]; then
+    echo "$FAILURES checks failed"
+    exit 1
+fi
+echo "all checks passed"
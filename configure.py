@@ -2,6 +2,7 @@
 import os
 import sys
 import argparse
+import subprocess
 
 sourcedir = os.path.dirname(os.path.realpath(__file__))
 sys.path.insert(0, os.path.join(sourcedir, "tools/enki"))
@@ -12,6 +13,11 @@ parser.add_argument("-o", "--out", default="build", help="build generation outpu
 parser.add_argument("-d", "--debug", action="store_true", help="compile with debug info")
 parser.add_argument("--optimize", action="store_true", help="compile with optimizations")
 parser.add_argument("-v", "--verbose", action="store_true", help="verbose print generation info")
+parser.add_argument("--libclang", action="store_true", help="highlight C/C++ code blocks at build time with libclang")
+parser.add_argument("--images", action="store_true", default=None, help="require the image stage, which needs the stb headers in external/stb")
+parser.add_argument("--no-images", dest="images", action="store_false", help="build without the image stage")
+parser.add_argument("--llvm-jit", action="store_true", help="enable -jit, compiling templates with LLVM's ORC LLJIT, requires an LLVM install")
+parser.add_argument("--llvm-config", default="llvm-config", help="llvm-config of the LLVM install used by --llvm-jit")
 args = parser.parse_args();
 
 host_os   = sys.platform
@@ -73,7 +79,43 @@ dep(fsg, [ core ])
 if host_os == "win32": define(fsg, "_CRT_SECURE_NO_WARNINGS", public=True)
 include_path(fsg, ["$root/external"], public=True)
 
+# NOTE: the image stage is built whenever the stb headers are in external/stb. --images
+# makes their absence an error rather than building without it
+stb_headers = [ "stb_image.h", "stb_image_resize2.h", "stb_image_write.h" ]
+stb_missing = [ h for h in stb_headers if not os.path.exists(os.path.join(sourcedir, "external/stb", h)) ]
+if args.images and stb_missing:
+    sys.exit("configure.py: --images requires the stb headers in external/stb, missing: " + ", ".join(stb_missing) +
+             "\n  get them from https://github.com/nothings/stb, or configure with --no-images")
+if args.images is None and stb_missing:
+    print("configure.py: building without the image stage, missing in external/stb: " + ", ".join(stb_missing))
+if args.images != False and not stb_missing:
+    define(fsg, "FSG_STB_IMAGE")
+
+if args.libclang:
+    define(fsg, "FSG_LIBCLANG")
+    include_path(fsg, ["$root/external/LLVM/include"])
+    if target_os == "win32":
+        lib(fsg, [ "$root/external/LLVM/lib/win64/libclang.lib" ])
+    else:
+        lib(fsg, [ "clang" ])
+
+if args.llvm_jit:
+    # NOTE: the vendored llvm-c headers include llvm/Config from the install they were
+    # generated for, so the install's include directory is searched after them
+    llvm_includedir = subprocess.check_output([ args.llvm_config, "--includedir" ], text=True).strip()
+    llvm_libfiles = subprocess.check_output([ args.llvm_config, "--libfiles", "--link-shared" ], text=True).split()
+
+    define(fsg, "FSG_LLVM_JIT")
+    include_path(fsg, ["$root/external/LLVM/include", llvm_includedir])
+    lib(fsg, llvm_libfiles)
+
 cxx(fsg, "fsg.cpp")
 
+### fsg_loadgen
+if target_os == "linux":
+    loadgen = build.executable("fsg_loadgen", "$root")
+    dep(loadgen, [ core ])
+    cxx(loadgen, "fsg_loadgen.cpp")
+
 build.default = fsg
 build.generate()
@@ -6,6 +6,56 @@
 #include <stdarg.h>
 
 #include <functional>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include <sys/stat.h>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define FSG_SSE2 1
+#endif
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define FSG_AVX2 1
+#endif
+
+#if defined(FSG_LIBCLANG)
+#include "clang-c/Index.h"
+#endif
+
+#if defined(FSG_LLVM_JIT)
+#include "llvm-c/Analysis.h"
+#include "llvm-c/Core.h"
+#include "llvm-c/Error.h"
+#include "llvm-c/LLJIT.h"
+#include "llvm-c/Target.h"
+#endif
+
+#if defined(FSG_STB_IMAGE)
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb/stb_image.h"
+#define STB_IMAGE_RESIZE_IMPLEMENTATION
+#include "stb/stb_image_resize2.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb/stb_image_write.h"
+#endif
 
 struct TagProperty {
     String key;
@@ -31,22 +81,48 @@ enum LexerFlags : u32 {
     // long winded rewrites of the whole way I deal with templates and sections etc to
     // generate the page
     LEXER_FLAG_ENABLE_ANCHOR = 1 << 3,
+    LEXER_FLAG_ENABLE_IMAGE = 1 << 4,
 
     LEXER_FLAGS_DEFAULT = LEXER_FLAG_EAT_WHITESPACE,
 };
 
+// NOTE(jesper): a lexer in stream mode, see init_stream_lexer, holds a window of the
+// input and refills it as tokens are consumed. Tokens returned from a stream point into
+// the window and are only valid until the next token is lexed. The window only grows for
+// a token that doesn't fit, but that is all the stream mode saves, what the caller builds
+// from the tokens still grows with the input, see load_post_body
+#define LEXER_STREAM_CHUNK_SIZE (64*1024)
+
+// NOTE(jesper): the most bytes any token looks ahead past where it ends, a stream token
+// that ends closer than this to the end of the window is lexed again after a refill
+#define LEXER_STREAM_LOOKAHEAD 8
+
 struct Lexer {
     char *at;
     char *end;
 
     String debug_name;
     LexerFlags flags = LEXER_FLAGS_DEFAULT;
+
+    // NOTE(jesper): start of the last token, including any prefix such as the <!-- of a
+    // comment, and anything the flags made the lexer eat before it
+    char *token_start;
+
+    // NOTE(jesper): start of the input, or of the window in stream mode, and the offset of
+    // it in the input
+    char *buffer;
+    i64 buffer_offset;
+
+    FILE *stream;
+    i64 capacity;
+    bool stream_eof;
 };
 
 enum FsgTokenType : u8 {
     TOKEN_START = 127,
 
     TOKEN_ANCHOR,
+    TOKEN_IMAGE,
     TOKEN_CODE_BLOCK,
     TOKEN_CODE_INLINE,
 
@@ -73,29 +149,84 @@ const char* token_type_str(FsgTokenType type)
 struct Token {
     FsgTokenType type;
     String str;
+
+    // NOTE(jesper): offset of str in the input
+    i64 offset;
 };
 
+bool init_stream_lexer(Lexer *lexer, String path, LexerFlags flags)
+{
+    char sz_path[4096];
+    snprintf(sz_path, sizeof sz_path, "%.*s", STRFMT(path));
+
+    *lexer = {};
+    lexer->debug_name = path;
+    lexer->flags = flags;
+
+    lexer->stream = fopen(sz_path, "rb");
+    if (!lexer->stream) return false;
+
+    lexer->capacity = LEXER_STREAM_CHUNK_SIZE;
+    lexer->buffer = (char*)malloc(lexer->capacity);
+    lexer->at = lexer->end = lexer->token_start = lexer->buffer;
+    return true;
+}
+
+void destroy_stream_lexer(Lexer *lexer)
+{
+    if (lexer->stream) fclose(lexer->stream);
+    free(lexer->buffer);
+    *lexer = {};
+}
+
+// NOTE(jesper): discards everything before lexer->at and reads the next chunk into the
+// window. The window only grows when a single token doesn't fit in it
+void refill_lexer(Lexer *lexer)
+{
+    i64 keep = lexer->end - lexer->at;
+    i64 consumed = lexer->at - lexer->buffer;
+
+    if (consumed == 0 && keep == lexer->capacity) {
+        lexer->capacity *= 2;
+        lexer->buffer = (char*)realloc(lexer->buffer, lexer->capacity);
+    } else if (keep > 0) {
+        memmove(lexer->buffer, lexer->at, keep);
+    }
+
+    lexer->buffer_offset += consumed;
+    lexer->at = lexer->buffer;
+    lexer->end = lexer->buffer + keep;
+
+    size_t read = fread(lexer->end, 1, (size_t)(lexer->capacity - keep), lexer->stream);
+    lexer->end += read;
+
+    if (read == 0) {
+        if (ferror(lexer->stream)) LOG_ERROR("failed reading %.*s", STRFMT(lexer->debug_name));
+        lexer->stream_eof = true;
+    }
+}
+
 bool is_comment_start(Lexer *lexer)
 {
-    return (i32)(lexer->end - lexer->at) >= 4 && starts_with(String{ lexer->at, 4 }, "<!--");
+    return lexer->end - lexer->at >= 4 && starts_with(String{ lexer->at, 4 }, "<!--");
 }
 
 bool is_comment_end(Lexer *lexer)
 {
-    return (i32)(lexer->end - lexer->at) >= 3 && starts_with(String{ lexer->at, 3 }, "-->");
+    return lexer->end - lexer->at >= 3 && starts_with(String{ lexer->at, 3 }, "-->");
 }
 
-i32 bytes_remain(Lexer *lexer)
+i64 bytes_remain(Lexer *lexer)
 {
-    return (i32)(lexer->end - lexer->at);
+    return lexer->end - lexer->at;
 }
 
 bool starts_with(Lexer *lexer, String str)
 {
-    return starts_with(String{ lexer->at, bytes_remain(lexer) }, str);
+    return starts_with(String{ lexer->at, (i32)MIN(bytes_remain(lexer), (i64)str.length) }, str);
 }
 
-Token next_token(Lexer *lexer, LexerFlags flags)
+Token lex_token(Lexer *lexer, LexerFlags flags)
 {
     while (lexer->at < lexer->end) {
         if (lexer->at[0] == ' ' || lexer->at[0] == '\t') {
@@ -156,7 +287,8 @@ Token next_token(Lexer *lexer, LexerFlags flags)
 
             result.str.data = lexer->at++;
             while (lexer->at < lexer->end && !starts_with(lexer, "```")) {
-                lexer->at++;
+                char *tick = (char*)memchr(lexer->at+1, '`', lexer->end - lexer->at - 1);
+                lexer->at = tick ? tick : lexer->end;
             }
             result.str.length = (i32)(lexer->at - result.str.data);
 
@@ -189,6 +321,20 @@ Token next_token(Lexer *lexer, LexerFlags flags)
                 lexer->at++;
             }
 
+            result.str.length = (i32)(lexer->at - result.str.data);
+            return result;
+        } else if (lexer->flags & LEXER_FLAG_ENABLE_IMAGE &&
+                   starts_with(lexer, "<img") &&
+                   bytes_remain(lexer) > 4 &&
+                   !is_alpha(lexer->at[4]))
+        {
+            Token result;
+            result.type = TOKEN_IMAGE;
+            result.str.data = lexer->at++;
+
+            while (lexer->at < lexer->end && *lexer->at != '>') lexer->at++;
+            if (lexer->at < lexer->end) lexer->at++;
+
             result.str.length = (i32)(lexer->at - result.str.data);
             return result;
         } else if (is_alpha(lexer->at[0]) || is_number(lexer->at[0]) || (u8)lexer->at[0] >= 128) {
@@ -220,6 +366,51 @@ Token next_token(Lexer *lexer, LexerFlags flags)
     return result;
 }
 
+// NOTE(jesper): lexes the token following lexer into next without advancing lexer.
+// In stream mode this refills lexer's window until the token is complete
+Token lex_next(Lexer *lexer, LexerFlags flags, Lexer *next)
+{
+    if (!lexer->buffer) lexer->buffer = lexer->at;
+
+    while (true) {
+        *next = *lexer;
+        Token t = lex_token(next, flags);
+
+        if (!lexer->stream || lexer->stream_eof ||
+            next->end - next->at >= LEXER_STREAM_LOOKAHEAD)
+        {
+            char *p = t.str.data ? t.str.data : next->at;
+            t.offset = lexer->buffer_offset + (p - lexer->buffer);
+            next->token_start = lexer->at;
+            return t;
+        }
+
+        refill_lexer(lexer);
+    }
+}
+
+// NOTE(jesper): advances to the next '<' or '`', the only characters that start a token
+// spanning others. Everything skipped would have been lexed as whitespace, identifiers or
+// punctuation, so a pass that only looks at comments can skip the text in between rather
+// than lexing it
+void skip_to_markup(Lexer *lexer)
+{
+    while (true) {
+        while (lexer->at < lexer->end && *lexer->at != '<' && *lexer->at != '`') lexer->at++;
+        if (lexer->at < lexer->end || !lexer->stream || lexer->stream_eof) return;
+
+        refill_lexer(lexer);
+    }
+}
+
+Token next_token(Lexer *lexer, LexerFlags flags)
+{
+    Lexer next;
+    Token t = lex_next(lexer, flags, &next);
+    *lexer = next;
+    return t;
+}
+
 Token next_token(Lexer *lexer)
 {
     return next_token(lexer, lexer->flags);
@@ -228,8 +419,8 @@ Token next_token(Lexer *lexer)
 
 Token peek_next_token(Lexer *lexer)
 {
-    Lexer copy = *lexer;
-    return next_token(&copy, lexer->flags);
+    Lexer next;
+    return lex_next(lexer, lexer->flags, &next);
 }
 
 bool require_next_token(Lexer *lexer, FsgTokenType type, Token *out)
@@ -319,21 +510,29 @@ Array<TagProperty> parse_html_tag_properties(String tag)
         if (is_alpha(at[0])) {
             property.key.data = at++;
             while (at < end) {
-                if (*at == '>' || *at == '=' || *at == ' ') break;
+                if (*at == '>' || *at == '=' || *at == ' ' || *at == '/') break;
                 at++;
             }
             property.key.length = (i32)(at - property.key.data);
 
             if (at < end && *at == '=') {
-                at += 2;
-                property.value.data = at++;
+                at++;
+
+                char quote = 0;
+                if (at < end && (*at == '"' || *at == '\'')) quote = *at++;
+
+                property.value.data = at;
                 while (at < end) {
-                    if (*at == '"') break;
+                    if (quote ? *at == quote : (*at == ' ' || *at == '>')) break;
                     at++;
                 }
                 property.value.length = (i32)(at - property.value.data);
-                at++;
+                if (quote && at < end) at++;
             }
+        } else if (at < end) {
+            // NOTE(jesper): skip anything that can't start a property, e.g. newlines or
+            // the / in a self-closing tag
+            at++;
         }
 
         if (property.key.length > 0) {
@@ -371,17 +570,425 @@ String parse_html_tag_inner(String tag)
     return inner;
 }
 
+char* find_html_escape(char *at, char *end)
+{
+#if FSG_AVX2
+    __m256i lt32 = _mm256_set1_epi8('<');
+    __m256i gt32 = _mm256_set1_epi8('>');
+    __m256i amp32 = _mm256_set1_epi8('&');
+    __m256i dq32 = _mm256_set1_epi8('"');
+    __m256i sq32 = _mm256_set1_epi8('\'');
+
+    while (end-at >= 32) {
+        __m256i v = _mm256_loadu_si256((__m256i*)at);
+        __m256i m = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, lt32), _mm256_cmpeq_epi8(v, gt32)),
+            _mm256_or_si256(
+                _mm256_cmpeq_epi8(v, amp32),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, dq32), _mm256_cmpeq_epi8(v, sq32))));
+
+        u32 mask = (u32)_mm256_movemask_epi8(m);
+        if (mask) return at + __builtin_ctz(mask);
+        at += 32;
+    }
+#endif
+
+#if FSG_SSE2
+    __m128i lt = _mm_set1_epi8('<');
+    __m128i gt = _mm_set1_epi8('>');
+    __m128i amp = _mm_set1_epi8('&');
+    __m128i dq = _mm_set1_epi8('"');
+    __m128i sq = _mm_set1_epi8('\'');
+
+    while (end-at >= 16) {
+        __m128i v = _mm_loadu_si128((__m128i*)at);
+        __m128i m = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, lt), _mm_cmpeq_epi8(v, gt)),
+            _mm_or_si128(
+                _mm_cmpeq_epi8(v, amp),
+                _mm_or_si128(_mm_cmpeq_epi8(v, dq), _mm_cmpeq_epi8(v, sq))));
+
+        i32 mask = _mm_movemask_epi8(m);
+        if (mask) return at + __builtin_ctz(mask);
+        at += 16;
+    }
+#endif
+
+    while (at < end) {
+        if (*at == '<' || *at == '>' || *at == '&' || *at == '"' || *at == '\'') break;
+        at++;
+    }
+    return at;
+}
+
+// NOTE(jesper): clean runs between the characters that need escaping are found a vector at
+// a time and copied in bulk. Output is staged in a local buffer so the builder sees a few
+// large appends instead of one per entity
 void append_escape_html(StringBuilder *sb, String str)
 {
-    for (i32 i = 0; i < str.length; i++) {
-        switch (str[i]) {
-        case '<': append_string(sb, "&lt;"); break;
-        case '>': append_string(sb, "&gt;"); break;
-        default: append_char(sb, str[i]); break;
+    char buffer[4096];
+    i32 written = 0;
+
+    auto emit = [&](const char *data, i32 size) {
+        if (written + size > (i32)sizeof buffer) {
+            append_string(sb, String{ buffer, written });
+            written = 0;
+
+            if (size > (i32)sizeof buffer) {
+                append_string(sb, String{ (char*)data, size });
+                return;
+            }
+        }
+
+        memcpy(buffer+written, data, size);
+        written += size;
+    };
+
+    char *at = str.data;
+    char *end = str.data + str.length;
+
+    while (at < end) {
+        char *run = at;
+        at = find_html_escape(at, end);
+        if (at > run) emit(run, (i32)(at-run));
+        if (at == end) break;
+
+        switch (*at++) {
+        case '<': emit("&lt;", 4); break;
+        case '>': emit("&gt;", 4); break;
+        case '&': emit("&amp;", 5); break;
+        case '"': emit("&quot;", 6); break;
+        case '\'': emit("&#39;", 5); break;
+        }
+    }
+
+    if (written > 0) append_string(sb, String{ buffer, written });
+}
+
+bool is_void_html_element(String name)
+{
+    static const char *void_elements[] = {
+        "area", "base", "br", "col", "embed", "hr", "img", "input",
+        "link", "meta", "param", "source", "track", "wbr",
+    };
+
+    for (const char *e : void_elements) {
+        if (name == e) return true;
+    }
+    return false;
+}
+
+String create_excerpt(String html, i32 max_words, i32 max_bytes, Allocator mem)
+{
+    if (max_words <= 0 && max_bytes <= 0) return html;
+
+    // NOTE(jesper): the excerpt is only ever cut at a safe point: the end of a word, or
+    // right after a closing, void or comment tag. Between two safe points the only thing
+    // that can happen to the tag stack is pushes, so the stack depth at the last safe
+    // point is all we need to close everything that's still open in reverse order
+    String open_tags[64];
+    i32 open_count = 0;
+    i32 max_depth = (i32)(sizeof open_tags / sizeof open_tags[0]);
+
+    i32 words = 0;
+    bool in_word = false;
+
+    i32 safe_end = 0;
+    i32 safe_open_count = 0;
+
+    char *start = html.data;
+    char *end = html.data + html.length;
+    char *at = start;
+
+    while (at < end) {
+        if (max_bytes > 0 && (i32)(at-start) >= max_bytes) break;
+
+        if (at[0] == '<') {
+            char *tag_start = at;
+            bool comment = end-at >= 4 && starts_with(String{ at, 4 }, "<!--");
+
+            if (in_word) {
+                safe_end = (i32)(at-start);
+                safe_open_count = open_count;
+                in_word = false;
+            }
+
+            if (comment) {
+                at += 4;
+                while (at < end && !(end-at >= 3 && starts_with(String{ at, 3 }, "-->"))) at++;
+                at = MIN(at+3, end);
+            } else {
+                char quote = 0;
+                while (at < end) {
+                    if (quote) {
+                        if (at[0] == quote) quote = 0;
+                    } else if (at[0] == '"' || at[0] == '\'') {
+                        quote = at[0];
+                    } else if (at[0] == '>') {
+                        break;
+                    }
+                    at++;
+                }
+                at = MIN(at+1, end);
+            }
+
+            if (max_bytes > 0 && (i32)(at-start) > max_bytes) break;
+
+            bool safe = comment;
+            if (!comment) {
+                bool closing = tag_start[1] == '/';
+                String name{ tag_start + (closing ? 2 : 1), 0 };
+                while (name.data+name.length < at &&
+                       (is_alpha(name[name.length]) || is_number(name[name.length])))
+                {
+                    name.length++;
+                }
+
+                if (closing) {
+                    for (i32 i = open_count-1; i >= 0; i--) {
+                        if (open_tags[i] == name) {
+                            open_count = i;
+                            break;
+                        }
+                    }
+                    safe = true;
+                } else if (name.length == 0 || at[-2] == '/' || is_void_html_element(name)) {
+                    safe = true;
+                } else {
+                    if (open_count == max_depth) break;
+                    open_tags[open_count++] = name;
+                }
+            }
+
+            if (safe) {
+                safe_end = (i32)(at-start);
+                safe_open_count = open_count;
+            }
+        } else if (at[0] == ' ' || at[0] == '\t' || at[0] == '\n' || at[0] == '\r') {
+            if (in_word) {
+                safe_end = (i32)(at-start);
+                safe_open_count = open_count;
+                in_word = false;
+            }
+            at++;
+        } else {
+            if (!in_word) {
+                if (max_words > 0 && words == max_words) break;
+                words++;
+                in_word = true;
+            }
+            at++;
+        }
+    }
+
+    if (at >= end) return html;
+
+    SArena scratch = tl_scratch_arena(mem);
+    StringBuilder sb{ .alloc = scratch };
+
+    append_string(&sb, String{ start, safe_end });
+    for (i32 i = safe_open_count-1; i >= 0; i--) {
+        append_stringf(&sb, "</%.*s>", STRFMT(open_tags[i]));
+    }
+
+    return create_string(&sb, mem);
+}
+
+bool is_html_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+bool eq_ignore_case(String lhs, String rhs)
+{
+    if (lhs.length != rhs.length) return false;
+    for (i32 i = 0; i < lhs.length; i++) {
+        char a = lhs[i] >= 'A' && lhs[i] <= 'Z' ? lhs[i] - 'A' + 'a' : lhs[i];
+        char b = rhs[i] >= 'A' && rhs[i] <= 'Z' ? rhs[i] - 'A' + 'a' : rhs[i];
+        if (a != b) return false;
+    }
+    return true;
+}
+
+char* find_char(char *at, char *end, char c)
+{
+#if FSG_SSE2
+    __m128i needle = _mm_set1_epi8(c);
+    while (end-at >= 16) {
+        __m128i v = _mm_loadu_si128((__m128i*)at);
+        i32 mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+        if (mask) return at + __builtin_ctz(mask);
+        at += 16;
+    }
+#endif
+
+    while (at < end && *at != c) at++;
+    return at;
+}
+
+// NOTE(jesper): finds the next byte the minifier has to look at: a tag start, or the start
+// of a whitespace run that collapses into something shorter. Single spaces between words
+// are by far the most common whitespace and are skipped over without stopping
+char* find_minify_stop(char *at, char *end)
+{
+#if FSG_SSE2
+    __m128i lt = _mm_set1_epi8('<');
+    __m128i sp = _mm_set1_epi8(' ');
+    __m128i tab = _mm_set1_epi8('\t');
+    __m128i nl = _mm_set1_epi8('\n');
+    __m128i cr = _mm_set1_epi8('\r');
+
+    while (end-at >= 17) {
+        __m128i v0 = _mm_loadu_si128((__m128i*)at);
+        __m128i v1 = _mm_loadu_si128((__m128i*)(at+1));
+
+        __m128i sp0 = _mm_cmpeq_epi8(v0, sp);
+        __m128i other0 = _mm_or_si128(
+            _mm_cmpeq_epi8(v0, tab),
+            _mm_or_si128(_mm_cmpeq_epi8(v0, nl), _mm_cmpeq_epi8(v0, cr)));
+        __m128i ws1 = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v1, sp), _mm_cmpeq_epi8(v1, tab)),
+            _mm_or_si128(_mm_cmpeq_epi8(v1, nl), _mm_cmpeq_epi8(v1, cr)));
+
+        __m128i stop = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v0, lt), other0),
+            _mm_and_si128(sp0, ws1));
+
+        i32 mask = _mm_movemask_epi8(stop);
+        if (mask) return at + __builtin_ctz(mask);
+        at += 16;
+    }
+#endif
+
+    while (at < end) {
+        if (at[0] == '<' || at[0] == '\t' || at[0] == '\n' || at[0] == '\r') break;
+        if (at[0] == ' ' && at+1 < end && is_html_whitespace(at[1])) break;
+        at++;
+    }
+    return at;
+}
+
+bool is_minify_raw_element(String name, String tag)
+{
+    if (eq_ignore_case(name, "pre") ||
+        eq_ignore_case(name, "script") ||
+        eq_ignore_case(name, "textarea"))
+    {
+        return true;
+    }
+
+    if (eq_ignore_case(name, "code")) {
+        Array<TagProperty> properties = parse_html_tag_properties(tag);
+        for (TagProperty prop : properties) {
+            if (prop.key != "class") continue;
+
+            String classes = prop.value;
+            while (classes.length > 0) {
+                String token{ classes.data, 0 };
+                while (token.length < classes.length && !is_html_whitespace(classes[token.length])) token.length++;
+                if (token == "block") return true;
+
+                classes.data += token.length;
+                classes.length -= token.length;
+                while (classes.length > 0 && is_html_whitespace(classes[0])) {
+                    classes.data++;
+                    classes.length--;
+                }
+            }
         }
     }
+
+    return false;
 }
 
+void minify_html(StringBuilder *sb, String html)
+{
+    char *end = html.data + html.length;
+    char *at = html.data;
+    char *flushed = at;
+
+    while (at < end && is_html_whitespace(*at)) at++;
+    flushed = at;
+
+    while (at < end) {
+        at = find_minify_stop(at, end);
+        if (at == end) break;
+
+        if (at[0] == '<') {
+            Lexer lexer{ at, end, "minify" };
+            if (is_comment_start(&lexer)) {
+                Token t = next_token(&lexer, LEXER_FLAG_NONE);
+                bool conditional = starts_with(t.str, "[if") || starts_with(t.str, "<![endif]");
+
+                if (!conditional) {
+                    append_string(sb, String{ flushed, (i32)(at-flushed) });
+
+                    // NOTE(jesper): the whitespace in front of the comment has already been
+                    // collapsed, so drop the run following it
+                    if (at > html.data && is_html_whitespace(at[-1])) {
+                        while (lexer.at < end && is_html_whitespace(*lexer.at)) lexer.at++;
+                    }
+                    flushed = lexer.at;
+                }
+
+                at = lexer.at;
+                continue;
+            }
+
+            char *tag_start = at++;
+            char quote = 0;
+            while (at < end) {
+                if (quote) {
+                    if (*at == quote) quote = 0;
+                } else if (*at == '"' || *at == '\'') {
+                    quote = *at;
+                } else if (*at == '>') {
+                    break;
+                }
+                at++;
+            }
+            at = MIN(at+1, end);
+
+            String name{ tag_start+1, 0 };
+            while (name.data+name.length < at &&
+                   (is_alpha(name[name.length]) || is_number(name[name.length])))
+            {
+                name.length++;
+            }
+
+            if (name.length > 0 && is_minify_raw_element(name, String{ tag_start, (i32)(at-tag_start) })) {
+                while (at < end) {
+                    at = find_char(at, end, '<');
+                    if (at == end) break;
+
+                    // NOTE(jesper): the name must end the tag's, so </pre doesn't match </prefix
+                    if (end-at >= name.length+3 && at[1] == '/' &&
+                        eq_ignore_case(String{ at+2, name.length }, name) &&
+                        (at[name.length+2] == '>' || is_html_whitespace(at[name.length+2])))
+                    {
+                        at = find_char(at, end, '>');
+                        at = MIN(at+1, end);
+                        break;
+                    }
+                    at++;
+                }
+            }
+        } else {
+            char *ws_start = at;
+            bool newline = false;
+            while (at < end && is_html_whitespace(*at)) {
+                newline = newline || *at == '\n' || *at == '\r';
+                at++;
+            }
+
+            append_string(sb, String{ flushed, (i32)(ws_start-flushed) });
+            if (at < end) append_char(sb, newline ? '\n' : ' ');
+            flushed = at;
+        }
+    }
+
+    append_string(sb, String{ flushed, (i32)(end-flushed) });
+}
 
 String join_url(String lhs, String rhs)
 {
@@ -418,9 +1025,119 @@ bool is_identifier(Token t, String str)
     return t.type == TOKEN_IDENTIFIER && t.str == str;
 }
 
+u64 hash_bytes(void *data, i32 size)
+{
+    u64 h = 0xcbf29ce484222325ull;
+    for (i32 i = 0; i < size; i++) {
+        h ^= ((u8*)data)[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// NOTE(jesper): interned strings, so that tag, template and variable names are compared
+// and looked up as 32-bit ids. Interning takes a lock, as posts are loaded in parallel,
+// but symbol_str doesn't, so it mustn't be called while anything is being interned
+typedef u32 FsgSymbol;
+
+// NOTE(jesper): interned first and in this order, so that the builtin variables can be
+// switched on
+enum FsgBuiltinSymbol : FsgSymbol {
+    SYM_NONE = 0,
+    SYM_POST_CREATED,
+    SYM_POST_TITLE,
+    SYM_POST_URL,
+    SYM_POST_BRIEF,
+    SYM_POST_CONTENT,
+    SYM_POST_TAGS,
+    SYM_POSTS_BRIEF,
+    SYM_POSTS_FULL,
+    SYM_PAGE_TITLE,
+    SYM_PAGE_SUBTITLE,
+    SYM_TAG_STR,
+    SYM_BUILTIN_COUNT,
+};
+
+struct FsgSymbolTable {
+    std::mutex mutex;
+    DynamicArray<String> strs;
+
+    // NOTE(jesper): open addressing, a slot holds symbol+1 so that 0 marks it empty
+    u32 *slots;
+    i32 slot_count;
+};
+
+FsgSymbolTable* get_symbol_table();
+
+FsgSymbol intern(String str)
+{
+    FsgSymbolTable *table = get_symbol_table();
+    std::lock_guard<std::mutex> lock(table->mutex);
+
+    u32 mask = (u32)table->slot_count-1;
+    u32 slot = (u32)hash_bytes(str.data, str.length) & mask;
+    for (; table->slots[slot]; slot = (slot+1) & mask) {
+        if (table->strs[table->slots[slot]-1] == str) return table->slots[slot]-1;
+    }
+
+    FsgSymbol symbol = (FsgSymbol)table->strs.count;
+    array_add(&table->strs, duplicate_string(str, mem_dynamic));
+    table->slots[slot] = symbol+1;
+
+    if (table->strs.count*2 > table->slot_count) {
+        i32 slot_count = table->slot_count*2;
+        u32 *slots = (u32*)calloc(slot_count, sizeof *slots);
+
+        for (i32 i = 0; i < table->strs.count; i++) {
+            u32 s = (u32)hash_bytes(table->strs[i].data, table->strs[i].length) & (u32)(slot_count-1);
+            while (slots[s]) s = (s+1) & (u32)(slot_count-1);
+            slots[s] = (u32)i+1;
+        }
+
+        free(table->slots);
+        table->slots = slots;
+        table->slot_count = slot_count;
+    }
+
+    return symbol;
+}
+
+FsgSymbolTable* get_symbol_table()
+{
+    static FsgSymbolTable table{};
+
+    if (!table.slots) {
+        table.slot_count = 256;
+        table.slots = (u32*)calloc(table.slot_count, sizeof *table.slots);
+
+        const char *builtins[] = {
+            "", "post.created", "post.title", "post.url", "post.brief", "post.content", "post.tags",
+            "posts.brief", "posts.full", "page.title", "page.subtitle", "tag.str",
+        };
+        static_assert(sizeof builtins / sizeof builtins[0] == SYM_BUILTIN_COUNT);
+
+        for (const char *str : builtins) {
+            array_add(&table.strs, duplicate_string(str, mem_dynamic));
+
+            String s = table.strs[table.strs.count-1];
+            u32 slot = (u32)hash_bytes(s.data, s.length) & (u32)(table.slot_count-1);
+            while (table.slots[slot]) slot = (slot+1) & (u32)(table.slot_count-1);
+            table.slots[slot] = (u32)table.strs.count;
+        }
+    }
+
+    return &table;
+}
+
+String symbol_str(FsgSymbol symbol)
+{
+    return get_symbol_table()->strs[symbol];
+}
+
 enum FsgPartType {
     FSG_PART_CHUNK = 0,
     FSG_PART_VARIABLE,
+    FSG_PART_INCLUDE,
 };
 
 struct FsgPart {
@@ -429,18 +1146,71 @@ struct FsgPart {
     union {
         String variable;
     };
+    FsgSymbol symbol;
 
-    i32 offset;
-    i32 length;
+    // NOTE(jesper): the literal text preceding the part. Points into the contents of the
+    // template or page the part was parsed from, which after includes are flattened
+    // needn't be the one it's rendered with
+    String text;
 };
 
+enum FsgTemplateState {
+    FSG_TEMPLATE_UNRESOLVED = 0,
+    FSG_TEMPLATE_RESOLVING,
+    FSG_TEMPLATE_RESOLVED,
+};
+
+// NOTE(jesper): the stat of a source file when it was last loaded, used by the daemon
+// to tell which inputs changed between requests
+struct FsgSourceStat {
+    i64 mtime;
+    i64 size;
+};
+
+bool operator==(FsgSourceStat lhs, FsgSourceStat rhs)
+{
+    return lhs.mtime == rhs.mtime && lhs.size == rhs.size;
+}
+
+bool stat_source(String path, FsgSourceStat *st)
+{
+    char sz_path[4096];
+    snprintf(sz_path, sizeof sz_path, "%.*s", STRFMT(path));
+
+    struct stat s;
+    if (stat(sz_path, &s) != 0) return false;
+
+#if defined(__linux__)
+    st->mtime = (i64)s.st_mtim.tv_sec*1000000000 + s.st_mtim.tv_nsec;
+#else
+    st->mtime = (i64)s.st_mtime*1000000000;
+#endif
+    st->size = (i64)s.st_size;
+    return true;
+}
+
+struct FsgPost;
+struct FsgJitBuffer;
+
+typedef char* FsgJitReserveProc(FsgJitBuffer *buffer, i64 length);
+typedef void FsgTemplateProc(FsgJitBuffer *buffer, FsgPost *post, String *tags_html, FsgJitReserveProc *reserve);
+
 struct FsgTemplate {
     String name;
+    FsgSymbol symbol;
     String contents;
     Array<FsgPart> parts;
+    FsgTemplateState state;
+
+    // NOTE(jesper): set when the template was compiled, see compile_templates
+    FsgTemplateProc *render;
 };
 
 struct FsgPage {
+    String src_path;
+    FsgSourceStat stat;
+    bool dirty;
+
     String path;
     String name;
     String title;
@@ -452,68 +1222,671 @@ struct FsgPage {
 };
 
 struct FsgPost {
+    i32 id;
+    String src_path;
+    FsgSourceStat stat;
+    bool dirty;
+
     String path;
     String title;
     String created;
-    DynamicArray<String> tags;
+    DynamicArray<FsgSymbol> tags;
     String url;
     bool draft;
+
+    // NOTE(jesper): converted by load_post_body, separately from the metadata. In low
+    // memory mode the content is dropped again once the post's page is written, and
+    // converted again whenever it's needed after that, see stream_posts. The content of a
+    // post whose search terms failed to be cached is kept, it's the only source of them
+    bool has_body;
+    bool content_dropped;
+    bool terms_uncached;
+    u64 content_hash;
     String brief;
     String content;
 };
 
 struct FsgTag {
+    FsgSymbol symbol;
     String str;
-    DynamicArray<FsgPost> posts;
+    String link;
+
+    // NOTE(jesper): indices into site->posts, in the order they're listed
+    DynamicArray<i32> posts;
+    bool dirty;
 };
 
-i32 find_template_index(Array<FsgTemplate> templates, String name)
+i32 find_template_index(Array<FsgTemplate> templates, FsgSymbol name)
 {
     for (i32 i = 0; i < templates.count; i++) {
-        if (templates.data[i].name == name) return i;
+        if (templates.data[i].symbol == name) return i;
     }
     return -1;
 
 }
 
-FsgTemplate* find_template(Array<FsgTemplate> templates, String name)
+FsgTemplate* find_template(Array<FsgTemplate> templates, FsgSymbol name)
 {
     for (i32 i = 0; i < templates.count; i++) {
-        if (templates.data[i].name == name) return &templates.data[i];
+        if (templates.data[i].symbol == name) return &templates.data[i];
     }
     return nullptr;
 
 }
 
-void sort_posts(Array<FsgPost> posts)
+FsgTemplate* find_template(Array<FsgTemplate> templates, String name)
 {
-    for (i32 i = 0; i < posts.count; i++) {
-        for (i32 j = i; j > 0 && posts[j-1].created < posts[j].created; j--) {
-            SWAP(posts[j], posts[j-1]);
-        }
-    }
+    return find_template(templates, intern(name));
 }
 
-void copy_files(String root, String folder, String dst)
+// NOTE(jesper): resolves fsg: include name; parts by splicing in the parts of the included
+// template, recursively, so rendering never has to look anything up
+void flatten_template(Array<FsgTemplate> templates, FsgTemplate *tmpl)
 {
-    SArena scratch = tl_scratch_arena();
-
-    DynamicArray<String> files = list_files(join_path(root, folder, scratch), scratch, FILE_LIST_RECURSIVE);
+    if (tmpl->state == FSG_TEMPLATE_RESOLVED) return;
+    tmpl->state = FSG_TEMPLATE_RESOLVING;
 
-    for (String p : files) {
-        SArena mem_file = tl_scratch_arena(scratch);
+    DynamicArray<FsgPart> parts{};
+    for (FsgPart part : tmpl->parts) {
+        if (part.type != FSG_PART_INCLUDE) {
+            array_add(&parts, part);
+            continue;
+        }
 
-        FileInfo contents = read_file(p, mem_file);
+        if (part.text.length > 0) array_add(&parts, FsgPart{ .type = FSG_PART_CHUNK, .text = part.text });
+
+        FsgTemplate *included = find_template(templates, part.symbol);
+        if (!included) {
+            LOG_ERROR("unknown template '%.*s' included from '%.*s'", STRFMT(part.variable), STRFMT(tmpl->name));
+            continue;
+        }
+
+        if (included->state == FSG_TEMPLATE_RESOLVING) {
+            LOG_ERROR("include cycle: '%.*s' includes '%.*s'", STRFMT(tmpl->name), STRFMT(included->name));
+            continue;
+        }
+
+        flatten_template(templates, included);
+        for (FsgPart p : included->parts) array_add(&parts, p);
+    }
+
+    tmpl->parts = parts;
+    tmpl->state = FSG_TEMPLATE_RESOLVED;
+}
+
+// NOTE(jesper): splices the page's parts into its template at the destination section, so
+// that a page renders in a single pass over its own parts
+Array<FsgPart> flatten_page(FsgTemplate *tmpl, String dst_section_name, Array<FsgPart> page_parts)
+{
+    FsgSymbol dst_section = intern(dst_section_name);
+
+    DynamicArray<FsgPart> parts{};
+    for (FsgPart part : tmpl->parts) {
+        if (part.type == FSG_PART_VARIABLE && part.symbol == dst_section) {
+            if (part.text.length > 0) array_add(&parts, FsgPart{ .type = FSG_PART_CHUNK, .text = part.text });
+            for (FsgPart p : page_parts) array_add(&parts, p);
+        } else {
+            array_add(&parts, part);
+        }
+    }
+    return parts;
+}
+
+// NOTE(jesper): posts are listed newest first, and posts created on the same date by their
+// source path, so that the daemon lists them in the same order as a full build regardless
+// of the order they were loaded in
+struct FsgPostSortKey {
+    String created;
+    String src_path;
+    i32 index;
+};
+
+int compare_post_sort_keys(const void *lhs, const void *rhs)
+{
+    FsgPostSortKey *a = (FsgPostSortKey*)lhs;
+    FsgPostSortKey *b = (FsgPostSortKey*)rhs;
+
+    if (a->created != b->created) return b->created < a->created ? -1 : 1;
+    return a->src_path < b->src_path ? -1 : b->src_path < a->src_path ? 1 : 0;
+}
+
+// NOTE(jesper): sorts the post indices, the posts themselves never move
+void sort_posts(Array<i32> order, Array<FsgPost> posts)
+{
+    FsgPostSortKey *keys = (FsgPostSortKey*)calloc(MAX(order.count, 1), sizeof *keys);
+    defer { free(keys); };
+
+    for (i32 i = 0; i < order.count; i++) {
+        keys[i] = { posts[order[i]].created, posts[order[i]].src_path, order[i] };
+    }
+
+    qsort(keys, order.count, sizeof *keys, compare_post_sort_keys);
+    for (i32 i = 0; i < order.count; i++) order[i] = keys[i].index;
+}
+
+void parallel_for(i32 count, std::function<void(i32)> proc)
+{
+    std::thread threads[64];
+    i32 num_threads = MIN(MIN(count, (i32)std::thread::hardware_concurrency()), (i32)(sizeof threads / sizeof threads[0]));
+
+    if (num_threads <= 1) {
+        for (i32 i = 0; i < count; i++) proc(i);
+        return;
+    }
+
+    std::atomic<i32> next{ 0 };
+    for (i32 i = 0; i < num_threads; i++) {
+        threads[i] = std::thread([&]() {
+            for (i32 j = next++; j < count; j = next++) proc(j);
+        });
+    }
+
+    for (i32 i = 0; i < num_threads; i++) threads[i].join();
+}
+
+// NOTE(jesper): a source file and its stat as of when its directory was walked, which is
+// what the daemon compares against to tell whether it has to be reloaded
+struct FsgSourceFile {
+    String path;
+    FsgSourceStat stat;
+};
+
+int compare_source_files(const void *lhs, const void *rhs)
+{
+    String a = ((FsgSourceFile*)lhs)->path;
+    String b = ((FsgSourceFile*)rhs)->path;
+    return a < b ? -1 : b < a ? 1 : 0;
+}
+
+FsgSourceFile* find_source_file(Array<FsgSourceFile> files, String path)
+{
+    FsgSourceFile key{ .path = path };
+    return (FsgSourceFile*)bsearch(&key, files.data, files.count, sizeof key, compare_source_files);
+}
+
+#if defined(__linux__)
+struct FsgDirent64 {
+    u64 d_ino;
+    i64 d_off;
+    u16 d_reclen;
+    u8 d_type;
+    char d_name[1];
+};
+
+// NOTE(jesper): reads a single directory with getdents64 directly, so that a directory
+// with thousands of entries takes a handful of syscalls, and stats its files relative to
+// the directory fd instead of resolving every full path. Called from the walker's worker
+// threads, so everything it returns is allocated from mem_dynamic
+void walk_source_dir(String dir, DynamicArray<FsgSourceFile> *files, DynamicArray<String> *dirs)
+{
+    char sz_dir[4096];
+    snprintf(sz_dir, sizeof sz_dir, "%.*s", STRFMT(dir));
+
+    int fd = open(sz_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) return;
+    defer { close(fd); };
+
+    alignas(8) char buffer[32*1024];
+    while (true) {
+        long length = syscall(SYS_getdents64, fd, buffer, sizeof buffer);
+        if (length <= 0) break;
+
+        for (long at = 0; at < length; ) {
+            FsgDirent64 *entry = (FsgDirent64*)(buffer+at);
+            at += entry->d_reclen;
+
+            if (entry->d_name[0] == '.') continue;
+
+            String name{ entry->d_name, (i32)strlen(entry->d_name) };
+            if (entry->d_type == DT_DIR) {
+                array_add(dirs, join_path(dir, name, mem_dynamic));
+                continue;
+            }
+
+            // NOTE(jesper): symlinks and filesystems that don't fill in d_type are
+            // resolved by the stat
+            if (entry->d_type != DT_REG && entry->d_type != DT_LNK && entry->d_type != DT_UNKNOWN) continue;
+
+            struct stat s;
+            if (fstatat(fd, entry->d_name, &s, 0) != 0) continue;
+
+            if (S_ISDIR(s.st_mode)) {
+                array_add(dirs, join_path(dir, name, mem_dynamic));
+                continue;
+            }
+            if (!S_ISREG(s.st_mode)) continue;
+
+            FsgSourceFile file{};
+            file.path = join_path(dir, name, mem_dynamic);
+            file.stat.mtime = (i64)s.st_mtim.tv_sec*1000000000 + s.st_mtim.tv_nsec;
+            file.stat.size = (i64)s.st_size;
+            array_add(files, file);
+        }
+    }
+}
+
+// NOTE(jesper): walks the directory tree a level at a time, reading the directories of a
+// level in parallel. skip_dir is called with the path of each directory found, to prune
+// it. The files are sorted by path, so that the order posts and pages are loaded in
+// doesn't depend on the filesystem
+DynamicArray<FsgSourceFile> list_source_files(
+    String root,
+    bool recursive,
+    std::function<bool(String)> skip_dir,
+    Allocator mem)
+{
+    DynamicArray<FsgSourceFile> files{};
+
+    DynamicArray<String> level{};
+    array_add(&level, duplicate_string(root, mem_dynamic));
+
+    while (level.count > 0) {
+        DynamicArray<DynamicArray<FsgSourceFile>> level_files{};
+        DynamicArray<DynamicArray<String>> level_dirs{};
+        for (i32 i = 0; i < level.count; i++) {
+            array_add(&level_files, DynamicArray<FsgSourceFile>{});
+            array_add(&level_dirs, DynamicArray<String>{});
+        }
+
+        parallel_for(level.count, [&](i32 i) {
+            walk_source_dir(level[i], &level_files[i], &level_dirs[i]);
+        });
+
+        DynamicArray<String> next{};
+        for (i32 i = 0; i < level.count; i++) {
+            for (FsgSourceFile file : level_files[i]) {
+                array_add(&files, FsgSourceFile{ duplicate_string(file.path, mem), file.stat });
+                destroy_string(file.path);
+            }
+
+            for (String dir : level_dirs[i]) {
+                if (recursive && !(skip_dir && skip_dir(dir))) {
+                    array_add(&next, dir);
+                } else {
+                    destroy_string(dir);
+                }
+            }
+
+            destroy_string(level[i]);
+        }
+
+        level = next;
+    }
+
+    qsort(files.data, files.count, sizeof *files.data, compare_source_files);
+    return files;
+}
+#else
+DynamicArray<FsgSourceFile> list_source_files(
+    String root,
+    bool recursive,
+    std::function<bool(String)> skip_dir,
+    Allocator mem)
+{
+    DynamicArray<FsgSourceFile> files{};
+
+    DynamicArray<String> paths = list_files(root, mem, recursive ? FILE_LIST_RECURSIVE : 0);
+    for (String p : paths) {
+        bool skipped = false;
+        for (i32 i = root.length+1; i < p.length && skip_dir && !skipped; i++) {
+            if (p[i] == '/' || p[i] == '\\') skipped = skip_dir(String{ p.data, i });
+        }
+        if (skipped) continue;
+
+        FsgSourceFile file{ .path = p };
+        stat_source(p, &file.stat);
+        array_add(&files, file);
+    }
+
+    qsort(files.data, files.count, sizeof *files.data, compare_source_files);
+    return files;
+}
+#endif
+
+#define FSG_IMMUTABLE_CACHE_CONTROL "public, max-age=31536000, immutable"
+
+struct FsgAsset {
+    String url;
+    String fingerprinted_url;
+};
+
+String asset_url(String root, String path, Allocator mem)
+{
+    String url = duplicate_string(String{ path.data+root.length, path.length-root.length }, mem);
+    for (i32 i = 0; i < url.length; i++) {
+        if (url[i] == '\\') url[i] = '/';
+    }
+    return url;
+}
+
+i32 url_extension_offset(String url)
+{
+    for (i32 i = url.length-1; i >= 0 && url[i] != '/'; i--) {
+        if (url[i] == '.') return i;
+    }
+    return url.length;
+}
+
+String fingerprint_url(String url, u64 hash, Allocator mem)
+{
+    i32 ext = url_extension_offset(url);
+
+    u32 h32 = (u32)(hash ^ (hash >> 32));
+    return stringf(mem, "%.*s.%08x%.*s", ext, url.data, h32, url.length-ext, url.data+ext);
+}
+
+bool is_fingerprinted_path(String path)
+{
+    i32 ext = path.length-1;
+    while (ext >= 0 && path[ext] != '.' && path[ext] != '/' && path[ext] != '\\') ext--;
+    if (ext < 9 || path[ext] != '.' || path[ext-9] != '.') return false;
+
+    for (i32 i = ext-8; i < ext; i++) {
+        char c = path[i];
+        if (!is_number(c) && !(c >= 'a' && c <= 'f')) return false;
+    }
+    return true;
+}
+
+#include "fsg_http.cpp"
+
+// NOTE(jesper): the assets are kept sorted by url as they're added, because the
+// stylesheets copied later look up the fonts and images copied before them
+void insert_asset(DynamicArray<FsgAsset> *assets, FsgAsset asset)
+{
+    array_add(assets, asset);
+    for (i32 i = assets->count-1; i > 0 && (*assets)[i].url < (*assets)[i-1].url; i--) {
+        SWAP((*assets)[i], (*assets)[i-1]);
+    }
+}
+
+FsgAsset* find_asset(Array<FsgAsset> assets, String url)
+{
+    i32 lo = 0, hi = assets.count;
+    while (lo < hi) {
+        i32 mid = lo + (hi-lo)/2;
+        if (assets[mid].url == url) return &assets[mid];
+        if (assets[mid].url < url) lo = mid+1;
+        else hi = mid;
+    }
+    return nullptr;
+}
+
+// NOTE(jesper): rewrites root-relative URLs of fingerprinted assets that appear directly
+// after a quote or an opening paren, which covers html attributes as well as css url()
+void append_rewritten_asset_urls(StringBuilder *sb, String text, Array<FsgAsset> assets)
+{
+    char *at = text.data;
+    char *end = text.data + text.length;
+    char *flushed = at;
+
+    while (at < end) {
+        char c = *at++;
+        if (c != '"' && c != '\'' && c != '(') continue;
+        if (at >= end || *at != '/') continue;
+
+        char *url_start = at;
+        while (at < end &&
+               *at != '"' && *at != '\'' && *at != ')' && *at != '>' &&
+               *at != '?' && *at != '#' && !is_html_whitespace(*at))
+        {
+            at++;
+        }
+
+        FsgAsset *asset = find_asset(assets, String{ url_start, (i32)(at-url_start) });
+        if (asset) {
+            append_string(sb, String{ flushed, (i32)(url_start-flushed) });
+            append_string(sb, asset->fingerprinted_url);
+            flushed = at;
+        }
+    }
+
+    append_string(sb, String{ flushed, (i32)(end-flushed) });
+}
+
+void copy_files(String root, String folder, String dst, bool fingerprint, DynamicArray<FsgAsset> *assets)
+{
+    SArena scratch = tl_scratch_arena();
+
+    DynamicArray<String> files = list_files(join_path(root, folder, scratch), scratch, FILE_LIST_RECURSIVE);
+
+    for (String p : files) {
+        SArena mem_file = tl_scratch_arena(scratch);
+
+        FileInfo contents = read_file(p, mem_file);
 
         String filename{ p.data+root.length, p.length-root.length };
+
+        if (fingerprint) {
+            String url = asset_url(root, p, mem_dynamic);
+
+            // NOTE(jesper): stylesheets reference fonts and images, which are copied
+            // first, so their url()s are rewritten before the stylesheet itself is hashed
+            if (ends_with(url, ".css") && assets->count > 0) {
+                StringBuilder sb{ .alloc = mem_file };
+                append_rewritten_asset_urls(&sb, String{ (char*)contents.data, contents.size }, *assets);
+
+                String rewritten = create_string(&sb, mem_file);
+                contents.data = (u8*)rewritten.data;
+                contents.size = rewritten.length;
+            }
+
+            FsgAsset asset{
+                .url = url,
+                .fingerprinted_url = fingerprint_url(url, hash_bytes(contents.data, contents.size), mem_dynamic),
+            };
+            insert_asset(assets, asset);
+
+            // NOTE(jesper): only root-relative urls in html and css are rewritten, so the
+            // original is kept alongside the fingerprinted copy for everything else:
+            // relative urls, srcset lists, urls built by scripts
+            write_file(join_path(dst, filename, mem_file), contents.data, contents.size);
+            filename = asset.fingerprinted_url;
+        }
+
         String out_file = join_path(dst, filename, mem_file);
 
         write_file(out_file, contents.data, contents.size);
     }
 }
 
+void write_asset_manifest(String output, Array<FsgAsset> assets, Array<FsgAsset> bundles)
+{
+    SArena scratch = tl_scratch_arena();
+    StringBuilder sb{ .alloc = scratch };
+
+    append_string(&sb, "[\n");
+    for (i32 i = 0; i < assets.count + bundles.count; i++) {
+        FsgAsset asset = i < assets.count ? assets[i] : bundles[i-assets.count];
+        append_stringf(
+            &sb,
+            "  { \"src\": \"%.*s\", \"url\": \"%.*s\", \"cache_control\": \"%s\" }%s\n",
+            STRFMT(asset.url),
+            STRFMT(asset.fingerprinted_url),
+            FSG_IMMUTABLE_CACHE_CONTROL,
+            i < assets.count+bundles.count-1 ? "," : "");
+    }
+    append_string(&sb, "]\n");
+
+    write_file(join_path(output, "asset-manifest.json", scratch), &sb);
+}
+
 volatile bool html_dirty = false;
 
+#define FSG_MAX_IMAGE_WIDTHS 8
+
+struct FsgOptions {
+    bool build_drafts = false;
+
+    // NOTE(jesper): budget for automatic post briefs, used when a post has no explicit
+    // fsg: brief; marker. 0 disables the respective limit
+    i32 brief_max_words = 80;
+    i32 brief_max_bytes = 4096;
+
+    bool minify = false;
+    bool fingerprint = false;
+
+    // NOTE(jesper): bundle and minify the stylesheets and scripts of each template, see
+    // bundle_template_assets
+    bool bundle = false;
+
+    // NOTE(jesper): inline the css rules each template's markup uses into its <head> and
+    // load the full stylesheets asynchronously, see inline_critical_css
+    bool critical_css = false;
+
+    // NOTE(jesper): widths of the downscaled variants generated for images under img/ and
+    // assets/, no widths disables the image stage
+    i32 image_widths[FSG_MAX_IMAGE_WIDTHS];
+    i32 image_width_count = 0;
+    String image_sizes = "100vw";
+
+    // NOTE(jesper): build artifacts that survive between runs, defaults to src/_cache
+    String cache_dir;
+
+    bool search = false;
+    i32 search_shards = 64;
+
+    // NOTE(jesper): unix domain socket the daemon listens on, defaults to cache/fsg.sock
+    String socket_path;
+
+    i32 port = 8080;
+    i32 workers = 1;
+    bool pin_workers = false;
+
+    // NOTE(jesper): when set the output is also written as a single pack file, which the
+    // server serves from instead of the output directory, see write_pack
+    String pack_path;
+
+    // NOTE(jesper): low memory mode, when non-zero. Posts are converted and written in
+    // batches estimated to fit in this many megabytes, and only their metadata and brief
+    // stay resident afterwards, see stream_posts. It's a hint for the batch size rather
+    // than a bound: the estimate is per post, a post larger than the budget is still
+    // converted on its own, and the metadata, briefs and templates aren't counted
+    i32 memory_budget_mb = 0;
+
+    // NOTE(jesper): report the weight of every rendered page as json, to report_path or
+    // stdout when it's empty, and fail when a page is over one of the budgets. A budget of
+    // 0 is unlimited, see write_page_report
+    bool report = false;
+    String report_path;
+    i64 max_html_bytes = 0;
+    i64 max_page_bytes = 0;
+
+    // NOTE(jesper): compile the post templates rather than interpret them, and optionally
+    // benchmark the two against each other before rendering, see compile_templates
+    bool jit_templates = false;
+    i32 bench_templates = 0;
+};
+
+// NOTE(jesper): the weight of a rendered page for the page-weight report, see -report.
+// References are the root-relative urls of the resources the page loads directly
+struct FsgPageReport {
+    String url;
+    i64 html_bytes;
+    DynamicArray<String> references;
+
+    i64 asset_bytes;
+    i32 post_count;
+    f64 render_ms;
+    bool over_budget;
+};
+
+void collect_page_references(FsgPageReport *report, String html)
+{
+    char *at = html.data;
+    char *end = html.data + html.length;
+
+    while (at < end) {
+        at = find_char(at, end, '<');
+        char *tag_end = find_char(at, end, '>');
+        if (tag_end == end) break;
+
+        String tag{ at, (i32)(tag_end+1-at) };
+        at++;
+
+        String name{ at, 0 };
+        while (name.data+name.length < tag_end && is_alpha(name[name.length])) name.length++;
+
+        bool is_link = eq_ignore_case(name, "link");
+        if (!is_link &&
+            !eq_ignore_case(name, "img") && !eq_ignore_case(name, "script") &&
+            !eq_ignore_case(name, "source") && !eq_ignore_case(name, "video") &&
+            !eq_ignore_case(name, "audio"))
+        {
+            continue;
+        }
+
+        String rel{}, url{};
+        for (TagProperty property : parse_html_tag_properties(tag)) {
+            if (eq_ignore_case(property.key, "rel")) rel = property.value;
+            else if (eq_ignore_case(property.key, is_link ? "href" : "src")) url = property.value;
+        }
+
+        if (is_link &&
+            !eq_ignore_case(rel, "stylesheet") && !eq_ignore_case(rel, "preload") &&
+            !eq_ignore_case(rel, "modulepreload") && !eq_ignore_case(rel, "icon"))
+        {
+            continue;
+        }
+
+        if (url.length < 2 || url[0] != '/' || url[1] == '/') continue;
+        for (i32 i = 0; i < url.length; i++) {
+            if (url[i] == '?' || url[i] == '#') url.length = i;
+        }
+
+        bool seen = false;
+        for (String reference : report->references) seen = seen || reference == url;
+        if (!seen) array_add(&report->references, duplicate_string(url, mem_dynamic));
+    }
+}
+
+void write_html(String path, StringBuilder *sb, FsgOptions opts, Array<FsgAsset> assets, FsgPageReport *report)
+{
+    if (!opts.minify && assets.count == 0 && !report) {
+        write_file(path, sb);
+        return;
+    }
+
+    SArena scratch = tl_scratch_arena(sb->alloc);
+    String html = create_string(sb, scratch);
+
+    if (assets.count > 0) {
+        StringBuilder rewritten{ .alloc = scratch };
+        append_rewritten_asset_urls(&rewritten, html, assets);
+
+        if (!opts.minify && !report) {
+            write_file(path, &rewritten);
+            return;
+        }
+
+        html = create_string(&rewritten, scratch);
+    }
+
+    if (opts.minify) {
+        StringBuilder minified{ .alloc = scratch };
+        minify_html(&minified, html);
+
+        if (!report) {
+            write_file(path, &minified);
+            return;
+        }
+
+        html = create_string(&minified, scratch);
+    }
+
+    write_file(path, html.data, html.length);
+
+    report->html_bytes = html.length;
+    collect_page_references(report, html);
+}
+
+void destroy_page_report(FsgPageReport *report)
+{
+    for (String url : report->references) destroy_string(url);
+    destroy_array(&report->references);
+    destroy_string(report->url);
+}
+
 bool parse_string(Lexer *lexer, String *str_out, Token *t_out)
 {
     Token t = peek_next_token(lexer);
@@ -588,529 +1961,4754 @@ bool parse_string_list(Lexer *lexer, DynamicArray<String> *strs_out, Token *t_ou
         t = peek_next_token(lexer);
     }
 
-    return false;
+    return false;
+}
+
+struct FsgImageVariant {
+    i32 width;
+    String url;
+    String dst_url;
+};
+
+struct FsgImage {
+    String url;
+    i32 width;
+    i32 height;
+
+    FsgImageVariant variants[FSG_MAX_IMAGE_WIDTHS];
+    i32 variant_count;
+
+    String srcset;
+};
+
+bool is_image_path(String path)
+{
+    return ends_with(path, ".png") || ends_with(path, ".jpg") || ends_with(path, ".jpeg");
+}
+
+String image_variant_url(String url, i32 width, Allocator mem)
+{
+    i32 ext = url_extension_offset(url);
+    return stringf(mem, "%.*s.%dw%.*s", ext, url.data, width, url.length-ext, url.data+ext);
+}
+
+void sort_images(Array<FsgImage> images)
+{
+    for (i32 i = 0; i < images.count; i++) {
+        for (i32 j = i; j > 0 && images[j].url < images[j-1].url; j--) {
+            SWAP(images[j], images[j-1]);
+        }
+    }
+}
+
+FsgImage* find_image(Array<FsgImage> images, String url)
+{
+    i32 lo = 0, hi = images.count;
+    while (lo < hi) {
+        i32 mid = lo + (hi-lo)/2;
+        if (images[mid].url == url) return &images[mid];
+        if (images[mid].url < url) lo = mid+1;
+        else hi = mid;
+    }
+    return nullptr;
+}
+
+// NOTE(jesper): the dimensions of an image under img/ or assets/, read from its header.
+// Keyed by the stat of the file, so that the daemon only probes images that changed
+struct FsgImageProbe {
+    String url;
+    u64 key;
+    i32 width;
+    i32 height;
+};
+
+bool is_probe_image_path(String path)
+{
+    return is_image_path(path) || ends_with(path, ".gif");
+}
+
+FsgImageProbe* find_image_probe(Array<FsgImageProbe> probes, String url)
+{
+    i32 lo = 0, hi = probes.count;
+    while (lo < hi) {
+        i32 mid = lo + (hi-lo)/2;
+        if (probes[mid].url == url) return &probes[mid];
+        if (probes[mid].url < url) lo = mid+1;
+        else hi = mid;
+    }
+    return nullptr;
+}
+
+u32 read_be16(u8 *p) { return (u32)p[0] << 8 | p[1]; }
+u32 read_be32(u8 *p) { return (u32)p[0] << 24 | (u32)p[1] << 16 | (u32)p[2] << 8 | p[3]; }
+
+// NOTE(jesper): the exif orientation of a jpeg, from its APP1 segment. Orientations 5-8
+// are rotated by 90 degrees, and browsers display them with width and height swapped
+i32 jpeg_exif_orientation(u8 *data, i32 size)
+{
+    if (size < 14 || memcmp(data, "Exif\0\0", 6) != 0) return 1;
+
+    u8 *tiff = data+6;
+    i32 tiff_size = size-6;
+    bool le = tiff[0] == 'I';
+
+    auto u16_at = [&](i32 offset) -> u32 {
+        return le ? (u32)tiff[offset] | (u32)tiff[offset+1] << 8 : read_be16(tiff+offset);
+    };
+    auto u32_at = [&](i32 offset) -> u32 {
+        return le ? u16_at(offset) | u16_at(offset+2) << 16 : read_be32(tiff+offset);
+    };
+
+    u32 ifd = u32_at(4);
+    if (ifd > (u32)tiff_size-2) return 1;
+
+    u32 entries = u16_at(ifd);
+    for (u32 i = 0; i < entries; i++) {
+        u32 entry = ifd + 2 + i*12;
+        if (entry > (u32)tiff_size-12) break;
+        if (u16_at(entry) == 0x0112) return (i32)u16_at(entry+8);
+    }
+
+    return 1;
+}
+
+// NOTE(jesper): reads the dimensions of a png, gif or jpeg from its header, without
+// reading the rest of the file. For jpegs that means seeking from segment to segment
+// until the frame header
+bool probe_image_size(String path, i32 *width, i32 *height)
+{
+    char sz_path[4096];
+    snprintf(sz_path, sizeof sz_path, "%.*s", STRFMT(path));
+
+    FILE *f = fopen(sz_path, "rb");
+    if (!f) return false;
+    defer { fclose(f); };
+
+    u8 header[32];
+    size_t read = fread(header, 1, sizeof header, f);
+
+    if (read >= 24 && memcmp(header, "\x89PNG\r\n\x1a\n", 8) == 0 && memcmp(header+12, "IHDR", 4) == 0) {
+        *width = (i32)read_be32(header+16);
+        *height = (i32)read_be32(header+20);
+        return *width > 0 && *height > 0;
+    }
+
+    if (read >= 10 && (memcmp(header, "GIF87a", 6) == 0 || memcmp(header, "GIF89a", 6) == 0)) {
+        *width = header[6] | header[7] << 8;
+        *height = header[8] | header[9] << 8;
+        return *width > 0 && *height > 0;
+    }
+
+    if (read < 4 || header[0] != 0xFF || header[1] != 0xD8) return false;
+
+    i32 orientation = 1;
+    long at = 2;
+    while (true) {
+        u8 marker[4];
+        if (fseek(f, at, SEEK_SET) != 0 || fread(marker, 1, sizeof marker, f) != sizeof marker) return false;
+        if (marker[0] != 0xFF) return false;
+
+        u8 type = marker[1];
+        if (type == 0xFF) {
+            at += 1;
+            continue;
+        }
+
+        if (type == 0x01 || (type >= 0xD0 && type <= 0xD8)) {
+            at += 2;
+            continue;
+        }
+
+        if (type == 0xD9 || type == 0xDA) return false;
+
+        u32 length = read_be16(marker+2);
+        if (length < 2) return false;
+
+        if (type == 0xE1 && orientation == 1) {
+            u8 app1[4096];
+            i32 size = (i32)fread(app1, 1, MIN(length-2, (u32)sizeof app1), f);
+            orientation = jpeg_exif_orientation(app1, size);
+        } else if (type >= 0xC0 && type <= 0xCF && type != 0xC4 && type != 0xC8 && type != 0xCC) {
+            u8 frame[5];
+            if (fread(frame, 1, sizeof frame, f) != sizeof frame) return false;
+
+            *height = (i32)read_be16(frame+1);
+            *width = (i32)read_be16(frame+3);
+            if (orientation >= 5 && orientation <= 8) SWAP(*width, *height);
+            return *width > 0 && *height > 0;
+        }
+
+        at += 2 + length;
+    }
+}
+
+int compare_image_probes(const void *lhs, const void *rhs)
+{
+    FsgImageProbe *a = (FsgImageProbe*)lhs;
+    FsgImageProbe *b = (FsgImageProbe*)rhs;
+    return a->url < b->url ? -1 : b->url < a->url ? 1 : 0;
+}
+
+// NOTE(jesper): probes the dimensions of every image under assets/ and img/, reusing the
+// previous probes of the images whose stat didn't change. The probes are returned sorted
+// by url, for find_image_probe
+DynamicArray<FsgImageProbe> probe_images(String src_dir, Array<FsgImageProbe> previous)
+{
+    SArena scratch = tl_scratch_arena();
+
+    DynamicArray<FsgSourceFile> files{};
+    const char *folders[] = { "assets", "img" };
+    for (const char *folder : folders) {
+        DynamicArray<FsgSourceFile> found = list_source_files(join_path(src_dir, folder, scratch), true, nullptr, scratch);
+        for (FsgSourceFile file : found) {
+            if (is_probe_image_path(file.path)) array_add(&files, file);
+        }
+    }
+
+    DynamicArray<FsgImageProbe> probes{};
+    for (FsgSourceFile file : files) {
+        u64 fields[] = { hash_bytes(file.path.data, file.path.length), (u64)file.stat.mtime, (u64)file.stat.size };
+
+        FsgImageProbe probe{};
+        probe.url = asset_url(src_dir, file.path, mem_dynamic);
+        probe.key = hash_bytes(fields, sizeof fields);
+
+        FsgImageProbe *existing = find_image_probe(previous, probe.url);
+        if (existing && existing->key == probe.key) {
+            probe.width = existing->width;
+            probe.height = existing->height;
+        }
+
+        array_add(&probes, probe);
+    }
+
+    parallel_for(probes.count, [&](i32 i) {
+        FsgImageProbe *probe = &probes[i];
+        if (probe->width > 0) return;
+
+        if (!probe_image_size(files[i].path, &probe->width, &probe->height)) {
+            LOG_ERROR("unable to read image dimensions from %.*s", STRFMT(files[i].path));
+            probe->width = probe->height = 0;
+        }
+    });
+
+    qsort(probes.data, probes.count, sizeof *probes.data, compare_image_probes);
+    return probes;
+}
+
+#if defined(FSG_STB_IMAGE)
+void stbi_append_to_sb(void *context, void *data, int size)
+{
+    append_string((StringBuilder*)context, String{ (char*)data, size });
+}
+#endif
+
+DynamicArray<FsgImage> process_images(String src_dir, String output, FsgOptions opts, DynamicArray<FsgAsset> *assets)
+{
+    DynamicArray<FsgImage> images{};
+    if (opts.image_width_count == 0) return images;
+
+#if !defined(FSG_STB_IMAGE)
+    LOG_ERROR("image variants requested, but fsg was built without FSG_STB_IMAGE");
+    return images;
+#else
+    DynamicArray<String> files{};
+
+    const char *folders[] = { "img", "assets" };
+    for (const char *folder : folders) {
+        DynamicArray<String> found = list_files(join_path(src_dir, folder, mem_dynamic), mem_dynamic, FILE_LIST_RECURSIVE);
+        for (String p : found) {
+            if (is_image_path(p)) array_add(&files, p);
+        }
+    }
+
+    for (i32 i = 0; i < files.count; i++) array_add(&images, FsgImage{});
+
+    // NOTE(jesper): variants are keyed by the hash of the source image in the cache, so
+    // unchanged images are only decoded and resized the first time they're seen
+    parallel_for(files.count, [&](i32 i) {
+        SArena scratch = tl_scratch_arena();
+
+        String p = files[i];
+        FsgImage *image = &images[i];
+
+        FileInfo contents = read_file(p, scratch);
+        if (!contents.data) {
+            LOG_ERROR("failed reading %.*s", STRFMT(p));
+            return;
+        }
+
+        int w, h, comp;
+        if (!stbi_info_from_memory(contents.data, contents.size, &w, &h, &comp)) {
+            LOG_ERROR("unsupported image format: %.*s", STRFMT(p));
+            return;
+        }
+
+        String url = asset_url(src_dir, p, mem_dynamic);
+        String ext{ url.data+url_extension_offset(url), url.length-url_extension_offset(url) };
+        bool png = ends_with(url, ".png");
+        u64 hash = hash_bytes(contents.data, contents.size);
+
+        i32 channels = comp == 2 || comp == 4 ? 4 : 3;
+        stbi_uc *pixels = nullptr;
+        defer { if (pixels) stbi_image_free(pixels); };
+
+        for (i32 j = 0; j < opts.image_width_count; j++) {
+            i32 vw = opts.image_widths[j];
+            if (vw >= w) continue;
+            i32 vh = MAX(1, (i32)((i64)h * vw / w));
+
+            String cache_path = join_path(
+                opts.cache_dir,
+                stringf(scratch, "images/%016llx-%d%.*s", (unsigned long long)hash, vw, STRFMT(ext)),
+                scratch);
+
+            FileInfo variant = read_file(cache_path, scratch);
+            if (!variant.data) {
+                if (!pixels) {
+                    int loaded_channels;
+                    pixels = stbi_load_from_memory(contents.data, contents.size, &w, &h, &loaded_channels, channels);
+                    if (!pixels) {
+                        LOG_ERROR("failed decoding %.*s: %s", STRFMT(p), stbi_failure_reason());
+                        return;
+                    }
+                }
+
+                u8 *resized = (u8*)malloc((size_t)vw*vh*channels);
+                defer { free(resized); };
+
+                stbir_resize_uint8_srgb(
+                    pixels, w, h, 0,
+                    resized, vw, vh, 0,
+                    channels == 4 ? STBIR_RGBA : STBIR_RGB);
+
+                StringBuilder encoded{ .alloc = scratch };
+                if (png) stbi_write_png_to_func(stbi_append_to_sb, &encoded, vw, vh, channels, resized, vw*channels);
+                else stbi_write_jpg_to_func(stbi_append_to_sb, &encoded, vw, vh, channels, resized, 85);
+
+                String data = create_string(&encoded, scratch);
+                write_file(cache_path, data.data, data.length);
+
+                variant.data = (u8*)data.data;
+                variant.size = data.length;
+            }
+
+            FsgImageVariant v{ .width = vw, .url = image_variant_url(url, vw, mem_dynamic) };
+            v.dst_url = opts.fingerprint ? fingerprint_url(v.url, hash_bytes(variant.data, variant.size), mem_dynamic) : v.url;
+
+            write_file(join_path(output, v.dst_url, scratch), variant.data, variant.size);
+            image->variants[image->variant_count++] = v;
+        }
+
+        image->url = url;
+        image->width = w;
+        image->height = h;
+    });
+
+    i32 count = 0;
+    for (i32 i = 0; i < images.count; i++) {
+        if (images[i].url.length > 0) images[count++] = images[i];
+    }
+    images.count = count;
+
+    for (FsgImage &image : images) {
+        for (i32 i = 0; i < image.variant_count; i++) {
+            if (opts.fingerprint) insert_asset(assets, FsgAsset{ image.variants[i].url, image.variants[i].dst_url });
+        }
+    }
+
+    sort_images(images);
+
+    for (FsgImage &image : images) {
+        if (image.variant_count == 0) continue;
+
+        SArena scratch = tl_scratch_arena();
+        StringBuilder sb{ .alloc = scratch };
+
+        for (i32 i = 0; i < image.variant_count; i++) {
+            append_stringf(&sb, "%.*s %dw, ", STRFMT(image.variants[i].dst_url), image.variants[i].width);
+        }
+
+        FsgAsset *original = find_asset(*assets, image.url);
+        append_stringf(&sb, "%.*s %dw", STRFMT(original ? original->fingerprinted_url : image.url), image.width);
+
+        image.srcset = create_string(&sb, mem_dynamic);
+    }
+
+    return images;
+#endif
+}
+
+// NOTE(jesper): re-emits a parsed tag attribute. Attributes without a value are emitted
+// bare, as boolean attributes are written. Values are always emitted double-quoted, so a
+// " from a single-quoted value is escaped
+void append_tag_property(StringBuilder *sb, TagProperty prop)
+{
+    append_stringf(sb, " %.*s", STRFMT(prop.key));
+    if (prop.value.length == 0) return;
+
+    append_string(sb, "=\"");
+
+    char *flushed = prop.value.data;
+    char *end = prop.value.data + prop.value.length;
+    for (char *at = flushed; at < end; at++) {
+        if (*at != '"') continue;
+
+        append_string(sb, String{ flushed, (i32)(at-flushed) });
+        append_string(sb, "&quot;");
+        flushed = at+1;
+    }
+
+    append_string(sb, String{ flushed, (i32)(end-flushed) });
+    append_string(sb, "\"");
+}
+
+// NOTE(jesper): rewrites an <img> with the attributes it's missing: its dimensions, so the
+// browser can reserve its space before it's loaded, lazy loading for all but the first
+// image of a post, which is the one most likely to be visible initially, and the srcset of
+// its variants
+void append_image(
+    StringBuilder *sb,
+    String tag,
+    Array<FsgImage> images,
+    Array<FsgImageProbe> probes,
+    bool lazy,
+    FsgOptions opts)
+{
+    Array<TagProperty> properties = parse_html_tag_properties(tag);
+
+    String src{};
+    bool has_srcset = false, has_size = false, has_loading = false, has_decoding = false;
+    for (TagProperty prop : properties) {
+        if (eq_ignore_case(prop.key, "src")) src = prop.value;
+        if (eq_ignore_case(prop.key, "srcset")) has_srcset = true;
+        if (eq_ignore_case(prop.key, "width") || eq_ignore_case(prop.key, "height")) has_size = true;
+        if (eq_ignore_case(prop.key, "loading")) has_loading = true;
+        if (eq_ignore_case(prop.key, "decoding")) has_decoding = true;
+    }
+
+    FsgImage *image = src.length > 0 && !has_srcset ? find_image(images, src) : nullptr;
+    if (image && image->variant_count == 0) image = nullptr;
+
+    FsgImageProbe *probe = src.length > 0 && !has_size ? find_image_probe(probes, src) : nullptr;
+    if (probe && probe->width == 0) probe = nullptr;
+
+    bool add_loading = lazy && !has_loading;
+    bool add_decoding = lazy && !has_decoding;
+
+    if (!image && !probe && !add_loading && !add_decoding) {
+        append_string(sb, tag);
+        return;
+    }
+
+    append_string(sb, "<img");
+    for (TagProperty prop : properties) append_tag_property(sb, prop);
+
+    if (probe) append_stringf(sb, " width=\"%d\" height=\"%d\"", probe->width, probe->height);
+    if (add_loading) append_string(sb, " loading=\"lazy\"");
+    if (add_decoding) append_string(sb, " decoding=\"async\"");
+
+    if (image) append_stringf(sb, " srcset=\"%.*s\" sizes=\"%.*s\"", STRFMT(image->srcset), STRFMT(opts.image_sizes));
+    append_string(sb, ">");
+}
+
+// NOTE(jesper): a code block can name its language on the first line, ```cpp. Only the
+// languages we know how to highlight are recognised, anything else stays part of the code
+String parse_code_block_lang(String *code)
+{
+    const char *langs[] = { "c", "cpp", "c++", "cc", "cxx", "h", "hpp" };
+
+    String line{ code->data, 0 };
+    while (line.length < code->length && !is_html_whitespace(line[line.length])) line.length++;
+
+    if (line.length == code->length || ((*code)[line.length] != '\n' && (*code)[line.length] != '\r')) {
+        return {};
+    }
+
+    for (const char *lang : langs) {
+        if (line == lang) {
+            code->data += line.length;
+            code->length -= line.length;
+            while (code->length > 0 && ((*code)[0] == '\n' || (*code)[0] == '\r')) {
+                code->data++;
+                code->length--;
+            }
+            return line;
+        }
+    }
+
+    return {};
+}
+
+#if defined(FSG_LIBCLANG)
+bool append_highlighted_code(StringBuilder *sb, String code, String lang)
+{
+    thread_local CXIndex index = clang_createIndex(0, 0);
+
+    const char *filename = lang == "c" || lang == "h" ? "fsg_code_block.c" : "fsg_code_block.cpp";
+    const char *args[] = { "-std=c++20" };
+    i32 num_args = lang == "c" || lang == "h" ? 0 : 1;
+
+    CXUnsavedFile unsaved{ filename, code.data, (unsigned long)code.length };
+
+    // NOTE(jesper): code blocks are snippets, so they're parsed on their own without
+    // resolving includes. We only need the tokens, which are valid regardless of errors
+    CXTranslationUnit tu;
+    CXErrorCode error = clang_parseTranslationUnit2(
+        index, filename,
+        args, num_args,
+        &unsaved, 1,
+        CXTranslationUnit_Incomplete | CXTranslationUnit_KeepGoing | CXTranslationUnit_SingleFileParse,
+        &tu);
+    if (error != CXError_Success) return false;
+    defer { clang_disposeTranslationUnit(tu); };
+
+    CXFile file = clang_getFile(tu, filename);
+    CXSourceRange range = clang_getRange(
+        clang_getLocationForOffset(tu, file, 0),
+        clang_getLocationForOffset(tu, file, code.length));
+
+    CXToken *tokens = nullptr;
+    unsigned num_tokens = 0;
+    clang_tokenize(tu, range, &tokens, &num_tokens);
+    defer { clang_disposeTokens(tu, tokens, num_tokens); };
+
+    i32 last_end = 0;
+    bool directive = false;
+
+    for (unsigned i = 0; i < num_tokens; i++) {
+        CXSourceRange extent = clang_getTokenExtent(tu, tokens[i]);
+
+        unsigned start, end;
+        clang_getSpellingLocation(clang_getRangeStart(extent), nullptr, nullptr, nullptr, &start);
+        clang_getSpellingLocation(clang_getRangeEnd(extent), nullptr, nullptr, nullptr, &end);
+        if ((i32)start < last_end || (i32)end > code.length) continue;
+
+        String str{ code.data+start, (i32)(end-start) };
+
+        const char *cls = nullptr;
+        switch (clang_getTokenKind(tokens[i])) {
+        case CXToken_Keyword:
+            cls = directive ? "hl-pp" : "hl-kw";
+            break;
+        case CXToken_Identifier:
+            if (directive) cls = "hl-pp";
+            break;
+        case CXToken_Literal:
+            cls = is_number(str[0]) || str[0] == '.' ? "hl-num" : "hl-str";
+            break;
+        case CXToken_Comment:
+            cls = "hl-cmt";
+            break;
+        case CXToken_Punctuation:
+            break;
+        }
+
+        directive = str == "#";
+
+        append_escape_html(sb, String{ code.data+last_end, (i32)start-last_end });
+        if (cls) append_stringf(sb, "<span class=\"%s\">", cls);
+        append_escape_html(sb, str);
+        if (cls) append_string(sb, "</span>");
+
+        last_end = (i32)end;
+    }
+
+    append_escape_html(sb, String{ code.data+last_end, code.length-last_end });
+    return true;
+}
+#endif
+
+void append_code_block(StringBuilder *sb, String code, FsgOptions opts)
+{
+    String lang = parse_code_block_lang(&code);
+
+    append_string(sb, "<code class=\"block\">");
+
+#if defined(FSG_LIBCLANG)
+    if (lang.length > 0) {
+        SArena scratch = tl_scratch_arena(sb->alloc);
+
+        u64 hash = hash_bytes(code.data, code.length) ^ hash_bytes(lang.data, lang.length);
+        String cache_path = join_path(
+            opts.cache_dir,
+            stringf(scratch, "highlight/v2-%016llx.html", (unsigned long long)hash),
+            scratch);
+
+        FileInfo cached = read_file(cache_path, scratch);
+        if (cached.data) {
+            append_string(sb, String{ (char*)cached.data, cached.size });
+            append_string(sb, "</code>");
+            return;
+        }
+
+        StringBuilder highlighted{ .alloc = scratch };
+        if (append_highlighted_code(&highlighted, code, lang)) {
+            String html = create_string(&highlighted, scratch);
+            write_file(cache_path, html.data, html.length);
+
+            append_string(sb, html);
+            append_string(sb, "</code>");
+            return;
+        }
+    }
+#else
+    (void)opts;
+    (void)lang;
+#endif
+
+    append_escape_html(sb, code);
+    append_string(sb, "</code>");
+}
+
+bool parse_i32(String str, i32 *out)
+{
+    if (str.length == 0) return false;
+
+    i32 value = 0;
+    for (i32 i = 0; i < str.length; i++) {
+        if (!is_number(str[i])) return false;
+        value = value*10 + (str[i]-'0');
+    }
+
+    *out = value;
+    return true;
+}
+
+bool parse_bool(Lexer *lexer, bool *bool_out, Token *t_out)
+{
+    String str;
+    if (parse_string(lexer, &str, t_out)) {
+        if (str == "yes" || str == "true") {
+            *bool_out = true;
+            return true;
+        } else if (str == "no" || str == "false") {
+            *bool_out = false;
+            return true;
+        }
+        PARSE_ERRORF(lexer, "unexpected identifier parsing bool: '%.*s'", STRFMT(str));
+        return false;
+    }
+    return false;
+}
+
+// NOTE(jesper): the post templates compiled to native code, as an alternative to
+// interpreting their parts in append_post. A compiled template measures its output, has
+// the buffer reserve the exact length, and fills it with constant-length copies of the
+// merged text between variables and copies of the post fields it loads directly. Only
+// templates whose every variable is a post variable are compiled, anything else is left
+// to the interpreter, which also keeps reporting the unhandled ones
+struct FsgJitBuffer {
+    char *data;
+    i64 capacity;
+    i64 length;
+};
+
+char* reserve_jit_buffer(FsgJitBuffer *buffer, i64 length)
+{
+    if (length > buffer->capacity) {
+        buffer->capacity = MAX(length, buffer->capacity*2);
+        buffer->data = (char*)realloc(buffer->data, buffer->capacity);
+    }
+
+    buffer->length = length;
+    return buffer->data;
+}
+
+String render_compiled_post(FsgTemplate *tmpl, FsgPost &post, String tags_html, Allocator mem)
+{
+    thread_local FsgJitBuffer buffer{};
+    tmpl->render(&buffer, &post, &tags_html, reserve_jit_buffer);
+    return duplicate_string(String{ buffer.data, (i32)buffer.length }, mem);
+}
+
+#if defined(FSG_LLVM_JIT)
+struct FsgJit {
+    LLVMOrcLLJITRef lljit;
+    i32 generation;
+
+    // NOTE(jesper): owns the code of the last compiled generation
+    LLVMOrcResourceTrackerRef tracker;
+};
+
+bool check_llvm_error(LLVMErrorRef error, const char *what)
+{
+    if (!error) return true;
+
+    char *msg = LLVMGetErrorMessage(error);
+    LOG_ERROR("%s: %s", what, msg);
+    LLVMDisposeErrorMessage(msg);
+    return false;
+}
+
+FsgJit* get_template_jit()
+{
+    static FsgJit jit{};
+    static bool initialized = false;
+
+    if (!initialized) {
+        initialized = true;
+
+        LLVMInitializeNativeTarget();
+        LLVMInitializeNativeAsmPrinter();
+
+        if (!check_llvm_error(LLVMOrcCreateLLJIT(&jit.lljit, nullptr), "failed creating LLJIT")) {
+            jit.lljit = nullptr;
+            return nullptr;
+        }
+
+        // NOTE(jesper): the copies are emitted as llvm.memcpy, which for lengths that aren't
+        // constant is lowered to a call to the process' memcpy
+        LLVMOrcDefinitionGeneratorRef generator;
+        LLVMErrorRef error = LLVMOrcCreateDynamicLibrarySearchGeneratorForProcess(
+            &generator, LLVMOrcLLJITGetGlobalPrefix(jit.lljit), nullptr, nullptr);
+        if (!check_llvm_error(error, "failed creating process symbol generator")) {
+            LLVMOrcDisposeLLJIT(jit.lljit);
+            jit.lljit = nullptr;
+            return nullptr;
+        }
+
+        LLVMOrcJITDylibAddGenerator(LLVMOrcLLJITGetMainJITDylib(jit.lljit), generator);
+    }
+
+    return jit.lljit ? &jit : nullptr;
+}
+
+// NOTE(jesper): the field of a post, or the tags html, a template variable reads
+bool template_variable_offset(FsgSymbol variable, i32 *offset, bool *is_tags)
+{
+    FsgPost post{};
+    *offset = 0;
+    *is_tags = false;
+
+    switch (variable) {
+    case SYM_POST_CREATED: *offset = (i32)((char*)&post.created - (char*)&post); break;
+    case SYM_POST_TITLE: *offset = (i32)((char*)&post.title - (char*)&post); break;
+    case SYM_POST_URL: *offset = (i32)((char*)&post.url - (char*)&post); break;
+    case SYM_POST_BRIEF: *offset = (i32)((char*)&post.brief - (char*)&post); break;
+    case SYM_POST_CONTENT: *offset = (i32)((char*)&post.content - (char*)&post); break;
+    case SYM_POST_TAGS: *is_tags = true; break;
+    default: return false;
+    }
+
+    return true;
+}
+
+bool is_compilable_template(FsgTemplate *tmpl)
+{
+    for (FsgPart s : tmpl->parts) {
+        i32 offset;
+        bool is_tags;
+
+        if (s.type == FSG_PART_VARIABLE && s.symbol != SYM_NONE &&
+            !template_variable_offset(s.symbol, &offset, &is_tags))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+struct FsgJitField {
+    i32 offset;
+    bool is_tags;
+    LLVMValueRef data;
+    LLVMValueRef length;
+};
+
+// NOTE(jesper): emits the render function for a template. Pointers are all i8* and cast at
+// the loads, which is valid IR with typed as well as opaque pointers
+void emit_template_function(LLVMContextRef ctx, LLVMModuleRef module, FsgTemplate *tmpl, const char *name)
+{
+    LLVMTypeRef void_t = LLVMVoidTypeInContext(ctx);
+    LLVMTypeRef i8_t = LLVMInt8TypeInContext(ctx);
+    LLVMTypeRef i32_t = LLVMInt32TypeInContext(ctx);
+    LLVMTypeRef i64_t = LLVMInt64TypeInContext(ctx);
+    LLVMTypeRef ptr_t = LLVMPointerType(i8_t, 0);
+
+    LLVMTypeRef reserve_params[] = { ptr_t, i64_t };
+    LLVMTypeRef reserve_t = LLVMFunctionType(ptr_t, reserve_params, 2, false);
+
+    LLVMTypeRef params[] = { ptr_t, ptr_t, ptr_t, LLVMPointerType(reserve_t, 0) };
+    LLVMTypeRef fn_t = LLVMFunctionType(void_t, params, 4, false);
+
+    LLVMValueRef fn = LLVMAddFunction(module, name, fn_t);
+    LLVMValueRef buffer = LLVMGetParam(fn, 0);
+    LLVMValueRef post = LLVMGetParam(fn, 1);
+    LLVMValueRef tags_html = LLVMGetParam(fn, 2);
+    LLVMValueRef reserve = LLVMGetParam(fn, 3);
+
+    SArena scratch = tl_scratch_arena();
+
+    LLVMBuilderRef b = LLVMCreateBuilderInContext(ctx);
+    defer { LLVMDisposeBuilder(b); };
+    LLVMPositionBuilderAtEnd(b, LLVMAppendBasicBlockInContext(ctx, fn, "entry"));
+
+    String str{};
+    i32 length_offset = (i32)((char*)&str.length - (char*)&str);
+
+    // NOTE(jesper): the fields are loaded once up front, both the length and the copy need
+    // them and a variable can appear any number of times
+    DynamicArray<FsgJitField> fields{};
+    for (FsgPart s : tmpl->parts) {
+        if (s.type != FSG_PART_VARIABLE || s.symbol == SYM_NONE) continue;
+
+        FsgJitField field{};
+        template_variable_offset(s.symbol, &field.offset, &field.is_tags);
+
+        bool loaded = false;
+        for (FsgJitField &f : fields) loaded = loaded || (f.offset == field.offset && f.is_tags == field.is_tags);
+        if (loaded) continue;
+
+        LLVMValueRef base = field.is_tags ? tags_html : post;
+
+        LLVMValueRef data_index = LLVMConstInt(i64_t, field.offset, false);
+        LLVMValueRef data_ptr = LLVMBuildGEP2(b, i8_t, base, &data_index, 1, "");
+        data_ptr = LLVMBuildBitCast(b, data_ptr, LLVMPointerType(ptr_t, 0), "");
+        field.data = LLVMBuildLoad2(b, ptr_t, data_ptr, "");
+
+        LLVMValueRef length_index = LLVMConstInt(i64_t, field.offset + length_offset, false);
+        LLVMValueRef length_ptr = LLVMBuildGEP2(b, i8_t, base, &length_index, 1, "");
+        length_ptr = LLVMBuildBitCast(b, length_ptr, LLVMPointerType(i32_t, 0), "");
+        field.length = LLVMBuildZExt(b, LLVMBuildLoad2(b, i32_t, length_ptr, ""), i64_t, "");
+
+        array_add(&fields, field);
+    }
+
+    // NOTE(jesper): runs of text with no variable between them are merged into a single
+    // constant, and each variable becomes the index of its field
+    struct Segment { String text; i32 field; };
+    DynamicArray<Segment> segments{};
+
+    i64 constant_length = 0;
+    StringBuilder text{ .alloc = scratch };
+    auto flush_text = [&]() {
+        String merged = create_string(&text, scratch);
+        if (merged.length > 0) array_add(&segments, Segment{ merged, -1 });
+        constant_length += merged.length;
+        text = StringBuilder{ .alloc = scratch };
+    };
+
+    for (FsgPart s : tmpl->parts) {
+        append_string(&text, s.text);
+        if (s.type != FSG_PART_VARIABLE || s.symbol == SYM_NONE) continue;
+
+        flush_text();
+
+        FsgJitField field{};
+        template_variable_offset(s.symbol, &field.offset, &field.is_tags);
+        for (i32 i = 0; i < fields.count; i++) {
+            if (fields[i].offset == field.offset && fields[i].is_tags == field.is_tags) {
+                array_add(&segments, Segment{ {}, i });
+                break;
+            }
+        }
+    }
+    flush_text();
+
+    LLVMValueRef total = LLVMConstInt(i64_t, constant_length, false);
+    for (Segment seg : segments) {
+        if (seg.field != -1) total = LLVMBuildAdd(b, total, fields[seg.field].length, "");
+    }
+
+    LLVMValueRef reserve_args[] = { buffer, total };
+    LLVMValueRef at = LLVMBuildCall2(b, reserve_t, reserve, reserve_args, 2, "");
+
+    for (Segment seg : segments) {
+        LLVMValueRef src, length;
+        if (seg.field == -1) {
+            LLVMValueRef init = LLVMConstStringInContext(ctx, seg.text.data, seg.text.length, true);
+            LLVMValueRef global = LLVMAddGlobal(module, LLVMTypeOf(init), "");
+            LLVMSetInitializer(global, init);
+            LLVMSetGlobalConstant(global, true);
+            LLVMSetLinkage(global, LLVMPrivateLinkage);
+            LLVMSetUnnamedAddress(global, LLVMGlobalUnnamedAddr);
+
+            src = LLVMConstBitCast(global, ptr_t);
+            length = LLVMConstInt(i64_t, seg.text.length, false);
+        } else {
+            src = fields[seg.field].data;
+            length = fields[seg.field].length;
+        }
+
+        LLVMBuildMemCpy(b, at, 1, src, 1, length);
+        at = LLVMBuildGEP2(b, i8_t, at, &length, 1, "");
+    }
+
+    LLVMBuildRetVoid(b);
+}
+
+// NOTE(jesper): compiles every compilable template into one module, named by generation
+// since the daemon compiles them again when they change. The templates are reloaded before
+// they're compiled again, so nothing calls the previous generation's code anymore and it's
+// freed first
+void compile_templates(Array<FsgTemplate> templates)
+{
+    FsgJit *jit = get_template_jit();
+    if (!jit) return;
+
+    if (jit->tracker) {
+        check_llvm_error(LLVMOrcResourceTrackerRemove(jit->tracker), "failed freeing previous templates");
+        LLVMOrcReleaseResourceTracker(jit->tracker);
+        jit->tracker = nullptr;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    i32 generation = jit->generation++;
+
+    LLVMOrcThreadSafeContextRef tsc = LLVMOrcCreateNewThreadSafeContext();
+    LLVMContextRef ctx = LLVMOrcThreadSafeContextGetContext(tsc);
+
+    char name[64];
+    snprintf(name, sizeof name, "fsg_templates_%d", generation);
+
+    LLVMModuleRef module = LLVMModuleCreateWithNameInContext(name, ctx);
+    LLVMSetTarget(module, LLVMOrcLLJITGetTripleString(jit->lljit));
+    LLVMSetDataLayout(module, LLVMOrcLLJITGetDataLayoutStr(jit->lljit));
+
+    for (i32 i = 0; i < templates.count; i++) {
+        if (!is_compilable_template(&templates[i])) continue;
+
+        snprintf(name, sizeof name, "fsg_template_%d_%d", generation, i);
+        emit_template_function(ctx, module, &templates[i], name);
+    }
+
+    char *verify_error = nullptr;
+    if (LLVMVerifyModule(module, LLVMReturnStatusAction, &verify_error)) {
+        LOG_ERROR("invalid template module: %s", verify_error);
+        LLVMDisposeMessage(verify_error);
+        LLVMDisposeModule(module);
+        LLVMOrcDisposeThreadSafeContext(tsc);
+        return;
+    }
+    LLVMDisposeMessage(verify_error);
+
+    LLVMOrcThreadSafeModuleRef tsm = LLVMOrcCreateNewThreadSafeModule(module, tsc);
+    LLVMOrcDisposeThreadSafeContext(tsc);
+
+    LLVMOrcJITDylibRef dylib = LLVMOrcLLJITGetMainJITDylib(jit->lljit);
+    jit->tracker = LLVMOrcJITDylibCreateResourceTracker(dylib);
+    if (!check_llvm_error(LLVMOrcLLJITAddLLVMIRModuleWithRT(jit->lljit, jit->tracker, tsm), "failed adding template module")) {
+        return;
+    }
+
+    i32 compiled = 0;
+    for (i32 i = 0; i < templates.count; i++) {
+        if (!is_compilable_template(&templates[i])) continue;
+
+        snprintf(name, sizeof name, "fsg_template_%d_%d", generation, i);
+
+        LLVMOrcExecutorAddress address = 0;
+        if (!check_llvm_error(LLVMOrcLLJITLookup(jit->lljit, &address, name), "failed compiling template")) {
+            continue;
+        }
+
+        templates[i].render = (FsgTemplateProc*)address;
+        compiled++;
+    }
+
+    f64 ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-start).count();
+    LOG_INFO("compiled %d of %d templates in %.2fms", compiled, templates.count, ms);
+}
+#else
+void compile_templates(Array<FsgTemplate>)
+{
+    LOG_ERROR("template jit requested, but fsg was built without FSG_LLVM_JIT");
+}
+#endif
+
+// NOTE(jesper): the same post is rendered through the same template for the index
+// listing, every tag page it's in, and its own page. Each (post, template) fragment is
+// rendered once per build and spliced into every output that needs it
+struct FsgFragmentCache {
+    Array<FsgTemplate> templates;
+    i32 post_count;
+
+    String *fragments;
+    String *tags_html;
+};
+
+FsgFragmentCache create_fragment_cache(Array<FsgTemplate> templates, Array<FsgPost> posts, Array<FsgTag> tags)
+{
+    FsgFragmentCache cache{};
+    cache.templates = templates;
+
+    // NOTE(jesper): post ids are dense, the daemon renumbers the posts when they change
+    for (FsgPost &post : posts) cache.post_count = MAX(cache.post_count, post.id+1);
+
+    cache.fragments = (String*)calloc((size_t)cache.post_count*MAX(templates.count, 1), sizeof(String));
+    cache.tags_html = (String*)calloc(MAX(cache.post_count, 1), sizeof(String));
+
+    for (FsgPost &post : posts) {
+        if (post.tags.count == 0) continue;
+
+        SArena scratch = tl_scratch_arena();
+        StringBuilder sb{ .alloc = scratch };
+        append_string(&sb, "<i class=\"fa fa-tag\"></i>");
+
+        for (i32 i = 0; i < post.tags.count; i++) {
+            for (FsgTag &tag : tags) {
+                if (tag.symbol == post.tags[i]) {
+                    append_string(&sb, tag.link);
+                    break;
+                }
+            }
+
+            if (i < post.tags.count-1) append_string(&sb, ", ");
+        }
+
+        cache.tags_html[post.id] = create_string(&sb, mem_dynamic);
+    }
+
+    return cache;
+}
+
+void destroy_fragment_cache(FsgFragmentCache *cache)
+{
+    for (i32 i = 0; i < cache->post_count*cache->templates.count; i++) {
+        if (cache->fragments[i].data) destroy_string(cache->fragments[i]);
+    }
+
+    for (i32 i = 0; i < cache->post_count; i++) {
+        if (cache->tags_html[i].data) destroy_string(cache->tags_html[i]);
+    }
+
+    free(cache->fragments);
+    free(cache->tags_html);
+    *cache = {};
+}
+
+void append_post(StringBuilder *sb, FsgTemplate *tmpl, FsgPost &post, String tags_html)
+{
+    for (FsgPart s : tmpl->parts) {
+        switch (s.type) {
+        case FSG_PART_VARIABLE:
+            append_string(sb, s.text);
+
+            switch (s.symbol) {
+            case SYM_NONE: break;
+            case SYM_POST_CREATED: append_string(sb, post.created); break;
+            case SYM_POST_TITLE: append_string(sb, post.title); break;
+            case SYM_POST_URL: append_string(sb, post.url); break;
+            case SYM_POST_BRIEF: append_string(sb, post.brief); break;
+            case SYM_POST_CONTENT: append_string(sb, post.content); break;
+            case SYM_POST_TAGS: append_string(sb, tags_html); break;
+            default:
+                LOG_ERROR("unhandled section '%.*s'", STRFMT(s.variable));
+                break;
+            }
+            break;
+
+        case FSG_PART_CHUNK:
+        case FSG_PART_INCLUDE:
+            append_string(sb, s.text);
+            break;
+
+        }
+    }
+}
+
+void append_post(StringBuilder *sb, FsgFragmentCache *cache, FsgTemplate *tmpl, FsgPost &post)
+{
+    i32 tmpl_index = (i32)(tmpl - cache->templates.data);
+    String *fragment = &cache->fragments[post.id*cache->templates.count + tmpl_index];
+
+    if (!fragment->data && tmpl->render) {
+        *fragment = render_compiled_post(tmpl, post, cache->tags_html[post.id], mem_dynamic);
+    } else if (!fragment->data) {
+        SArena scratch = tl_scratch_arena(sb->alloc);
+        StringBuilder fsb{ .alloc = scratch };
+        append_post(&fsb, tmpl, post, cache->tags_html[post.id]);
+        *fragment = create_string(&fsb, mem_dynamic);
+    }
+
+    append_string(sb, *fragment);
+}
+
+void append_json_string(StringBuilder *sb, String str)
+{
+    append_char(sb, '"');
+    for (i32 i = 0; i < str.length; i++) {
+        switch (str[i]) {
+        case '"': append_string(sb, "\\\""); break;
+        case '\\': append_string(sb, "\\\\"); break;
+        case '\n': append_string(sb, "\\n"); break;
+        case '\r': append_string(sb, "\\r"); break;
+        case '\t': append_string(sb, "\\t"); break;
+        default:
+            if ((u8)str[i] < 0x20) append_stringf(sb, "\\u%04x", (u8)str[i]);
+            else append_char(sb, str[i]);
+            break;
+        }
+    }
+    append_char(sb, '"');
+}
+
+// NOTE(jesper): 32-bit FNV-1a over the utf-8 bytes of the term, simple enough for the
+// client to compute in a couple of lines of javascript to find the shard for a query term
+u32 search_shard(String term, i32 shard_count)
+{
+    u32 h = 2166136261u;
+    for (i32 i = 0; i < term.length; i++) {
+        h ^= (u8)term[i];
+        h *= 16777619u;
+    }
+    return h % (u32)shard_count;
+}
+
+int compare_strings(const void *lhs, const void *rhs)
+{
+    String a = *(String*)lhs;
+    String b = *(String*)rhs;
+    return a < b ? -1 : b < a ? 1 : 0;
+}
+
+struct SearchPosting {
+    String term;
+    i32 doc;
+};
+
+int compare_search_postings(const void *lhs, const void *rhs)
+{
+    SearchPosting *a = (SearchPosting*)lhs;
+    SearchPosting *b = (SearchPosting*)rhs;
+    if (a->term < b->term) return -1;
+    if (b->term < a->term) return 1;
+    return a->doc - b->doc;
+}
+
+bool is_search_term_char(char c)
+{
+    return is_alpha(c) || is_number(c) || (u8)c >= 128;
+}
+
+// NOTE(jesper): splits rendered html into lower-cased search terms, runs of letters,
+// digits and utf-8, skipping tags, comments and entities. This is plain text, not fsg
+// markup, so it's scanned directly rather than with the lexer, whose markup tokens such
+// as inline code would swallow the terms following a stray backtick
+void tokenize_search_terms(String text, DynamicArray<String> *terms, Allocator mem)
+{
+    char *at = text.data;
+    char *end = text.data + text.length;
+
+    while (at < end) {
+        if (*at == '<') {
+            if (end-at >= 4 && memcmp(at, "<!--", 4) == 0) {
+                at += 4;
+                while (at < end && !(end-at >= 3 && memcmp(at, "-->", 3) == 0)) at++;
+                at = MIN(at+3, end);
+            } else {
+                while (at < end && *at != '>') at++;
+                at = MIN(at+1, end);
+            }
+        } else if (*at == '&') {
+            at++;
+            if (at < end && (is_search_term_char(*at) || *at == '#')) {
+                while (at < end && *at != ';' && !is_html_whitespace(*at)) at++;
+            }
+        } else if (is_search_term_char(*at)) {
+            char *start = at;
+            while (at < end && is_search_term_char(*at)) at++;
+
+            i32 length = (i32)(at-start);
+            if (length >= 2 && length <= 32) {
+                String term = duplicate_string(String{ start, length }, mem);
+                for (i32 i = 0; i < term.length; i++) {
+                    if (term[i] >= 'A' && term[i] <= 'Z') term[i] = term[i] - 'A' + 'a';
+                }
+                array_add(terms, term);
+            }
+        } else {
+            at++;
+        }
+    }
+
+    qsort(terms->data, terms->count, sizeof(String), compare_strings);
+
+    i32 count = 0;
+    for (i32 i = 0; i < terms->count; i++) {
+        if (count == 0 || (*terms)[count-1] != (*terms)[i]) (*terms)[count++] = (*terms)[i];
+    }
+    terms->count = count;
+}
+
+// NOTE(jesper): the terms of a post only change when its title or content does, so
+// they're cached by content hash and only re-tokenized for new or edited posts. In low
+// memory mode the content is dropped once the post is written, so the terms are cached
+// before that and this only reads them back
+bool load_search_terms(FsgPost *post, DynamicArray<String> *terms, FsgOptions opts, Allocator mem)
+{
+    SArena scratch = tl_scratch_arena(mem);
+
+    // NOTE(jesper): the version in the key is bumped whenever tokenize_search_terms changes
+    u64 hash = hash_bytes(post->title.data, post->title.length) ^ (post->content_hash * 31);
+    String cache_path = join_path(
+        opts.cache_dir,
+        stringf(scratch, "search/v2-%016llx.terms", (unsigned long long)hash),
+        scratch);
+
+    FileInfo cached = read_file(cache_path, mem);
+    if (cached.data) {
+        char *at = (char*)cached.data;
+        char *end = at + cached.size;
+        while (at < end) {
+            char *line_end = find_char(at, end, '\n');
+            if (line_end > at) array_add(terms, String{ at, (i32)(line_end-at) });
+            at = line_end+1;
+        }
+        post->terms_uncached = false;
+        return true;
+    }
+
+    if (post->content_dropped) {
+        LOG_ERROR("search terms of '%.*s' missing from the cache", STRFMT(post->src_path));
+        return false;
+    }
+
+    tokenize_search_terms(post->title, terms, mem);
+    tokenize_search_terms(post->content, terms, mem);
+
+    StringBuilder sb{ .alloc = scratch };
+    for (String term : *terms) {
+        append_string(&sb, term);
+        append_char(&sb, '\n');
+    }
+
+    post->terms_uncached = !write_file(cache_path, &sb);
+    if (post->terms_uncached) {
+        LOG_ERROR("failed to cache search terms of '%.*s' to '%.*s', keeping its content", STRFMT(post->src_path), STRFMT(cache_path));
+    }
+    return true;
+}
+
+// NOTE(jesper): writes search/docs.json with the url and title of every document, and
+// search/N.json shards mapping each term to its delta-encoded list of document ids. The
+// client only fetches the shards for the terms in its query
+void generate_search_index(String output, Array<FsgPost> posts, Array<i32> order, FsgOptions opts)
+{
+    DynamicArray<FsgPost*> docs{};
+    for (i32 index : order) {
+        if (!opts.build_drafts && posts[index].draft) continue;
+        array_add(&docs, &posts[index]);
+    }
+
+    DynamicArray<DynamicArray<String>> doc_terms{};
+    for (i32 i = 0; i < docs.count; i++) array_add(&doc_terms, DynamicArray<String>{});
+
+    parallel_for(docs.count, [&](i32 i) {
+        load_search_terms(docs[i], &doc_terms[i], opts, mem_dynamic);
+    });
+
+    i32 shard_count = MAX(opts.search_shards, 1);
+
+    DynamicArray<DynamicArray<SearchPosting>> shards{};
+    for (i32 i = 0; i < shard_count; i++) array_add(&shards, DynamicArray<SearchPosting>{});
+
+    for (i32 i = 0; i < docs.count; i++) {
+        for (String term : doc_terms[i]) {
+            array_add(&shards[search_shard(term, shard_count)], SearchPosting{ term, i });
+        }
+    }
+
+    parallel_for(shard_count, [&](i32 i) {
+        SArena scratch = tl_scratch_arena();
+        StringBuilder sb{ .alloc = scratch };
+
+        DynamicArray<SearchPosting> &postings = shards[i];
+        qsort(postings.data, postings.count, sizeof(SearchPosting), compare_search_postings);
+
+        append_char(&sb, '{');
+        for (i32 j = 0; j < postings.count; j++) {
+            bool first_term = j == 0 || postings[j-1].term != postings[j].term;
+            if (first_term) {
+                if (j > 0) append_string(&sb, "],");
+                append_json_string(&sb, postings[j].term);
+                append_stringf(&sb, ":[%d", postings[j].doc);
+            } else {
+                append_stringf(&sb, ",%d", postings[j].doc - postings[j-1].doc);
+            }
+        }
+        if (postings.count > 0) append_char(&sb, ']');
+        append_char(&sb, '}');
+
+        write_file(join_path(output, stringf(scratch, "search/%d.json", i), scratch), &sb);
+    });
+
+    SArena scratch = tl_scratch_arena();
+    StringBuilder sb{ .alloc = scratch };
+
+    append_stringf(&sb, "{\"shards\":%d,\"docs\":[", shard_count);
+    for (i32 i = 0; i < docs.count; i++) {
+        if (i > 0) append_char(&sb, ',');
+        append_char(&sb, '[');
+        append_json_string(&sb, docs[i]->url);
+        append_char(&sb, ',');
+        append_json_string(&sb, docs[i]->title);
+        append_char(&sb, ']');
+    }
+    append_string(&sb, "]}");
+
+    write_file(join_path(output, "search/docs.json", scratch), &sb);
+}
+
+// NOTE(jesper): the servable files of the output packed into a single file: a header, the
+// entries sorted by url, a string table of the urls and content types, and then the
+// bodies, each starting on a page boundary so they can be mapped or sent straight from the
+// file. Offsets are from the start of the file, string offsets from the start of the
+// string table
+#define FSG_PACK_MAGIC "FSGPACK1"
+#define FSG_PACK_VERSION 1
+#define FSG_PACK_ALIGNMENT 4096
+
+enum FsgPackEntryFlags : u32 {
+    FSG_PACK_IMMUTABLE = 1 << 0,
+};
+
+struct FsgPackHeader {
+    char magic[8];
+    u32 version;
+    u32 entry_count;
+    u64 strings_offset;
+    u64 strings_size;
+};
+
+struct FsgPackEntry {
+    u64 body_offset;
+    u64 body_size;
+    u64 etag;
+
+    u32 url_offset;
+    u32 url_length;
+    u32 content_type_offset;
+    u32 content_type_length;
+
+    u32 flags;
+    u32 reserved;
+};
+
+struct FsgPackSource {
+    String url;
+    String path;
+    String content_type;
+};
+
+int compare_pack_sources(const void *lhs, const void *rhs)
+{
+    FsgPackSource *a = (FsgPackSource*)lhs;
+    FsgPackSource *b = (FsgPackSource*)rhs;
+    return a->url < b->url ? -1 : b->url < a->url ? 1 : 0;
+}
+
+bool write_pack_bytes(FILE *f, void *data, u64 size, u64 *offset)
+{
+    if (size > 0 && fwrite(data, 1, size, f) != size) return false;
+    *offset += size;
+    return true;
+}
+
+// NOTE(jesper): the pack is written next to its destination and renamed over it, so a
+// server that has the previous one mapped keeps serving it intact
+bool write_pack(String output, String pack_path)
+{
+    SArena scratch = tl_scratch_arena();
+
+    DynamicArray<String> files = list_files(output, scratch, FILE_LIST_RECURSIVE);
+
+    DynamicArray<FsgPackSource> sources{};
+    for (String p : files) {
+        FsgPackSource src{};
+        src.url = asset_url(output, p, scratch);
+        src.path = p;
+        src.content_type = http_content_type(src.url);
+        if (src.content_type.length == 0) continue;
+
+        array_add(&sources, src);
+    }
+
+    qsort(sources.data, sources.count, sizeof(FsgPackSource), compare_pack_sources);
+
+    FsgPackEntry *entries = (FsgPackEntry*)calloc(MAX(sources.count, 1), sizeof *entries);
+    defer { free(entries); };
+
+    StringBuilder strings{ .alloc = scratch };
+    i32 strings_size = 0;
+    for (i32 i = 0; i < sources.count; i++) {
+        entries[i].url_offset = strings_size;
+        entries[i].url_length = sources[i].url.length;
+        append_string(&strings, sources[i].url);
+        strings_size += sources[i].url.length;
+
+        entries[i].content_type_offset = strings_size;
+        entries[i].content_type_length = sources[i].content_type.length;
+        append_string(&strings, sources[i].content_type);
+        strings_size += sources[i].content_type.length;
+
+        if (is_fingerprinted_path(sources[i].url)) entries[i].flags |= FSG_PACK_IMMUTABLE;
+    }
+
+    FsgPackHeader header{};
+    memcpy(header.magic, FSG_PACK_MAGIC, sizeof header.magic);
+    header.version = FSG_PACK_VERSION;
+    header.entry_count = sources.count;
+    header.strings_offset = sizeof header + sources.count*sizeof *entries;
+    header.strings_size = strings_size;
+
+    char sz_path[4096], sz_tmp_path[4096];
+    snprintf(sz_path, sizeof sz_path, "%.*s", STRFMT(pack_path));
+    snprintf(sz_tmp_path, sizeof sz_tmp_path, "%.*s.tmp", STRFMT(pack_path));
+
+    FILE *f = fopen(sz_tmp_path, "wb");
+    if (!f) {
+        LOG_ERROR("failed opening '%s' for writing", sz_tmp_path);
+        return false;
+    }
+
+    static char padding[FSG_PACK_ALIGNMENT];
+    String strings_data = create_string(&strings, scratch);
+
+    u64 offset = 0;
+    bool success =
+        write_pack_bytes(f, &header, sizeof header, &offset) &&
+        write_pack_bytes(f, entries, sources.count*sizeof *entries, &offset) &&
+        write_pack_bytes(f, strings_data.data, strings_data.length, &offset);
+
+    for (i32 i = 0; i < sources.count && success; i++) {
+        SArena mem_file = tl_scratch_arena(scratch);
+
+        FileInfo contents = read_file(sources[i].path, mem_file);
+        if (!contents.data && contents.size != 0) {
+            LOG_ERROR("failed reading %.*s", STRFMT(sources[i].path));
+            success = false;
+            break;
+        }
+
+        u64 aligned = (offset + FSG_PACK_ALIGNMENT-1) & ~(u64)(FSG_PACK_ALIGNMENT-1);
+        success = write_pack_bytes(f, padding, aligned-offset, &offset);
+
+        entries[i].body_offset = offset;
+        entries[i].body_size = contents.size;
+        entries[i].etag = hash_bytes(contents.data, contents.size);
+
+        success = success && write_pack_bytes(f, contents.data, contents.size, &offset);
+    }
+
+    // NOTE(jesper): the entries were written as placeholders before the bodies were laid out
+    success = success &&
+        fseek(f, sizeof header, SEEK_SET) == 0 &&
+        fwrite(entries, sizeof *entries, sources.count, f) == (size_t)sources.count;
+
+    success = fclose(f) == 0 && success;
+    if (!success) {
+        LOG_ERROR("failed writing pack '%s'", sz_tmp_path);
+        remove(sz_tmp_path);
+        return false;
+    }
+
+    if (rename(sz_tmp_path, sz_path) != 0) {
+        LOG_ERROR("failed renaming '%s' to '%s'", sz_tmp_path, sz_path);
+        remove(sz_tmp_path);
+        return false;
+    }
+
+    LOG_INFO("packed %d files into '%s' (%llu bytes)", sources.count, sz_path, (unsigned long long)offset);
+    return true;
+}
+
+struct FsgSite {
+    String src_dir;
+    String output;
+    FsgOptions opts;
+
+    String posts_src_path;
+    String posts_dst_path;
+
+    DynamicArray<FsgTemplate> templates;
+    DynamicArray<FsgPost> posts;
+    DynamicArray<FsgPage> pages;
+    DynamicArray<FsgTag> tags;
+    DynamicArray<FsgAsset> assets;
+    DynamicArray<FsgImage> images;
+    DynamicArray<FsgImageProbe> image_probes;
+
+    // NOTE(jesper): the css and js bundles of the templates, see bundle_template_assets.
+    // Rebuilt with the templates, unlike the assets
+    DynamicArray<FsgAsset> bundles;
+
+    // NOTE(jesper): indices into posts, newest first. The posts stay where they were
+    // loaded so that the tags can refer to them by index
+    DynamicArray<i32> post_order;
+
+    // NOTE(jesper): combined stat of the inputs that everything else is derived from,
+    // when they change the daemon reloads the whole site rather than tracking who
+    // referenced what
+    u64 assets_signature;
+    u64 templates_signature;
+
+    // NOTE(jesper): the latest page-weight report of every rendered page, sorted by url.
+    // Kept across daemon generations so that the budgets are checked against every page
+    // rather than only the re-rendered ones, see merge_page_reports
+    DynamicArray<FsgPageReport> page_reports;
+    bool page_reports_complete;
+
+    i32 next_post_id;
+    bool search_dirty;
+};
+
+struct FsgRenderStats {
+    i32 tags;
+    i32 pages;
+    i32 posts;
+    i32 over_budget;
+
+    // NOTE(jesper): the page-weight report when there's no report_path to write it to, for
+    // the caller to print, or for the daemon to send back to its client
+    String report;
+};
+
+void resolve_options(FsgOptions *opts, String src_dir)
+{
+    if (opts->cache_dir.length == 0) opts->cache_dir = join_path(src_dir, "_cache", mem_dynamic);
+    if (opts->socket_path.length == 0) opts->socket_path = join_path(opts->cache_dir, "fsg.sock", mem_dynamic);
+}
+
+FsgSite create_site(String output, String src_dir, FsgOptions opts)
+{
+    resolve_options(&opts, src_dir);
+
+    FsgSite site{};
+    site.src_dir = src_dir;
+    site.output = output;
+    site.opts = opts;
+    site.posts_src_path = join_path(src_dir, "_posts", mem_dynamic);
+    site.posts_dst_path = join_path(output, "posts", mem_dynamic);
+    return site;
+}
+
+// NOTE(jesper): also removes the directories the file leaves empty, up to the output root,
+// for pages and posts from nested source directories
+void remove_output(FsgSite *site, String path)
+{
+    char sz_path[4096];
+    snprintf(sz_path, sizeof sz_path, "%.*s", STRFMT(path));
+
+    // NOTE(jesper): a removed page no longer counts against the budgets
+    SArena scratch = tl_scratch_arena();
+    String url = asset_url(site->output, path, scratch);
+    for (i32 i = 0; i < site->page_reports.count; i++) {
+        if (site->page_reports[i].url != url) continue;
+
+        destroy_page_report(&site->page_reports[i]);
+        for (i32 j = i; j < site->page_reports.count-1; j++) site->page_reports[j] = site->page_reports[j+1];
+        site->page_reports.count--;
+        break;
+    }
+
+    if (remove(sz_path) != 0) return;
+
+    i32 length = path.length;
+    while (length > site->output.length) {
+        while (length > site->output.length && sz_path[length] != '/' && sz_path[length] != '\\') length--;
+        if (length <= site->output.length) break;
+
+        sz_path[length] = '\0';
+        if (remove(sz_path) != 0) break;
+    }
+}
+
+u64 source_signature(u64 signature, Array<FsgSourceFile> files)
+{
+    for (FsgSourceFile file : files) {
+        u64 fields[] = { hash_bytes(file.path.data, file.path.length), (u64)file.stat.mtime, (u64)file.stat.size };
+        signature = (signature ^ hash_bytes(fields, sizeof fields)) * 1099511628211ull;
+    }
+
+    return signature;
+}
+
+u64 asset_signature(String src_dir)
+{
+    SArena scratch = tl_scratch_arena();
+
+    u64 signature = 0;
+
+    const char *folders[] = { "img", "fonts", "assets", "css", "js" };
+    for (const char *folder : folders) {
+        DynamicArray<FsgSourceFile> files = list_source_files(join_path(src_dir, folder, scratch), true, nullptr, scratch);
+        signature = source_signature(signature, files);
+    }
+
+    return signature;
+}
+
+// NOTE(jesper): pages are every file under the site root, except those in the source and
+// asset directories at its root, and the output if it's been put in there too
+bool is_page_dir(FsgSite *site, String dir)
+{
+    if (dir == site->output || dir == site->opts.cache_dir) return false;
+
+    String name{ dir.data+site->src_dir.length+1, dir.length-site->src_dir.length-1 };
+    for (i32 i = 0; i < name.length; i++) {
+        if (name[i] == '/' || name[i] == '\\') return true;
+    }
+
+    if (name.length > 0 && name[0] == '_') return false;
+
+    const char *folders[] = { "img", "fonts", "assets", "css", "js" };
+    for (const char *folder : folders) {
+        if (name == folder) return false;
+    }
+
+    return true;
+}
+
+// NOTE(jesper): every file under src outside of the directories is_page_dir prunes is a
+// page, other than the pack when it's written into src
+DynamicArray<FsgSourceFile> list_page_files(FsgSite *site, Allocator mem)
+{
+    SArena scratch = tl_scratch_arena(mem);
+
+    DynamicArray<FsgSourceFile> files = list_source_files(
+        site->src_dir, true,
+        [site](String dir) { return !is_page_dir(site, dir); },
+        mem);
+
+    String pack_path = site->opts.pack_path;
+    String pack_tmp_path = stringf(scratch, "%.*s.tmp", STRFMT(pack_path));
+
+    i32 kept = 0;
+    for (FsgSourceFile file : files) {
+        if (pack_path.length > 0 && (file.path == pack_path || file.path == pack_tmp_path)) continue;
+        files[kept++] = file;
+    }
+    files.count = kept;
+
+    return files;
+}
+
+String tag_page_path(FsgSite *site, FsgTag &tag)
+{
+    return join_path(site->output, stringf(mem_dynamic, "/posts/tag/%.*s.html", STRFMT(tag.str)), mem_dynamic);
+}
+
+void destroy_post(FsgPost *post)
+{
+    if (post->brief.data && post->brief.data != post->content.data) destroy_string(post->brief);
+    if (post->content.data) destroy_string(post->content);
+    if (post->title.data) destroy_string(post->title);
+    if (post->created.data) destroy_string(post->created);
+    if (post->src_path.data) destroy_string(post->src_path);
+    if (post->path.data) destroy_string(post->path);
+    *post = {};
+}
+
+void destroy_page(FsgPage *page)
+{
+    if (page->contents.data) destroy_string(page->contents);
+    if (page->src_path.data) destroy_string(page->src_path);
+    if (page->path.data) destroy_string(page->path);
+    *page = {};
+}
+
+// NOTE(jesper): posts are loaded in two passes. The first only parses the fsg: metadata
+// comments, which is all that's needed to tell drafts apart, sort the posts and build the
+// tags. The body is converted by load_post_body, and only for the posts that are rendered.
+// Posts are loaded in parallel, the caller hands out the ids once they're all done
+bool load_post(FsgSite *site, FsgSourceFile file, FsgPost *out)
+{
+    String p = file.path;
+    String filename{ p.data+site->posts_src_path.length+1, p.length-site->posts_src_path.length-1};
+
+    FsgPost post{};
+    post.stat = file.stat;
+
+    // NOTE(jesper): posts are lexed from a stream so the source is never held in memory
+    // in full, which means anything kept from a token has to be copied out of the window
+    Lexer lexer;
+    if (!init_stream_lexer(&lexer, p, (LexerFlags)(LEXER_FLAG_NONE | LEXER_FLAG_ENABLE_ANCHOR | LEXER_FLAG_ENABLE_IMAGE))) {
+        LOG_ERROR("failed reading %.*s", p.length, p.data);
+        return false;
+    }
+    defer { destroy_stream_lexer(&lexer); };
+
+    while (true) {
+        skip_to_markup(&lexer);
+
+        Token t = next_token(&lexer);
+        if (t.type == TOKEN_EOF) break;
+        if (t.type != TOKEN_COMMENT) continue;
+
+        Lexer fsg_lexer{
+            t.str.data,
+            t.str.data+t.str.length,
+            p,
+            (LexerFlags)(LEXER_FLAG_EAT_NEWLINE | LEXER_FLAG_EAT_WHITESPACE)
+        };
+
+        Token t2 = next_token(&fsg_lexer);
+        if (!is_identifier(t2, "fsg")) continue;
+        if (!require_next_token(&fsg_lexer, ':', &t2)) goto parse_error;
+
+        t2 = next_token(&fsg_lexer);
+        if (is_identifier(t2, "brief")) {
+            if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+            if (!require_next_token(&fsg_lexer, TOKEN_EOF, &t2)) goto parse_error;
+            continue;
+        }
+
+        while (t2.type != TOKEN_EOF) {
+            if (is_identifier(t2, "title")) {
+                if (!parse_string(&fsg_lexer, &post.title, &t2)) goto parse_error;
+                post.title = duplicate_string(post.title, mem_dynamic);
+                if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+            } else if (is_identifier(t2, "created")) {
+                if (!parse_string(&fsg_lexer, &post.created, &t2)) goto parse_error;
+                post.created = duplicate_string(post.created, mem_dynamic);
+                if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+            } else if (is_identifier(t2, "draft")) {
+                if (!parse_bool(&fsg_lexer, &post.draft, &t2)) goto parse_error;
+                if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+            } else if (is_identifier(t2, "tags")) {
+                DynamicArray<String> tags{};
+                defer { destroy_array(&tags); };
+
+                bool parsed = parse_string_list(&fsg_lexer, &tags, &t2);
+
+                for (String tag : tags) array_add(&post.tags, intern(tag));
+
+                if (!parsed) goto parse_error;
+                if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+            } else {
+                PARSE_ERRORF(
+                    &fsg_lexer,
+                    "unexpected token. expected one of 'title' or 'date', got '%.*s'",
+                    STRFMT(t2.str));
+                goto parse_error;
+            }
+
+            t2 = next_token(&fsg_lexer);
+        }
+    }
+
+    post.src_path = duplicate_string(p, mem_dynamic);
+    post.path = join_path(site->posts_dst_path, filename, mem_dynamic);
+    post.url = join_url("/posts", filename);
+    for (i32 i = 0; i < post.url.length; i++) {
+        if (post.url[i] == '\\') post.url[i] = '/';
+    }
+    post.dirty = true;
+
+    *out = post;
+    return true;
+
+parse_error:
+    destroy_post(&post);
+    return false;
+}
+
+bool is_brief_marker(Token comment)
+{
+    Lexer lexer{
+        comment.str.data,
+        comment.str.data+comment.str.length,
+        {},
+        (LexerFlags)(LEXER_FLAG_EAT_NEWLINE | LEXER_FLAG_EAT_WHITESPACE)
+    };
+
+    return is_identifier(next_token(&lexer), "fsg") &&
+        next_token(&lexer).type == ':' &&
+        is_identifier(next_token(&lexer), "brief");
+}
+
+// NOTE(jesper): second pass, converting the body of a post loaded by load_post to html.
+// The metadata was validated by the first pass, so comments are only checked for the
+// brief marker here. The source is streamed, but the converted body is built whole, so
+// this takes memory in proportion to the size of the post, and a post must convert to
+// less than 2 GB, the most a String holds
+bool load_post_body(FsgSite *site, FsgPost *post)
+{
+    FsgOptions &opts = site->opts;
+
+    if (post->stat.size >= INT32_MAX) {
+        LOG_ERROR("post too large to convert: %.*s", STRFMT(post->src_path));
+        return false;
+    }
+
+    Lexer lexer;
+    if (!init_stream_lexer(&lexer, post->src_path, (LexerFlags)(LEXER_FLAG_NONE | LEXER_FLAG_ENABLE_ANCHOR | LEXER_FLAG_ENABLE_IMAGE))) {
+        LOG_ERROR("failed reading %.*s", STRFMT(post->src_path));
+        return false;
+    }
+    defer { destroy_stream_lexer(&lexer); };
+
+    StringBuilder content{};
+    i32 image_count = 0;
+
+    for (Token t = next_token(&lexer); t.type != TOKEN_EOF; t = next_token(&lexer)) {
+        if (t.type == TOKEN_COMMENT) {
+            if (is_brief_marker(t)) post->brief = create_string(&content, mem_dynamic);
+        } else if (t.type == TOKEN_CODE_BLOCK) {
+            append_code_block(&content, t.str, opts);
+        } else if (t.type == TOKEN_CODE_INLINE) {
+            append_string(&content, "<code>");
+            append_escape_html(&content, t.str);
+            append_string(&content, "</code>");
+        } else if (t.type == TOKEN_IMAGE) {
+            i32 length = (i32)(t.str.data - lexer.token_start);
+            if (length > 0) append_string(&content, String{ lexer.token_start, length });
+
+            append_image(&content, t.str, site->images, site->image_probes, image_count++ > 0, opts);
+        } else if (t.type == TOKEN_ANCHOR) {
+            i32 length = (i32)(t.str.data - lexer.token_start);
+            if (length > 0) append_string(&content, String{ lexer.token_start, length });
+
+            Array<TagProperty> properties = parse_html_tag_properties(t.str);
+            String inner = parse_html_tag_inner(t.str);
+
+            bool has_href = false;
+            append_string(&content, "<a");
+
+            for (TagProperty prop : properties) {
+                if (prop.key == "href") has_href = true;
+                append_tag_property(&content, prop);
+            }
+
+            if (!has_href) append_stringf(&content, " href=\"%.*s\"", STRFMT(inner));
+            append_stringf(&content, ">%.*s</a>", STRFMT(inner));
+        } else {
+            i32 length = (i32)(lexer.at - lexer.token_start);
+            if (length > 0) append_string(&content, String{ lexer.token_start, length });
+        }
+    }
+
+    post->content = create_string(&content, mem_dynamic);
+    post->content_hash = hash_bytes(post->content.data, post->content.length);
+    post->content_dropped = false;
+    if (post->brief.length == 0) {
+        post->brief = create_excerpt(post->content, opts.brief_max_words, opts.brief_max_bytes, mem_dynamic);
+    }
+
+    post->has_body = true;
+    return true;
+}
+
+// NOTE(jesper): converts the bodies of the posts that will be rendered and haven't been
+// yet, excluded drafts are never converted. A post whose body fails to load is still
+// listed, with an empty body, and retried when its source changes
+void load_post_bodies(FsgSite *site)
+{
+    // NOTE(jesper): in low memory mode the bodies are converted while rendering instead,
+    // see stream_posts
+    if (site->opts.memory_budget_mb > 0) return;
+
+    DynamicArray<FsgPost*> pending{};
+
+    for (FsgPost &post : site->posts) {
+        if (post.has_body) continue;
+        if (!site->opts.build_drafts && post.draft) continue;
+        array_add(&pending, &post);
+    }
+
+    parallel_for(pending.count, [&](i32 i) {
+        load_post_body(site, pending[i]);
+    });
+}
+
+bool parse_template(String p, String contents, FsgTemplate *out)
+{
+    FsgTemplate tmpl{};
+    tmpl.contents = contents;
+
+    FsgPart tail{};
+    i32 last_section_end = 0;
+
+
+    String filename = p;
+    while (filename.length > 0 && filename[filename.length-1] != '.') filename.length--;
+    filename.length = filename.data[filename.length-1] == '.' ? filename.length-1 : filename.length;
+
+    filename.data = filename.data + filename.length-1;
+    while (filename.data > p.data && filename.data[0] != '\\' && filename.data[0] != '/') filename.data--;
+    filename.data = *filename.data == '\\' || *filename.data == '/' ? filename.data+1 : filename.data;
+    filename.length -= (i32)(filename.data-p.data);
+
+    DynamicArray<FsgPart> parts{};
+
+    Lexer lexer{ contents.data, contents.data+contents.length, p };
+
+    Token t = next_token(&lexer);
+    while (t.type != TOKEN_EOF) {
+        if (t.type == TOKEN_COMMENT) {
+            char *comment_start = t.str.data-4;
+            char *comment_end = t.str.data+t.str.length+3;
+
+            Lexer fsg_lexer{
+                t.str.data,
+                t.str.data+t.str.length,
+                p,
+                (LexerFlags)(LEXER_FLAG_EAT_WHITESPACE | LEXER_FLAG_EAT_NEWLINE)
+            };
+
+            Token t2 = next_token(&fsg_lexer);
+            if (is_identifier(t2, "fsg")) {
+                FsgPart part{};
+
+                if (!require_next_token(&fsg_lexer, ':', &t2)) return false;
+
+                t2 = next_token(&fsg_lexer);
+                while (t2.type != TOKEN_EOF) {
+
+                    if (is_identifier(t2, "section")) {
+                        if (!parse_string(&fsg_lexer, &part.variable, &t2)) return false;
+                        if (!require_next_token(&fsg_lexer, ';', &t2)) return false;
+                        part.type = FSG_PART_VARIABLE;
+                        part.symbol = intern(part.variable);
+                    } else if (is_identifier(t2, "include")) {
+                        if (!parse_string(&fsg_lexer, &part.variable, &t2)) return false;
+                        if (!require_next_token(&fsg_lexer, ';', &t2)) return false;
+                        part.type = FSG_PART_INCLUDE;
+                        part.symbol = intern(part.variable);
+                    } else {
+                        PARSE_ERRORF(&fsg_lexer, "unexpected token. expected one of 'section', 'include', got '%.*s'", STRFMT(t2.str));
+                        return false;
+                    }
+
+                    t2 = next_token(&fsg_lexer);
+
+                }
+
+                part.text = String{
+                    contents.data+last_section_end,
+                    (i32)(comment_start-contents.data-last_section_end)
+                };
+                last_section_end = (i32)(comment_end - contents.data);
+                array_add(&parts, part);
+            }
+
+        }
+
+        t = next_token(&lexer);
+    }
+
+    tail = FsgPart{
+        .type = FSG_PART_CHUNK,
+        .text = String{
+            contents.data+last_section_end,
+            (i32)(lexer.end - (contents.data + last_section_end))
+        },
+    };
+    if (tail.text.length > 0) array_add(&parts, tail);
+
+    tmpl.name = duplicate_string(filename, mem_dynamic);
+    tmpl.symbol = intern(tmpl.name);
+    tmpl.parts = parts;
+
+    *out = tmpl;
+    return true;
+}
+
+// NOTE(jesper): the element names, classes and ids appearing in a template's markup, which
+// decide which of the site's css rules are critical to the pages rendered with it
+struct FsgMarkupSelectors {
+    DynamicArray<String> tags;
+    DynamicArray<String> classes;
+    DynamicArray<String> ids;
+};
+
+// NOTE(jesper): a stylesheet read for bundling or critical css extraction, with its
+// relative urls resolved against its own url so that its rules can be moved anywhere
+struct FsgStylesheet {
+    String url;
+    String css;
+};
+
+bool contains_string(Array<String> strs, String str, bool ignore_case = false)
+{
+    for (String s : strs) {
+        if (ignore_case ? eq_ignore_case(s, str) : s == str) return true;
+    }
+    return false;
+}
+
+bool contains_substring(String haystack, String needle)
+{
+    if (needle.length == 0) return true;
+
+    char *end = haystack.data + haystack.length - needle.length + 1;
+    for (char *at = haystack.data; at < end; at++) {
+        at = find_char(at, end, needle[0]);
+        if (at == end) break;
+        if (memcmp(at, needle.data, needle.length) == 0) return true;
+    }
+    return false;
+}
+
+bool is_css_name_char(char c)
+{
+    return is_alpha(c) || is_number(c) || c == '-' || c == '_' || (u8)c >= 0x80;
+}
+
+String trim_css(char *start, char *end)
+{
+    while (start < end && is_html_whitespace(*start)) start++;
+    while (end > start && is_html_whitespace(end[-1])) end--;
+    return String{ start, (i32)(end-start) };
+}
+
+char* skip_css_space(char *at, char *end)
+{
+    while (at < end) {
+        if (is_html_whitespace(*at)) {
+            at++;
+        } else if (end-at >= 2 && at[0] == '/' && at[1] == '*') {
+            at += 2;
+            while (end-at >= 2 && !(at[0] == '*' && at[1] == '/')) at++;
+            at = MIN(at+2, end);
+        } else {
+            break;
+        }
+    }
+    return at;
+}
+
+// NOTE(jesper): finds the next c that isn't inside a string, comment or nested block, or
+// the closing bracket of the block the search started in, whichever comes first. Returns
+// end if there's neither
+char* find_css_char(char *at, char *end, char c)
+{
+    i32 depth = 0;
+    while (at < end) {
+        if (*at == '"' || *at == '\'') {
+            char quote = *at++;
+            while (at < end && *at != quote) at += *at == '\\' ? 2 : 1;
+            at = MIN(at+1, end);
+            continue;
+        }
+
+        if (end-at >= 2 && at[0] == '/' && at[1] == '*') {
+            at = skip_css_space(at, end);
+            continue;
+        }
+
+        if (depth == 0 && *at == c) return at;
+
+        if (*at == '{' || *at == '(' || *at == '[') {
+            depth++;
+        } else if (*at == '}' || *at == ')' || *at == ']') {
+            if (depth == 0) return at;
+            depth--;
+        }
+
+        at++;
+    }
+
+    return end;
+}
+
+void collect_markup_selectors(String html, FsgMarkupSelectors *selectors)
+{
+    char *at = html.data;
+    char *end = html.data + html.length;
+
+    while (at < end) {
+        at = find_char(at, end, '<');
+        if (at == end) break;
+
+        char *tag_start = at++;
+        if (at == end || !is_alpha(*at)) continue;
+
+        String name{ at, 0 };
+        while (at < end && is_css_name_char(*at)) at++;
+        name.length = (i32)(at-name.data);
+
+        char quote = 0;
+        while (at < end && (quote || *at != '>')) {
+            if (quote && *at == quote) quote = 0;
+            else if (!quote && (*at == '"' || *at == '\'')) quote = *at;
+            at++;
+        }
+
+        // NOTE(jesper): tags split by a section are only partially visible from here, only
+        // their name is taken
+        if (!contains_string(selectors->tags, name, true)) array_add(&selectors->tags, name);
+        if (at == end) break;
+
+        String tag{ tag_start, (i32)(at+1-tag_start) };
+        for (TagProperty property : parse_html_tag_properties(tag)) {
+            if (eq_ignore_case(property.key, "id")) {
+                if (!contains_string(selectors->ids, property.value)) array_add(&selectors->ids, property.value);
+            } else if (eq_ignore_case(property.key, "class")) {
+                char *c = property.value.data;
+                char *c_end = property.value.data + property.value.length;
+                while (c < c_end) {
+                    while (c < c_end && is_html_whitespace(*c)) c++;
+
+                    String cls{ c, 0 };
+                    while (c < c_end && !is_html_whitespace(*c)) c++;
+                    cls.length = (i32)(c-cls.data);
+
+                    if (cls.length > 0 && !contains_string(selectors->classes, cls)) {
+                        array_add(&selectors->classes, cls);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// NOTE(jesper): whether every element name, class and id in the compound selectors of
+// selector appears in the markup. Combinators, attribute selectors and pseudo-classes are
+// ignored, so this errs on the side of keeping a rule
+bool is_selector_used(String selector, FsgMarkupSelectors *used)
+{
+    char *at = selector.data;
+    char *end = selector.data + selector.length;
+
+    while (at < end) {
+        char c = *at;
+
+        if (c == '.' || c == '#') {
+            String name{ ++at, 0 };
+            while (at < end && (is_css_name_char(*at) || *at == '\\')) at += *at == '\\' ? 2 : 1;
+            name.length = (i32)(MIN(at, end)-name.data);
+
+            if (!contains_string(c == '.' ? used->classes : used->ids, name)) return false;
+        } else if (is_alpha(c)) {
+            String name{ at, 0 };
+            while (at < end && is_css_name_char(*at)) at++;
+            name.length = (i32)(at-name.data);
+
+            if (!contains_string(used->tags, name, true)) return false;
+        } else if (c == ':') {
+            while (at < end && *at == ':') at++;
+            while (at < end && is_css_name_char(*at)) at++;
+            if (at < end && *at == '(') at = MIN(find_css_char(at+1, end, ')')+1, end);
+        } else if (c == '[') {
+            at = MIN(find_css_char(at+1, end, ']')+1, end);
+        } else {
+            at++;
+        }
+    }
+
+    return true;
+}
+
+// NOTE(jesper): appends the rules with at least one selector used by the markup, keeping
+// only the selectors that are, along with the @media and @supports blocks around them.
+// Whether a @font-face is needed depends on the rules that were kept, so those are
+// collected separately. Any other at-rule is dropped
+void append_critical_rules(
+    StringBuilder *sb,
+    String css,
+    FsgMarkupSelectors *used,
+    DynamicArray<String> *font_faces)
+{
+    char *at = css.data;
+    char *end = css.data + css.length;
+
+    while (true) {
+        at = skip_css_space(at, end);
+        if (at == end) break;
+        if (*at == '}' || *at == ';') {
+            at++;
+            continue;
+        }
+
+        char *block = find_css_char(at, end, '{');
+        if (*at == '@') {
+            String name{ at+1, 0 };
+            while (name.data+name.length < end && is_css_name_char(name[name.length])) name.length++;
+
+            char *semicolon = find_css_char(at, end, ';');
+            if (semicolon < block) {
+                at = semicolon+1;
+                continue;
+            }
+        }
+
+        if (block == end || *block != '{') break;
+        char *block_end = find_css_char(block+1, end, '}');
+
+        String prelude = trim_css(at, block);
+        String body = trim_css(block+1, block_end);
+        at = MIN(block_end+1, end);
+
+        if (prelude.length > 0 && prelude[0] == '@') {
+            if (starts_with(prelude, "@media") || starts_with(prelude, "@supports")) {
+                SArena scratch = tl_scratch_arena(sb->alloc);
+                StringBuilder inner{ .alloc = scratch };
+                append_critical_rules(&inner, body, used, font_faces);
+
+                String rules = create_string(&inner, scratch);
+                if (rules.length > 0) append_stringf(sb, "%.*s{%.*s}", STRFMT(prelude), STRFMT(rules));
+            } else if (starts_with(prelude, "@font-face")) {
+                array_add(font_faces, body);
+            }
+            continue;
+        }
+
+        bool kept = false;
+        char *selector = prelude.data;
+        char *prelude_end = prelude.data + prelude.length;
+        while (selector < prelude_end) {
+            char *selector_end = find_css_char(selector, prelude_end, ',');
+
+            String s = trim_css(selector, selector_end);
+            if (s.length > 0 && is_selector_used(s, used)) {
+                if (kept) append_char(sb, ',');
+                append_string(sb, s);
+                kept = true;
+            }
+
+            selector = selector_end+1;
+        }
+
+        if (kept) append_stringf(sb, "{%.*s}", STRFMT(body));
+    }
+}
+
+String css_declaration(String body, String property)
+{
+    char *at = body.data;
+    char *end = body.data + body.length;
+
+    while (at < end) {
+        char *decl_end = find_css_char(at, end, ';');
+        char *colon = find_css_char(at, decl_end, ':');
+
+        if (colon < decl_end && trim_css(at, colon) == property) {
+            return trim_css(colon+1, decl_end);
+        }
+
+        at = decl_end+1;
+    }
+
+    return {};
+}
+
+String css_url(String value, char **next)
+{
+    char *at = value.data;
+    char *end = value.data + value.length;
+
+    while (end-at >= 4) {
+        if (memcmp(at, "url(", 4) == 0) {
+            char *close = find_css_char(at+4, end, ')');
+            *next = MIN(close+1, end);
+
+            String url = trim_css(at+4, close);
+            if (url.length >= 2 && (url[0] == '"' || url[0] == '\'')) {
+                url = String{ url.data+1, url.length-2 };
+            }
+            return url;
+        }
+        at++;
+    }
+
+    *next = end;
+    return {};
+}
+
+String font_preload_type(String url)
+{
+    if (ends_with(url, ".woff2")) return "font/woff2";
+    if (ends_with(url, ".woff")) return "font/woff";
+    if (ends_with(url, ".ttf")) return "font/ttf";
+    if (ends_with(url, ".otf")) return "font/otf";
+    return {};
+}
+
+// NOTE(jesper): rewrites the relative url()s in css to root-relative ones, resolved
+// against the directory of the stylesheet's own url
+void append_resolved_css_urls(StringBuilder *sb, String css, String css_url_dir)
+{
+    char *at = css.data;
+    char *end = css.data + css.length;
+    char *flushed = at;
+
+    while (at < end) {
+        String url = css_url(String{ at, (i32)(end-at) }, &at);
+        if (url.length == 0 ||
+            url[0] == '/' || url[0] == '#' ||
+            starts_with(url, "data:") || find_char(url.data, url.data+url.length, ':') < url.data+url.length)
+        {
+            continue;
+        }
+
+        append_string(sb, String{ flushed, (i32)(url.data-flushed) });
+
+        String dir = css_url_dir;
+        while (true) {
+            if (starts_with(url, "./")) {
+                url = String{ url.data+2, url.length-2 };
+            } else if (starts_with(url, "../")) {
+                url = String{ url.data+3, url.length-3 };
+                if (dir.length > 1) dir.length--;
+                while (dir.length > 1 && dir[dir.length-1] != '/') dir.length--;
+            } else {
+                break;
+            }
+        }
+
+        append_string(sb, dir);
+        append_string(sb, url);
+        flushed = url.data+url.length;
+    }
+
+    append_string(sb, String{ flushed, (i32)(end-flushed) });
+}
+
+FsgStylesheet* find_stylesheet(FsgSite *site, DynamicArray<FsgStylesheet> *stylesheets, String url)
+{
+    for (FsgStylesheet &sheet : *stylesheets) {
+        if (sheet.url == url) return sheet.css.data ? &sheet : nullptr;
+    }
+
+    FsgStylesheet sheet{ .url = url };
+
+    // NOTE(jesper): only stylesheets served from the site's own source can be inlined
+    if (url.length > 1 && url[0] == '/' && url[1] != '/' &&
+        find_char(url.data, url.data+url.length, '?') == url.data+url.length)
+    {
+        SArena scratch = tl_scratch_arena();
+        String path = join_path(site->src_dir, String{ url.data+1, url.length-1 }, scratch);
+
+        FileInfo contents = read_file(path, scratch);
+        if (contents.data) {
+            String dir = url;
+            while (dir[dir.length-1] != '/') dir.length--;
+
+            StringBuilder sb{ .alloc = mem_dynamic };
+            append_resolved_css_urls(&sb, String{ (char*)contents.data, contents.size }, dir);
+            sheet.css = create_string(&sb, mem_dynamic);
+        }
+    }
+
+    array_add(stylesheets, sheet);
+    return sheet.css.data ? &stylesheets->data[stylesheets->count-1] : nullptr;
+}
+
+// NOTE(jesper): inlines the rules of the template's stylesheets that apply to its markup
+// into its <head>, preloads the fonts those rules use, and turns the stylesheet links into
+// preloads that only apply once loaded, so that they no longer block the first render.
+// This runs once per template when they're loaded, pages render the rewritten parts as
+// they would any other
+void inline_critical_css(FsgSite *site, FsgTemplate *tmpl, DynamicArray<FsgStylesheet> *stylesheets)
+{
+    SArena scratch = tl_scratch_arena();
+
+    i32 head_part = -1;
+    char *head_end = nullptr;
+    for (i32 i = 0; i < tmpl->parts.count && head_part == -1; i++) {
+        String text = tmpl->parts[i].text;
+        for (char *at = text.data; at+7 <= text.data+text.length; at++) {
+            if (at[0] == '<' && eq_ignore_case(String{ at, 7 }, "</head>")) {
+                head_part = i;
+                head_end = at;
+                break;
+            }
+        }
+    }
+    if (head_part == -1) return;
+
+    FsgMarkupSelectors used{};
+    for (FsgPart &part : tmpl->parts) collect_markup_selectors(part.text, &used);
+
+    StringBuilder css{ .alloc = scratch };
+    DynamicArray<String> links{};
+
+    for (FsgPart &part : tmpl->parts) {
+        char *at = part.text.data;
+        char *end = part.text.data + part.text.length;
+
+        while (at < end) {
+            at = find_char(at, end, '<');
+            if (end-at < 5 || !eq_ignore_case(String{ at+1, 4 }, "link")) {
+                at = MIN(at+1, end);
+                continue;
+            }
+
+            char *tag_end = find_char(at, end, '>');
+            if (tag_end == end) break;
+
+            String tag{ at, (i32)(tag_end+1-at) };
+            at = tag_end+1;
+
+            String rel{}, href{};
+            for (TagProperty property : parse_html_tag_properties(tag)) {
+                if (eq_ignore_case(property.key, "rel")) rel = property.value;
+                else if (eq_ignore_case(property.key, "href")) href = property.value;
+            }
+
+            if (!eq_ignore_case(rel, "stylesheet")) continue;
+
+            FsgStylesheet *sheet = find_stylesheet(site, stylesheets, href);
+            if (!sheet) continue;
+
+            append_string(&css, sheet->css);
+            append_char(&css, '\n');
+            array_add(&links, tag);
+        }
+    }
+
+    if (links.count == 0) return;
+
+    StringBuilder rules_sb{ .alloc = scratch };
+    DynamicArray<String> font_faces{};
+    append_critical_rules(&rules_sb, create_string(&css, scratch), &used, &font_faces);
+    String rules = create_string(&rules_sb, scratch);
+
+    StringBuilder head{ .alloc = scratch };
+    append_string(&head, "<style>");
+
+    DynamicArray<String> fonts{};
+    for (String face : font_faces) {
+        String family = css_declaration(face, "font-family");
+        if (family.length >= 2 && (family[0] == '"' || family[0] == '\'')) {
+            family = String{ family.data+1, family.length-2 };
+        }
+
+        if (family.length == 0 || !contains_substring(rules, family)) continue;
+        append_stringf(&head, "@font-face{%.*s}", STRFMT(face));
+
+        char *next = nullptr;
+        String src = css_declaration(face, "src");
+        String url = css_url(src, &next);
+        if (url.length > 0 && url[0] == '/' && font_preload_type(url).length > 0) {
+            array_add(&fonts, url);
+        }
+    }
+
+    append_string(&head, rules);
+    append_string(&head, "</style>");
+
+    for (String url : fonts) {
+        append_stringf(
+            &head,
+            "<link rel=\"preload\" href=\"%.*s\" as=\"font\" type=\"%.*s\" crossorigin>",
+            STRFMT(url), STRFMT(font_preload_type(url)));
+    }
+
+    String head_html = create_string(&head, scratch);
+
+    for (i32 i = 0; i < tmpl->parts.count; i++) {
+        FsgPart &part = tmpl->parts[i];
+        char *at = part.text.data;
+        char *end = part.text.data + part.text.length;
+
+        bool rewritten = i == head_part;
+        for (String link : links) rewritten = rewritten || (link.data >= at && link.data < end);
+        if (!rewritten) continue;
+
+        StringBuilder sb{ .alloc = mem_dynamic };
+        while (at < end) {
+            char *next = end;
+            for (String link : links) {
+                if (link.data >= at && link.data < next) next = link.data;
+            }
+            if (i == head_part && head_end >= at && head_end < next) next = head_end;
+
+            append_string(&sb, String{ at, (i32)(next-at) });
+            if (next == end) break;
+
+            if (next == head_end) {
+                append_string(&sb, head_html);
+                append_string(&sb, "</head>");
+                at = next+7;
+                continue;
+            }
+
+            String href{};
+            String link{ next, (i32)(find_char(next, end, '>')+1-next) };
+            for (TagProperty property : parse_html_tag_properties(link)) {
+                if (eq_ignore_case(property.key, "href")) href = property.value;
+            }
+
+            append_stringf(
+                &sb,
+                "<link rel=\"preload\" href=\"%.*s\" as=\"style\" onload=\"this.onload=null;this.rel='stylesheet'\">"
+                "<noscript>%.*s</noscript>",
+                STRFMT(href), STRFMT(link));
+            at = next+link.length;
+        }
+
+        part.text = create_string(&sb, mem_dynamic);
+    }
+}
+
+bool is_js_name_char(char c)
+{
+    return is_alpha(c) || is_number(c) || c == '_' || c == '$' || (u8)c >= 0x80;
+}
+
+// NOTE(jesper): single pass css minifier. Drops comments, collapses whitespace and removes
+// it around the punctuation that doesn't need it, along with the last ; of each block.
+// Strings and url()s are copied verbatim
+void minify_css(StringBuilder *sb, String css)
+{
+    char *at = css.data;
+    char *end = css.data + css.length;
+    char *flushed = at;
+
+    char prev = 0;
+    i32 parens = 0;
+
+    while (at < end) {
+        char *token = skip_css_space(at, end);
+        if (token == end) break;
+
+        if (token > at) {
+            char c = *token;
+            bool combinator = parens == 0 && (c == '+' || c == '~' || prev == '+' || prev == '~');
+            bool tight =
+                prev == 0 || combinator ||
+                prev == '{' || prev == '}' || prev == ';' || prev == ',' || prev == '>' || prev == ':' || prev == '(' ||
+                c == '{' || c == '}' || c == ';' || c == ',' || c == '>' || c == ')' || c == '!';
+
+            append_string(sb, String{ flushed, (i32)(at-flushed) });
+            if (!tight) append_char(sb, ' ');
+            at = flushed = token;
+        }
+
+        char c = *at;
+        if (c == '"' || c == '\'') {
+            at++;
+            while (at < end && *at != c && *at != '\n') at += *at == '\\' ? 2 : 1;
+            at = MIN(at+1, end);
+            prev = c;
+            continue;
+        }
+
+        if ((c == 'u' || c == 'U') && (prev == 0 || !is_css_name_char(at[-1])) &&
+            end-at >= 4 && eq_ignore_case(String{ at, 4 }, "url("))
+        {
+            at = MIN(find_css_char(at+4, end, ')')+1, end);
+            prev = ')';
+            continue;
+        }
+
+        char *next = c == ';' ? skip_css_space(at+1, end) : nullptr;
+        if (c == ';' && (next == end || *next == '}')) {
+            append_string(sb, String{ flushed, (i32)(at-flushed) });
+            flushed = ++at;
+            continue;
+        }
+
+        if (c == '(') parens++;
+        else if (c == ')' && parens > 0) parens--;
+
+        prev = c;
+        at++;
+    }
+
+    append_string(sb, String{ flushed, (i32)(at-flushed) });
+}
+
+bool is_js_regex_keyword(String word)
+{
+    const char *keywords[] = {
+        "return", "typeof", "instanceof", "in", "of", "new", "delete", "void",
+        "throw", "case", "do", "else", "yield", "await",
+    };
+
+    for (const char *keyword : keywords) {
+        if (word == keyword) return true;
+    }
+    return false;
+}
+
+bool is_js_condition_keyword(String word)
+{
+    return word == "if" || word == "while" || word == "for" || word == "with";
+}
+
+#define JS_MAX_NESTING 64
+
+// NOTE(jesper): single pass javascript minifier. Drops comments and collapses whitespace,
+// but keeps the line breaks that automatic semicolon insertion could depend on. Strings,
+// template literals and regular expression literals are copied verbatim, the latter told
+// apart from divisions by the token preceding them. After a ) or } that depends on what
+// was opened: the condition of an if, while, for or with, and a block, are followed by a
+// statement, anything else by an operator
+void minify_js(StringBuilder *sb, String js)
+{
+    char *at = js.data;
+    char *end = js.data + js.length;
+
+    char prev = 0;
+    bool prev_number = false;
+    bool regex_allowed = true;
+    bool space = false;
+    bool newline = false;
+
+    // NOTE(jesper): whether the next token starts a statement, where a { opens a block
+    // rather than an object literal, and whether the last token was a condition keyword
+    bool statement = true;
+    bool condition = false;
+    bool arrow = false;
+
+    // NOTE(jesper): whether a regex may follow the ) or } closing each open ( and {,
+    // nesting past JS_MAX_NESTING is treated as an expression
+    bool paren_regex[JS_MAX_NESTING];
+    bool brace_regex[JS_MAX_NESTING];
+    i32 paren_depth = 0;
+    i32 brace_depth = 0;
+
+    // NOTE(jesper): the brace depth at each ${ of the template literals being copied, so
+    // that the } closing the substitution resumes the literal
+    i32 braces = 0;
+    i32 substitutions[32];
+    i32 substitution_count = 0;
+
+    auto copy_template = [&]() {
+        char *start = at;
+        while (at < end) {
+            if (*at == '\\') {
+                at += 2;
+            } else if (*at == '`') {
+                at++;
+                break;
+            } else if (*at == '$' && at+1 < end && at[1] == '{' && substitution_count < (i32)(sizeof substitutions / sizeof substitutions[0])) {
+                at += 2;
+                substitutions[substitution_count++] = braces++;
+                break;
+            } else {
+                at++;
+            }
+        }
+
+        at = MIN(at, end);
+        append_string(sb, String{ start, (i32)(at-start) });
+        prev = at[-1];
+        prev_number = false;
+        regex_allowed = prev == '{';
+        statement = condition = arrow = false;
+    };
+
+    while (at < end) {
+        char c = *at;
+
+        if (is_html_whitespace(c)) {
+            space = true;
+            newline = newline || c == '\n';
+            at++;
+            continue;
+        }
+
+        if (c == '/' && at+1 < end && at[1] == '/') {
+            at = find_char(at, end, '\n');
+            continue;
+        }
+
+        if (c == '/' && at+1 < end && at[1] == '*') {
+            char *comment_end = at+2;
+            while (end-comment_end >= 2 && !(comment_end[0] == '*' && comment_end[1] == '/')) comment_end++;
+            comment_end = MIN(comment_end+2, end);
+
+            space = true;
+            newline = newline || find_char(at, comment_end, '\n') < comment_end;
+            at = comment_end;
+            continue;
+        }
+
+        if (space && prev != 0) {
+            bool words = is_js_name_char(prev) && is_js_name_char(c);
+            bool merges =
+                (prev == c && (c == '+' || c == '-' || c == '/')) ||
+                (prev_number && c == '.');
+
+            if (newline &&
+                prev != '{' && prev != '(' && prev != '[' && prev != ',' && prev != ';' &&
+                c != '}' && c != ')' && c != ']' && c != ',')
+            {
+                append_char(sb, '\n');
+            } else if (words || merges) {
+                append_char(sb, ' ');
+            }
+        }
+        space = newline = false;
+
+        if (c == '"' || c == '\'') {
+            char *start = at++;
+            while (at < end && *at != c && *at != '\n') at += *at == '\\' ? 2 : 1;
+            at = MIN(at+1, end);
+
+            append_string(sb, String{ start, (i32)(at-start) });
+            prev = c;
+            prev_number = false;
+            regex_allowed = false;
+            statement = condition = arrow = false;
+            continue;
+        }
+
+        if (c == '`') {
+            append_char(sb, *at++);
+            copy_template();
+            continue;
+        }
+
+        if (c == '/' && regex_allowed) {
+            char *start = at++;
+            bool in_class = false;
+            while (at < end && *at != '\n') {
+                if (*at == '\\') at++;
+                else if (*at == '[') in_class = true;
+                else if (*at == ']') in_class = false;
+                else if (*at == '/' && !in_class) break;
+                at++;
+            }
+            at = MIN(at+1, end);
+
+            append_string(sb, String{ start, (i32)(at-start) });
+            prev = '/';
+            prev_number = false;
+            regex_allowed = false;
+            statement = condition = arrow = false;
+            continue;
+        }
+
+        if (is_js_name_char(c)) {
+            String word{ at, 0 };
+            while (at < end && is_js_name_char(*at)) at++;
+            word.length = (i32)(at-word.data);
+
+            append_string(sb, word);
+            prev = at[-1];
+            prev_number = is_number(word[0]);
+            regex_allowed = is_js_regex_keyword(word);
+            statement = word == "else" || word == "do";
+            condition = is_js_condition_keyword(word);
+            arrow = false;
+            continue;
+        }
+
+        bool closes_to_regex = false;
+        if (c == '(') {
+            if (paren_depth < JS_MAX_NESTING) paren_regex[paren_depth] = condition;
+            paren_depth++;
+        } else if (c == ')') {
+            closes_to_regex = paren_depth > 0 && paren_depth <= JS_MAX_NESTING && paren_regex[paren_depth-1];
+            paren_depth = MAX(paren_depth-1, 0);
+        } else if (c == '{') {
+            if (brace_depth < JS_MAX_NESTING) brace_regex[brace_depth] = statement || prev == ')' || arrow;
+            brace_depth++;
+            braces++;
+        } else if (c == '}') {
+            if (substitution_count > 0 && substitutions[substitution_count-1] == braces-1) {
+                substitution_count--;
+                braces--;
+                append_char(sb, *at++);
+                copy_template();
+                continue;
+            }
+            braces = MAX(braces-1, 0);
+
+            closes_to_regex = brace_depth > 0 && brace_depth <= JS_MAX_NESTING && brace_regex[brace_depth-1];
+            brace_depth = MAX(brace_depth-1, 0);
+        }
+
+        append_char(sb, *at++);
+        arrow = prev == '=' && c == '>';
+        prev = c;
+        prev_number = false;
+        condition = false;
+
+        if (c == ')' || c == '}') {
+            regex_allowed = statement = closes_to_regex;
+        } else if (c == '{') {
+            regex_allowed = true;
+            statement = brace_depth <= JS_MAX_NESTING && brace_regex[brace_depth-1];
+        } else {
+            regex_allowed = c != ']';
+            statement = c == ';';
+        }
+    }
+}
+
+// NOTE(jesper): a stylesheet link or a script element in a template that is replaced by
+// the template's bundle. The element spans from its < to the end of its > or </script>
+struct FsgBundleInput {
+    i32 part;
+    String element;
+    String url;
+};
+
+bool is_local_asset_url(String url)
+{
+    return url.length > 1 && url[0] == '/' && url[1] != '/' &&
+        find_char(url.data, url.data+url.length, '?') == url.data+url.length &&
+        find_char(url.data, url.data+url.length, '#') == url.data+url.length;
+}
+
+// NOTE(jesper): writes the bundle of inputs to the output, minified, and returns the url
+// it was written to. The minified bundles are cached by the hash of their inputs, so they
+// are only minified again when an input changed
+String write_bundle(
+    FsgSite *site,
+    String ext,
+    Array<String> inputs,
+    String contents,
+    DynamicArray<FsgStylesheet> *stylesheets)
+{
+    SArena scratch = tl_scratch_arena();
+
+    u64 names_hash = 0;
+    for (String url : inputs) names_hash = (names_hash ^ hash_bytes(url.data, url.length)) * 1099511628211ull;
+
+    u64 hash = hash_bytes(contents.data, contents.length);
+    String cache_path = join_path(
+        site->opts.cache_dir,
+        stringf(scratch, "bundles/v2-%016llx.%.*s", (unsigned long long)hash, STRFMT(ext)),
+        scratch);
+
+    String minified{};
+    FileInfo cached = read_file(cache_path, scratch);
+    if (cached.data) {
+        minified = String{ (char*)cached.data, cached.size };
+    } else {
+        StringBuilder sb{ .alloc = scratch };
+        if (ext == "css") minify_css(&sb, contents);
+        else minify_js(&sb, contents);
+
+        minified = create_string(&sb, scratch);
+        write_file(cache_path, minified.data, minified.length);
+    }
+
+    // NOTE(jesper): as in copy_files, the fonts and images a stylesheet references are
+    // fingerprinted first, so the bundle is hashed with their urls rewritten
+    String output = minified;
+    if (site->opts.fingerprint && ext == "css") {
+        StringBuilder sb{ .alloc = scratch };
+        append_rewritten_asset_urls(&sb, minified, site->assets);
+        output = create_string(&sb, scratch);
+    }
+
+    FsgAsset bundle{};
+    bundle.url = stringf(mem_dynamic, "/%.*s/bundle-%08x.%.*s", STRFMT(ext), (u32)(names_hash ^ (names_hash >> 32)), STRFMT(ext));
+    bundle.fingerprinted_url = site->opts.fingerprint
+        ? fingerprint_url(bundle.url, hash_bytes(output.data, output.length), mem_dynamic)
+        : bundle.url;
+
+    for (FsgAsset &existing : site->bundles) {
+        if (existing.fingerprinted_url == bundle.fingerprinted_url) return existing.fingerprinted_url;
+    }
+
+    write_file(join_path(site->output, bundle.fingerprinted_url, scratch), output.data, output.length);
+    array_add(&site->bundles, bundle);
+
+    // NOTE(jesper): critical css extraction runs after bundling, and finds the bundle's
+    // rules through the link that now refers to it
+    if (ext == "css") {
+        array_add(stylesheets, FsgStylesheet{
+            .url = bundle.fingerprinted_url,
+            .css = duplicate_string(minified, mem_dynamic),
+        });
+    }
+
+    return bundle.fingerprinted_url;
+}
+
+// NOTE(jesper): classic scripts only, modules can't be concatenated into one
+bool is_classic_script_type(String type)
+{
+    return type.length == 0 ||
+        eq_ignore_case(type, "text/javascript") ||
+        eq_ignore_case(type, "application/javascript") ||
+        eq_ignore_case(type, "text/ecmascript") ||
+        eq_ignore_case(type, "application/ecmascript");
+}
+
+// NOTE(jesper): concatenates the local stylesheets and scripts a template references into
+// a bundle each, and replaces the references with a single one to the bundle, at the
+// position of the first. Only plain stylesheet links and classic scripts that are all
+// either deferred or not are bundled, anything with other attributes is left as it is.
+// Moving them to the first must not change the order they apply or run in, so each
+// bundle stops at the first stylesheet or script that isn't bundled, and scripts that
+// aren't deferred are only bundled with the ones directly preceding them
+void bundle_template_assets(FsgSite *site, FsgTemplate *tmpl, DynamicArray<FsgStylesheet> *stylesheets)
+{
+    SArena scratch = tl_scratch_arena();
+
+    DynamicArray<FsgBundleInput> styles{};
+    DynamicArray<FsgBundleInput> scripts{};
+    bool defer_scripts = false;
+    bool styles_done = false, scripts_done = false;
+
+    StringBuilder css{ .alloc = scratch };
+    StringBuilder js{ .alloc = scratch };
+
+    for (i32 i = 0; i < tmpl->parts.count; i++) {
+        char *at = tmpl->parts[i].text.data;
+        char *end = tmpl->parts[i].text.data + tmpl->parts[i].text.length;
+
+        while (at < end) {
+            at = find_char(at, end, '<');
+            char *tag_end = find_char(at, end, '>');
+            if (tag_end == end) break;
+
+            String tag{ at, (i32)(tag_end+1-at) };
+            bool is_link = end-at >= 5 && eq_ignore_case(String{ at+1, 4 }, "link");
+            bool is_script = end-at >= 7 && eq_ignore_case(String{ at+1, 6 }, "script");
+            bool is_style = end-at >= 7 && eq_ignore_case(String{ at+1, 5 }, "style") &&
+                (at[6] == '>' || is_html_whitespace(at[6]));
+            at++;
+
+            if (is_style) {
+                styles_done = styles_done || styles.count > 0;
+                continue;
+            }
+
+            if (!is_link && !is_script) continue;
+
+            String rel{}, url{}, type{};
+            bool plain = true, deferred = false;
+            for (TagProperty property : parse_html_tag_properties(tag)) {
+                if (eq_ignore_case(property.key, "rel")) rel = property.value;
+                else if (eq_ignore_case(property.key, is_link ? "href" : "src")) url = property.value;
+                else if (is_script && eq_ignore_case(property.key, "defer")) deferred = true;
+                else if (eq_ignore_case(property.key, "type")) type = property.value;
+                else plain = false;
+            }
+
+            if (is_link) {
+                if (!eq_ignore_case(rel, "stylesheet")) continue;
+
+                FsgStylesheet *sheet = nullptr;
+                if (!styles_done && plain && is_local_asset_url(url) &&
+                    (type.length == 0 || eq_ignore_case(type, "text/css")))
+                {
+                    sheet = find_stylesheet(site, stylesheets, url);
+                }
+
+                if (!sheet) {
+                    styles_done = styles_done || styles.count > 0;
+                    continue;
+                }
+
+                append_string(&css, sheet->css);
+                append_char(&css, '\n');
+                array_add(&styles, FsgBundleInput{ i, tag, url });
+            } else {
+                char *close = tag_end+1;
+                while (close < end && is_html_whitespace(*close)) close++;
+
+                bool bundled = !scripts_done && plain && is_local_asset_url(url) && is_classic_script_type(type) &&
+                    end-close >= 9 && eq_ignore_case(String{ close, 9 }, "</script>");
+
+                if (bundled && scripts.count > 0) {
+                    FsgBundleInput &last = scripts[scripts.count-1];
+                    char *last_end = last.element.data + last.element.length;
+
+                    if (deferred != defer_scripts) {
+                        bundled = false;
+                    } else if (!deferred) {
+                        bundled = last.part == i;
+                        for (char *c = last_end; bundled && c < tag.data; c++) bundled = is_html_whitespace(*c);
+                    }
+                }
+
+                FileInfo contents{};
+                if (bundled) {
+                    String path = join_path(site->src_dir, String{ url.data+1, url.length-1 }, scratch);
+                    contents = read_file(path, scratch);
+                }
+
+                if (!contents.data) {
+                    scripts_done = scripts_done || scripts.count > 0;
+                    continue;
+                }
+
+                if (scripts.count == 0) defer_scripts = deferred;
+
+                // NOTE(jesper): scripts needn't end with a ; or a line break, and a
+                // following one could otherwise continue their last statement
+                append_string(&js, String{ (char*)contents.data, contents.size });
+                append_string(&js, "\n;\n");
+                array_add(&scripts, FsgBundleInput{ i, String{ tag.data, (i32)(close+9-tag.data) }, url });
+            }
+        }
+    }
+
+    if (styles.count == 0 && scripts.count == 0) return;
+
+    String css_url{}, js_url{};
+    DynamicArray<String> urls{};
+
+    if (styles.count > 0) {
+        for (FsgBundleInput &input : styles) array_add(&urls, input.url);
+        css_url = write_bundle(site, "css", urls, create_string(&css, scratch), stylesheets);
+    }
+
+    if (scripts.count > 0) {
+        urls.count = 0;
+        for (FsgBundleInput &input : scripts) array_add(&urls, input.url);
+        js_url = write_bundle(site, "js", urls, create_string(&js, scratch), stylesheets);
+    }
+
+    for (i32 i = 0; i < tmpl->parts.count; i++) {
+        FsgPart &part = tmpl->parts[i];
+
+        DynamicArray<FsgBundleInput*> inputs{};
+        for (FsgBundleInput &input : styles) if (input.part == i) array_add(&inputs, &input);
+        for (FsgBundleInput &input : scripts) if (input.part == i) array_add(&inputs, &input);
+        if (inputs.count == 0) continue;
+
+        StringBuilder sb{ .alloc = mem_dynamic };
+        char *at = part.text.data;
+        char *end = part.text.data + part.text.length;
+
+        while (true) {
+            FsgBundleInput *next = nullptr;
+            for (FsgBundleInput *input : inputs) {
+                if (input->element.data >= at && (!next || input->element.data < next->element.data)) next = input;
+            }
+
+            if (!next) break;
+
+            append_string(&sb, String{ at, (i32)(next->element.data-at) });
+            at = next->element.data + next->element.length;
+
+            if (styles.count > 0 && next == &styles[0]) {
+                append_stringf(&sb, "<link rel=\"stylesheet\" href=\"%.*s\">", STRFMT(css_url));
+            } else if (scripts.count > 0 && next == &scripts[0]) {
+                append_stringf(&sb, "<script src=\"%.*s\"%s></script>", STRFMT(js_url), defer_scripts ? " defer" : "");
+            }
+        }
+
+        append_string(&sb, String{ at, (i32)(end-at) });
+        part.text = create_string(&sb, mem_dynamic);
+    }
+}
+
+bool load_templates(FsgSite *site)
+{
+    SArena scratch = tl_scratch_arena();
+
+    // NOTE(jesper): the previous contents are intentionally leaked, pages that fail to
+    // reload keep rendering with the parts flattened from them
+    site->templates.count = 0;
+
+    DynamicArray<FsgSourceFile> template_files = list_source_files(join_path(site->src_dir, "_templates", scratch), false, nullptr, scratch);
+    site->templates_signature = source_signature(0, template_files);
+
+    for (FsgSourceFile file : template_files) {
+        String p = file.path;
+        FileInfo contents = read_file(p, mem_dynamic);
+        if (!contents.data) {
+            LOG_ERROR("failed reading %.*s", p.length, p.data);
+            return false;
+        }
+
+        FsgTemplate tmpl{};
+        if (parse_template(p, String{ (char*)contents.data, contents.size }, &tmpl)) {
+            array_add(&site->templates, tmpl);
+        }
+    }
+
+    for (FsgTemplate &tmpl : site->templates) flatten_template(site->templates, &tmpl);
+
+    DynamicArray<FsgAsset> previous_bundles{};
+    for (FsgAsset bundle : site->bundles) array_add(&previous_bundles, bundle);
+    site->bundles.count = 0;
+
+    DynamicArray<FsgStylesheet> stylesheets{};
+    if (site->opts.bundle) {
+        for (FsgTemplate &tmpl : site->templates) bundle_template_assets(site, &tmpl, &stylesheets);
+    }
+
+    if (site->opts.critical_css) {
+        for (FsgTemplate &tmpl : site->templates) inline_critical_css(site, &tmpl, &stylesheets);
+    }
+
+    for (FsgAsset previous : previous_bundles) {
+        bool kept = false;
+        for (FsgAsset bundle : site->bundles) kept = kept || bundle.fingerprinted_url == previous.fingerprinted_url;
+        if (!kept) remove_output(site, join_path(site->output, previous.fingerprinted_url, scratch));
+    }
+
+    if (site->opts.jit_templates) compile_templates(site->templates);
+    return true;
+}
+
+bool load_page(FsgSite *site, FsgSourceFile file, FsgPage *out)
+{
+    String p = file.path;
+
+    FsgPage page{};
+    page.src_path = duplicate_string(p, mem_dynamic);
+    page.name = String{ page.src_path.data+site->src_dir.length+1, page.src_path.length-site->src_dir.length-1 };
+    page.path = join_path(site->output, page.name, mem_dynamic);
+    page.stat = file.stat;
+
+    FileInfo contents = read_file(p, mem_dynamic);
+    if (!contents.data) {
+        LOG_ERROR("failed reading: %.*s", p.length, p.data);
+        destroy_page(&page);
+        return false;
+    }
+
+    page.contents = String{ (char*)contents.data, contents.size };
+
+
+    DynamicArray<FsgPart> parts{};
+    FsgPart tail{};
+
+    i32 last_section_end = 0;
+
+    Lexer lexer{ (char*)contents.data, (char*)contents.data+contents.size, p };
+    Token t = next_token(&lexer);
+    while (t.type != TOKEN_EOF) {
+        if (t.type == TOKEN_COMMENT) {
+            char *comment_start = t.str.data-4;
+            char *comment_end = t.str.data+t.str.length+3;
+
+            Lexer fsg_lexer{
+                t.str.data,
+                t.str.data+t.str.length,
+                p,
+                (LexerFlags)(LEXER_FLAG_EAT_WHITESPACE | LEXER_FLAG_EAT_NEWLINE)
+            };
+
+            Token t2 = next_token(&fsg_lexer);
+            if (is_identifier(t2, "fsg")) {
+                FsgPart part{};
+
+                if (!require_next_token(&fsg_lexer, ':', &t2)) goto parse_error;
+
+                t2 = next_token(&fsg_lexer);
+                while (t2.type != TOKEN_EOF) {
+                    if (is_identifier(t2, "template")) {
+                        if (page.tmpl_index == -1) {
+                            if (!require_next_token(&fsg_lexer, TOKEN_IDENTIFIER, &t2)) goto parse_error;
+                            page.tmpl_index = find_template_index(site->templates, intern(t2.str));
+
+                            if (!require_next_token(&fsg_lexer, '.', &t2)) goto parse_error;
+                            if (!require_next_token(&fsg_lexer, TOKEN_IDENTIFIER, &t2)) goto parse_error;
+                            page.dst_section_name = t2.str;
+
+                            if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+                        } else {
+                            PARSE_ERROR(&fsg_lexer, "duplicate template properties");
+                            goto parse_error;
+                        }
+                    } else if (is_identifier(t2, "section")) {
+                        if (!parse_string(&fsg_lexer, &part.variable, &t2)) goto parse_error;
+                        if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+                        part.type = FSG_PART_VARIABLE;
+                        part.symbol = intern(part.variable);
+                    } else if (is_identifier(t2, "title")) {
+                        if (!parse_string(&fsg_lexer, &page.title, &t2)) goto parse_error;
+                        if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+                    } else if (is_identifier(t2, "subtitle")) {
+                        if (!parse_string(&fsg_lexer, &page.subtitle, &t2)) goto parse_error;
+                        if (!require_next_token(&fsg_lexer, ';', &t2)) goto parse_error;
+                    } else {
+                        PARSE_ERRORF(
+                            &fsg_lexer,
+                            "unexpected identifier. expected one of 'template', 'section' - got '%.*s'",
+                            STRFMT(t2.str));
+                        goto parse_error;
+                    }
+
+                    t2 = next_token(&fsg_lexer);
+                }
+
+                part.text = String{
+                    (char*)contents.data+last_section_end,
+                    (i32)(comment_start-(char*)contents.data-last_section_end)
+                };
+                last_section_end = (i32)(comment_end-(char*)contents.data);
+                array_add(&parts, part);
+            }
+        }
+
+        t = next_token(&lexer);
+    }
+
+    tail = FsgPart{
+        .type = FSG_PART_CHUNK,
+        .text = String{
+            (char*)contents.data+last_section_end,
+            (i32)(lexer.end - ((char*)contents.data + last_section_end))
+        },
+    };
+    if (tail.text.length > 0) array_add(&parts, tail);
+
+    page.parts = parts;
+    if (page.tmpl_index != -1) {
+        page.parts = flatten_page(&site->templates[page.tmpl_index], page.dst_section_name, parts);
+        destroy_array(&parts);
+    }
+
+    page.dirty = true;
+
+    *out = page;
+    return true;
+
+parse_error:
+    destroy_array(&parts);
+    destroy_page(&page);
+    return false;
+}
+
+bool page_lists_posts(FsgPage &page)
+{
+    for (FsgPart s : page.parts) {
+        if (s.type == FSG_PART_VARIABLE &&
+            (s.symbol == SYM_POSTS_BRIEF || s.symbol == SYM_POSTS_FULL))
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void load_pages(FsgSite *site)
+{
+    SArena scratch = tl_scratch_arena();
+
+    for (FsgPage &page : site->pages) destroy_page(&page);
+    site->pages.count = 0;
+
+    DynamicArray<FsgSourceFile> page_files = list_page_files(site, scratch);
+
+    for (FsgSourceFile file : page_files) {
+        FsgPage page{};
+        if (load_page(site, file, &page)) array_add(&site->pages, page);
+    }
+}
+
+// NOTE(jesper): loads the metadata of the given post files in parallel. Results are
+// returned in the order of the files, with loaded[i] false for the posts that failed
+void load_posts(FsgSite *site, Array<FsgSourceFile> files, FsgPost *posts, bool *loaded)
+{
+    parallel_for(files.count, [&](i32 i) {
+        posts[i] = {};
+        loaded[i] = load_post(site, files[i], &posts[i]);
+    });
+
+    for (i32 i = 0; i < files.count; i++) {
+        if (loaded[i]) posts[i].id = site->next_post_id++;
+    }
+}
+
+void load_posts(FsgSite *site)
+{
+    SArena scratch = tl_scratch_arena();
+
+    for (FsgPost &post : site->posts) destroy_post(&post);
+    site->posts.count = 0;
+    site->next_post_id = 0;
+
+    DynamicArray<FsgSourceFile> post_files = list_source_files(site->posts_src_path, true, nullptr, scratch);
+
+    FsgPost *posts = (FsgPost*)calloc(MAX(post_files.count, 1), sizeof *posts);
+    bool *loaded = (bool*)calloc(MAX(post_files.count, 1), sizeof *loaded);
+    defer { free(posts); free(loaded); };
+
+    load_posts(site, post_files, posts, loaded);
+
+    for (i32 i = 0; i < post_files.count; i++) {
+        if (loaded[i]) array_add(&site->posts, posts[i]);
+    }
+
+    load_post_bodies(site);
+}
+
+// NOTE(jesper): sorts the posts and rebuilds the tags from them, so that the posts of a
+// tag are listed in the same order as the site's
+void build_tags(FsgSite *site)
+{
+    site->post_order.count = 0;
+    for (i32 i = 0; i < site->posts.count; i++) array_add(&site->post_order, i);
+    sort_posts(site->post_order, site->posts);
+
+    for (FsgTag &tag : site->tags) tag.posts.count = 0;
+
+    for (i32 index : site->post_order) {
+        FsgPost &post = site->posts[index];
+
+        for (FsgSymbol symbol : post.tags) {
+            for (FsgTag &t : site->tags) {
+                if (t.symbol == symbol) {
+                    array_add(&t.posts, index);
+                    LOG_INFO("adding post '%.*s' to existing tag: '%.*s'", STRFMT(post.title), STRFMT(t.str));
+                    goto next_tag;
+                }
+            }
+
+            {
+                FsgTag t{};
+                t.symbol = symbol;
+                t.str = symbol_str(symbol);
+                t.link = stringf(mem_dynamic, "<a href=\"/posts/tag/%.*s.html\">%.*s</a>", STRFMT(t.str), STRFMT(t.str));
+                array_add(&t.posts, index);
+                array_add(&site->tags, t);
+                LOG_INFO("adding post '%.*s' to new tag: '%.*s'", STRFMT(post.title), STRFMT(t.str));
+            }
+
+next_tag:;
+        }
+    }
+
+    i32 kept = 0;
+    for (i32 i = 0; i < site->tags.count; i++) {
+        FsgTag tag = site->tags[i];
+        if (tag.posts.count > 0) {
+            site->tags[kept++] = tag;
+            continue;
+        }
+
+        LOG_INFO("removing empty tag: '%.*s'", STRFMT(tag.str));
+        remove_output(site, tag_page_path(site, tag));
+        destroy_string(tag.link);
+    }
+    site->tags.count = kept;
+}
+
+bool load_site(FsgSite *site)
+{
+    FsgOptions &opts = site->opts;
+
+    // NOTE(jesper): stat before copying, so that an asset modified mid-copy is picked up
+    // again by the next daemon request
+    site->assets_signature = asset_signature(site->src_dir);
+
+    remove_files(site->output);
+
+    for (FsgPageReport &report : site->page_reports) destroy_page_report(&report);
+    site->page_reports.count = 0;
+    site->page_reports_complete = false;
+
+    site->assets.count = 0;
+    copy_files(site->src_dir, "img", site->output, opts.fingerprint, &site->assets);
+    copy_files(site->src_dir, "fonts", site->output, opts.fingerprint, &site->assets);
+    copy_files(site->src_dir, "assets", site->output, opts.fingerprint, &site->assets);
+
+    site->images = process_images(site->src_dir, site->output, opts, &site->assets);
+    site->image_probes = probe_images(site->src_dir, site->image_probes);
+
+    copy_files(site->src_dir, "css", site->output, opts.fingerprint, &site->assets);
+    copy_files(site->src_dir, "js", site->output, opts.fingerprint, &site->assets);
+
+    if (!load_templates(site)) return false;
+    if (opts.fingerprint) write_asset_manifest(site->output, site->assets, site->bundles);
+    load_pages(site);
+
+    for (FsgTag &tag : site->tags) tag.posts.count = 0;
+    site->tags.count = 0;
+
+    load_posts(site);
+    build_tags(site);
+
+    for (FsgTag &tag : site->tags) tag.dirty = true;
+    site->search_dirty = true;
+    return true;
+}
+
+// NOTE(jesper): revalidates the resident site against the source directory, reloading
+// the pages and posts whose stat changed and marking everything that has to be
+// re-rendered as a consequence dirty
+bool update_site(FsgSite *site)
+{
+    SArena scratch = tl_scratch_arena();
+
+    if (asset_signature(site->src_dir) != site->assets_signature) {
+        LOG_INFO("assets changed, rebuilding site");
+        return load_site(site);
+    }
+
+    DynamicArray<FsgSourceFile> template_files = list_source_files(join_path(site->src_dir, "_templates", scratch), false, nullptr, scratch);
+
+    bool templates_changed = source_signature(0, template_files) != site->templates_signature;
+    if (templates_changed) {
+        LOG_INFO("templates changed, re-rendering all pages");
+        if (!load_templates(site)) return false;
+        if (site->opts.fingerprint) write_asset_manifest(site->output, site->assets, site->bundles);
+
+        for (FsgPost &post : site->posts) post.dirty = true;
+        for (FsgTag &tag : site->tags) tag.dirty = true;
+    }
+
+    DynamicArray<FsgSourceFile> page_files = list_page_files(site, scratch);
+
+    i32 kept = 0;
+    for (i32 i = 0; i < site->pages.count; i++) {
+        FsgPage page = site->pages[i];
+        if (find_source_file(page_files, page.src_path)) {
+            site->pages[kept++] = page;
+            continue;
+        }
+
+        LOG_INFO("removing page '%.*s'", STRFMT(page.name));
+        remove_output(site, page.path);
+        destroy_page(&page);
+    }
+    site->pages.count = kept;
+
+    // NOTE(jesper): the index of the page loaded from each file, -1 for new files. Every
+    // page left has its file, the ones that don't were removed above
+    i32 *existing_pages = (i32*)calloc(MAX(page_files.count, 1), sizeof *existing_pages);
+    defer { free(existing_pages); };
+
+    for (i32 i = 0; i < page_files.count; i++) existing_pages[i] = -1;
+    for (i32 i = 0; i < site->pages.count; i++) {
+        existing_pages[find_source_file(page_files, site->pages[i].src_path) - page_files.data] = i;
+    }
+
+    for (i32 i = 0; i < page_files.count; i++) {
+        FsgPage *existing = existing_pages[i] != -1 ? &site->pages[existing_pages[i]] : nullptr;
+        if (!templates_changed && existing && page_files[i].stat == existing->stat) continue;
+
+        FsgPage page{};
+        if (!load_page(site, page_files[i], &page)) continue;
+
+        if (existing) {
+            destroy_page(existing);
+            *existing = page;
+        } else {
+            array_add(&site->pages, page);
+        }
+    }
+
+    bool posts_changed = false;
+
+    DynamicArray<FsgSourceFile> post_files = list_source_files(site->posts_src_path, true, nullptr, scratch);
+
+    kept = 0;
+    for (i32 i = 0; i < site->posts.count; i++) {
+        FsgPost post = site->posts[i];
+        if (find_source_file(post_files, post.src_path)) {
+            site->posts[kept++] = post;
+            continue;
+        }
+
+        LOG_INFO("removing post '%.*s'", STRFMT(post.title));
+        for (FsgTag &tag : site->tags) {
+            for (FsgSymbol t : post.tags) {
+                if (tag.symbol == t) tag.dirty = true;
+            }
+        }
+
+        remove_output(site, post.path);
+        destroy_post(&post);
+        posts_changed = true;
+    }
+    site->posts.count = kept;
+
+    i32 *existing_posts = (i32*)calloc(MAX(post_files.count, 1), sizeof *existing_posts);
+    defer { free(existing_posts); };
+
+    for (i32 i = 0; i < post_files.count; i++) existing_posts[i] = -1;
+    for (i32 i = 0; i < site->posts.count; i++) {
+        existing_posts[find_source_file(post_files, site->posts[i].src_path) - post_files.data] = i;
+    }
+
+    DynamicArray<FsgSourceFile> changed{};
+    DynamicArray<i32> changed_existing{};
+    defer { destroy_array(&changed); destroy_array(&changed_existing); };
+    for (i32 i = 0; i < post_files.count; i++) {
+        i32 existing = existing_posts[i];
+        if (existing != -1 && post_files[i].stat == site->posts[existing].stat) continue;
+
+        array_add(&changed, post_files[i]);
+        array_add(&changed_existing, existing);
+    }
+
+    FsgPost *posts = (FsgPost*)calloc(MAX(changed.count, 1), sizeof *posts);
+    bool *loaded = (bool*)calloc(MAX(changed.count, 1), sizeof *loaded);
+    defer { free(posts); free(loaded); };
+
+    load_posts(site, changed, posts, loaded);
+
+    for (i32 i = 0; i < changed.count; i++) {
+        if (!loaded[i]) continue;
+
+        FsgPost post = posts[i];
+        FsgPost *existing = changed_existing[i] != -1 ? &site->posts[changed_existing[i]] : nullptr;
+
+        if (existing) {
+            // NOTE(jesper): tags the post was removed from need their page re-rendered too
+            for (FsgTag &tag : site->tags) {
+                for (FsgSymbol t : existing->tags) {
+                    if (tag.symbol == t) tag.dirty = true;
+                }
+            }
+
+            if (post.draft && !existing->draft) remove_output(site, existing->path);
+
+            destroy_post(existing);
+            *existing = post;
+        } else {
+            array_add(&site->posts, post);
+        }
+
+        posts_changed = true;
+    }
+
+    if (posts_changed) {
+        // NOTE(jesper): the fragment cache is sized by the largest post id, so they're
+        // handed out densely again rather than growing with every reload
+        for (i32 i = 0; i < site->posts.count; i++) site->posts[i].id = i;
+        site->next_post_id = site->posts.count;
+
+        load_post_bodies(site);
+        build_tags(site);
+
+        for (FsgTag &tag : site->tags) {
+            for (i32 index : tag.posts) {
+                if (site->posts[index].dirty) tag.dirty = true;
+            }
+        }
+
+        for (FsgPage &page : site->pages) {
+            if (page_lists_posts(page)) page.dirty = true;
+        }
+
+        site->search_dirty = true;
+    }
+
+    return true;
+}
+
+FsgPageReport* add_page_report(FsgSite *site, DynamicArray<FsgPageReport> *reports, String path)
+{
+    if (!site->opts.report) return nullptr;
+
+    FsgPageReport report{};
+    report.url = asset_url(site->output, path, mem_dynamic);
+    array_add(reports, report);
+    return &reports->data[reports->count-1];
+}
+
+int compare_page_reports(const void *lhs, const void *rhs)
+{
+    FsgPageReport *a = (FsgPageReport*)lhs;
+    FsgPageReport *b = (FsgPageReport*)rhs;
+    return a->url < b->url ? -1 : b->url < a->url ? 1 : 0;
+}
+
+// NOTE(jesper): replaces the site's reports of the pages rendered in this generation,
+// and takes ownership of them
+void merge_page_reports(FsgSite *site, DynamicArray<FsgPageReport> *reports)
+{
+    qsort(reports->data, reports->count, sizeof *reports->data, compare_page_reports);
+
+    DynamicArray<FsgPageReport> merged{};
+    i32 i = 0, j = 0;
+    while (i < site->page_reports.count || j < reports->count) {
+        if (j == reports->count || (i < site->page_reports.count && site->page_reports[i].url < (*reports)[j].url)) {
+            array_add(&merged, site->page_reports[i++]);
+            continue;
+        }
+
+        if (i < site->page_reports.count && site->page_reports[i].url == (*reports)[j].url) {
+            destroy_page_report(&site->page_reports[i++]);
+        }
+        array_add(&merged, (*reports)[j++]);
+    }
+
+    destroy_array(&site->page_reports);
+    destroy_array(reports);
+    site->page_reports = merged;
+}
+
+struct FsgOutputSize {
+    String url;
+    i64 size;
+};
+
+// NOTE(jesper): sums up the weight of the assets each page references, flags the pages
+// over budget and writes the report, to opts.report_path or json when it's empty. Every
+// asset is only stat'ed once, however many pages reference it. Returns the number of
+// pages over budget
+i32 write_page_report(FsgSite *site, Array<FsgPageReport> reports, String *json)
+{
+    SArena scratch = tl_scratch_arena();
+    FsgOptions &opts = site->opts;
+
+    // NOTE(jesper): sorted by url
+    DynamicArray<FsgOutputSize> sizes{};
+
+    i32 over_budget = 0;
+    for (FsgPageReport &report : reports) {
+        report.asset_bytes = 0;
+        for (String url : report.references) {
+            i32 lo = 0, hi = sizes.count;
+            while (lo < hi) {
+                i32 mid = lo + (hi-lo)/2;
+                if (sizes[mid].url < url) lo = mid+1;
+                else hi = mid;
+            }
+
+            if (lo == sizes.count || sizes[lo].url != url) {
+                FsgOutputSize size{ .url = url };
+
+                FsgSourceStat st{};
+                if (stat_source(join_path(site->output, url, scratch), &st)) size.size = st.size;
+
+                array_add(&sizes, size);
+                for (i32 i = sizes.count-1; i > lo; i--) sizes[i] = sizes[i-1];
+                sizes[lo] = size;
+            }
+
+            report.asset_bytes += sizes[lo].size;
+        }
+
+        report.over_budget =
+            (opts.max_html_bytes > 0 && report.html_bytes > opts.max_html_bytes) ||
+            (opts.max_page_bytes > 0 && report.html_bytes + report.asset_bytes > opts.max_page_bytes);
+
+        if (report.over_budget) {
+            over_budget++;
+            LOG_ERROR("page '%.*s' is over budget: %lld bytes of html, %lld bytes with assets",
+                      STRFMT(report.url),
+                      (long long)report.html_bytes,
+                      (long long)(report.html_bytes + report.asset_bytes));
+        }
+    }
+
+    StringBuilder sb{ .alloc = scratch };
+    append_stringf(
+        &sb,
+        "{\n  \"max_html_bytes\": %lld,\n  \"max_page_bytes\": %lld,\n  \"over_budget\": %d,\n  \"pages\": [\n",
+        (long long)opts.max_html_bytes, (long long)opts.max_page_bytes, over_budget);
+
+    for (i32 i = 0; i < reports.count; i++) {
+        FsgPageReport &report = reports[i];
+
+        append_string(&sb, "    { \"url\": ");
+        append_json_string(&sb, report.url);
+        append_stringf(
+            &sb,
+            ", \"html_bytes\": %lld, \"asset_bytes\": %lld, \"assets\": %d, \"posts\": %d, \"render_ms\": %.3f, \"over_budget\": %s }%s\n",
+            (long long)report.html_bytes,
+            (long long)report.asset_bytes,
+            report.references.count,
+            report.post_count,
+            report.render_ms,
+            report.over_budget ? "true" : "false",
+            i < reports.count-1 ? "," : "");
+    }
+
+    append_string(&sb, "  ]\n}\n");
+
+    if (opts.report_path.length == 0) {
+        *json = create_string(&sb, mem_dynamic);
+    } else if (!write_file(opts.report_path, &sb)) {
+        LOG_ERROR("failed writing page report to '%.*s'", STRFMT(opts.report_path));
+    }
+
+    LOG_INFO("page report: %d pages, %d over budget", reports.count, over_budget);
+    return over_budget;
+}
+
+// NOTE(jesper): appends a post rendered without going through the fragment cache, for
+// fragments that are only rendered once or are too large to keep around
+void append_post_uncached(StringBuilder *sb, FsgTemplate *tmpl, FsgPost &post, String tags_html)
+{
+    if (tmpl->render) {
+        SArena scratch = tl_scratch_arena(sb->alloc);
+        append_string(sb, render_compiled_post(tmpl, post, tags_html, scratch));
+    } else {
+        append_post(sb, tmpl, post, tags_html);
+    }
+}
+
+void drop_post_content(FsgPost *post)
+{
+    if (post->terms_uncached) return;
+    if (post->content.data && post->content.data != post->brief.data) destroy_string(post->content);
+    post->content = {};
+    post->content_dropped = true;
+}
+
+// NOTE(jesper): converts the body of a post whose content was dropped again, for as long
+// as it takes to render it. The brief is converted along with it, so the post's own is
+// released first
+bool reload_post_content(FsgSite *site, FsgPost *post)
+{
+    if (post->brief.data) destroy_string(post->brief);
+    post->brief = {};
+    return load_post_body(site, post);
+}
+
+// NOTE(jesper): appends a post with a template that needs its content. In low memory mode
+// the content is converted again for it and dropped straight after, rather than kept
+// around in the fragment cache
+void append_full_post(StringBuilder *sb, FsgSite *site, FsgFragmentCache *cache, FsgTemplate *tmpl, FsgPost &post)
+{
+    if (site->opts.memory_budget_mb == 0) {
+        append_post(sb, cache, tmpl, post);
+        return;
+    }
+
+    if (post.content_dropped && !reload_post_content(site, &post)) return;
+
+    append_post_uncached(sb, tmpl, post, cache->tags_html[post.id]);
+    drop_post_content(&post);
+}
+
+// NOTE(jesper): the posts of low memory mode, converted and written in batches that are
+// estimated to fit in the memory budget. Each post's page is written as soon as its body
+// is converted, after which the content is dropped and only the metadata and brief are
+// kept for the listings rendered after. Returns the number of post pages written
+i32 stream_posts(
+    FsgSite *site,
+    FsgFragmentCache *fragments,
+    FsgTemplate *post_tmpl,
+    DynamicArray<FsgPageReport> *reports)
+{
+    FsgOptions &opts = site->opts;
+
+    DynamicArray<FsgPost*> pending{};
+    for (FsgPost &post : site->posts) {
+        if (!opts.build_drafts && post.draft) continue;
+        if (post.has_body && !(post_tmpl && post.dirty)) continue;
+        array_add(&pending, &post);
+    }
+
+    // NOTE(jesper): the converted content, the rendered page and the copies write_html
+    // makes of it are each roughly the size of the source, and the source itself is
+    // streamed through the lexer
+    auto estimate = [](FsgPost *post) { return MAX(post->stat.size, (i64)4096) * 4; };
+
+    i64 budget = (i64)opts.memory_budget_mb*1024*1024;
+    std::atomic<i32> written = 0;
+
+    for (i32 start = 0; start < pending.count;) {
+        i32 end = start+1;
+        i64 batch_size = estimate(pending[start]);
+        while (end < pending.count && batch_size + estimate(pending[end]) <= budget) {
+            batch_size += estimate(pending[end++]);
+        }
+
+        i32 first_report = reports->count;
+        if (opts.report) {
+            for (i32 i = start; i < end; i++) array_add(reports, FsgPageReport{});
+        }
+
+        parallel_for(end-start, [&](i32 i) {
+            FsgPost *post = pending[start+i];
+
+            if (!post->has_body || post->content_dropped) {
+                if (!reload_post_content(site, post)) return;
+            }
+
+            if (opts.search) {
+                SArena scratch = tl_scratch_arena();
+                DynamicArray<String> terms{};
+                load_search_terms(post, &terms, opts, scratch);
+            }
+
+            if (post_tmpl && post->dirty) {
+                auto render_start = std::chrono::steady_clock::now();
+
+                SArena scratch = tl_scratch_arena();
+                StringBuilder sb{ .alloc = scratch };
+                append_post_uncached(&sb, post_tmpl, *post, fragments->tags_html[post->id]);
+
+                FsgPageReport *report = opts.report ? &(*reports)[first_report+i] : nullptr;
+                write_html(post->path, &sb, opts, site->assets, report);
+                written++;
+
+                if (report) {
+                    report->url = asset_url(site->output, post->path, mem_dynamic);
+                    report->post_count = 1;
+                    report->render_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-render_start).count();
+                }
+            }
+
+            drop_post_content(post);
+        });
+
+        start = end;
+    }
+
+    // NOTE(jesper): posts that only needed their brief converted didn't write a page
+    i32 kept = 0;
+    for (FsgPageReport report : *reports) {
+        if (report.url.length > 0) reports->data[kept++] = report;
+    }
+    reports->count = kept;
+
+    return written;
+}
+
+FsgRenderStats render_site(FsgSite *site)
+{
+    FsgOptions &opts = site->opts;
+    FsgRenderStats stats{};
+
+    FsgFragmentCache fragments = create_fragment_cache(site->templates, site->posts, site->tags);
+    defer { destroy_fragment_cache(&fragments); };
+
+    DynamicArray<FsgPageReport> reports{};
+
+    // NOTE(jesper): reports are only collected for the pages that are rendered, so when
+    // the last generation didn't collect them every page is rendered again to have one
+    if (opts.report && !site->page_reports_complete) {
+        for (FsgTag &tag : site->tags) tag.dirty = true;
+        for (FsgPage &page : site->pages) page.dirty = true;
+        for (FsgPost &post : site->posts) post.dirty = true;
+    }
+    site->page_reports_complete = opts.report;
+
+    // NOTE(jesper): in low memory mode the posts are written first, since that's when their
+    // briefs for the listings are converted
+    FsgTemplate *post_page_tmpl = find_template(site->templates, "post");
+    if (opts.memory_budget_mb > 0) stats.posts = stream_posts(site, &fragments, post_page_tmpl, &reports);
+
+    if (opts.search && site->search_dirty) generate_search_index(site->output, site->posts, site->post_order, opts);
+    site->search_dirty = false;
+
+    FsgTemplate *brief_tmpl = find_template(site->templates, "post_brief_inline");
+    FsgTemplate *brief_block_tmpl = find_template(site->templates, "post_brief_block");
+    FsgTemplate *full_tmpl = find_template(site->templates, "post_full_block");
+
+    FsgTemplate *tag_tmpl = find_template(site->templates, "posts_tag");
+
+    if (tag_tmpl) {
+        for (FsgTag &tag : site->tags) {
+            if (!tag.dirty) continue;
+
+            auto start = std::chrono::steady_clock::now();
+            i32 post_count = 0;
+
+            SArena scratch = tl_scratch_arena();
+            StringBuilder sb{ .alloc = scratch };
+
+            for (FsgPart s : tag_tmpl->parts) {
+                switch (s.type) {
+                case FSG_PART_VARIABLE:
+                    append_string(&sb, s.text);
+
+                    if (s.symbol == SYM_POSTS_BRIEF || s.symbol == SYM_POSTS_FULL) {
+                        FsgTemplate *post_tmpl = s.symbol == SYM_POSTS_BRIEF ? brief_block_tmpl : full_tmpl;
+
+                        for (i32 index : tag.posts) {
+                            FsgPost &post = site->posts[index];
+                            if (!opts.build_drafts && post.draft) continue;
+
+                            if (s.symbol == SYM_POSTS_FULL) append_full_post(&sb, site, &fragments, post_tmpl, post);
+                            else append_post(&sb, &fragments, post_tmpl, post);
+                            post_count++;
+                        }
+                    } else if (s.symbol == SYM_TAG_STR) {
+                        append_string(&sb, tag.str);
+                    } else if (s.symbol != SYM_NONE) {
+                        LOG_ERROR("unhandled section '%.*s' in template '%.*s'", STRFMT(s.variable), STRFMT(tag_tmpl->name));
+                    }
+                    break;
+
+                case FSG_PART_CHUNK:
+                case FSG_PART_INCLUDE:
+                    append_string(&sb, s.text);
+                    break;
+                }
+            }
+
+            String path = tag_page_path(site, tag);
+            //defer{ destroy_string(path); };
+
+            FsgPageReport *report = add_page_report(site, &reports, path);
+            write_html(path, &sb, opts, site->assets, report);
+            stats.tags++;
+
+            if (report) {
+                report->post_count = post_count;
+                report->render_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-start).count();
+            }
+        }
+    }
+
+
+    for (FsgPage &page : site->pages) {
+        if (!page.dirty) continue;
+
+        auto start = std::chrono::steady_clock::now();
+        i32 post_count = 0;
+
+        SArena scratch = tl_scratch_arena();
+        StringBuilder sb{ .alloc = scratch };
+
+        for (FsgPart s : page.parts) {
+            append_string(&sb, s.text);
+            if (s.type != FSG_PART_VARIABLE) continue;
+
+            if (s.symbol == SYM_POSTS_BRIEF || s.symbol == SYM_POSTS_FULL) {
+                FsgTemplate *post_tmpl = s.symbol == SYM_POSTS_BRIEF ? brief_tmpl : full_tmpl;
+
+                for (i32 index : site->post_order) {
+                    FsgPost &post = site->posts[index];
+                    if (!opts.build_drafts && post.draft) continue;
+
+                    if (s.symbol == SYM_POSTS_FULL) append_full_post(&sb, site, &fragments, post_tmpl, post);
+                    else append_post(&sb, &fragments, post_tmpl, post);
+                    post_count++;
+                }
+            } else if (s.symbol == SYM_PAGE_TITLE) {
+                append_string(&sb, page.title);
+            } else if (s.symbol == SYM_PAGE_SUBTITLE) {
+                append_string(&sb, page.subtitle);
+            } else if (s.symbol != SYM_NONE) {
+                LOG_ERROR("unhandled section '%.*s' in page '%.*s'", STRFMT(s.variable), STRFMT(page.name));
+            }
+        }
+
+        FsgPageReport *report = add_page_report(site, &reports, page.path);
+        write_html(page.path, &sb, opts, site->assets, report);
+        stats.pages++;
+
+        if (report) {
+            report->post_count = post_count;
+            report->render_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-start).count();
+        }
+    }
+
+    if (post_page_tmpl && opts.memory_budget_mb == 0) {
+    	for (FsgPost &post : site->posts) {
+            if (!post.dirty) continue;
+            if (!opts.build_drafts && post.draft) continue;
+
+            auto start = std::chrono::steady_clock::now();
+
+            SArena scratch = tl_scratch_arena();
+            StringBuilder sb{ .alloc = scratch };
+            append_post(&sb, &fragments, post_page_tmpl, post);
+
+            FsgPageReport *report = add_page_report(site, &reports, post.path);
+            write_html(post.path, &sb, opts, site->assets, report);
+            stats.posts++;
+
+            if (report) {
+                report->post_count = 1;
+                report->render_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-start).count();
+            }
+        }
+    }
+
+    for (FsgTag &tag : site->tags) tag.dirty = false;
+    for (FsgPage &page : site->pages) page.dirty = false;
+    for (FsgPost &post : site->posts) post.dirty = false;
+
+    if (opts.report) {
+        merge_page_reports(site, &reports);
+        stats.over_budget = write_page_report(site, site->page_reports, &stats.report);
+    }
+
+    if (opts.pack_path.length > 0) write_pack(site->output, opts.pack_path);
+    return stats;
+}
+
+// NOTE(jesper): renders every post with every compiled template through both the
+// interpreter and the compiled code, checking that they agree before timing them
+void bench_templates(FsgSite *site, i32 iterations)
+{
+    FsgFragmentCache cache = create_fragment_cache(site->templates, site->posts, site->tags);
+    defer { destroy_fragment_cache(&cache); };
+
+    DynamicArray<FsgPost*> posts{};
+    for (FsgPost &post : site->posts) {
+        if (post.has_body) array_add(&posts, &post);
+    }
+
+    i32 fragments = 0;
+    i64 bytes = 0;
+
+    for (FsgTemplate &tmpl : site->templates) {
+        if (!tmpl.render) continue;
+
+        for (FsgPost *post : posts) {
+            SArena scratch = tl_scratch_arena();
+            StringBuilder sb{ .alloc = scratch };
+            append_post(&sb, &tmpl, *post, cache.tags_html[post->id]);
+
+            String interpreted = create_string(&sb, scratch);
+            String compiled = render_compiled_post(&tmpl, *post, cache.tags_html[post->id], scratch);
+
+            if (interpreted != compiled) {
+                LOG_ERROR("compiled template '%.*s' differs from the interpreter for '%.*s'",
+                          STRFMT(tmpl.name), STRFMT(post->src_path));
+                return;
+            }
+
+            fragments++;
+            bytes += compiled.length;
+        }
+    }
+
+    if (fragments == 0) {
+        LOG_ERROR("no compiled templates to benchmark");
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (i32 i = 0; i < iterations; i++) {
+        for (FsgTemplate &tmpl : site->templates) {
+            if (!tmpl.render) continue;
+
+            for (FsgPost *post : posts) {
+                SArena scratch = tl_scratch_arena();
+                StringBuilder sb{ .alloc = scratch };
+                append_post(&sb, &tmpl, *post, cache.tags_html[post->id]);
+                create_string(&sb, scratch);
+            }
+        }
+    }
+    f64 interpreted_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-start).count();
+
+    start = std::chrono::steady_clock::now();
+    for (i32 i = 0; i < iterations; i++) {
+        for (FsgTemplate &tmpl : site->templates) {
+            if (!tmpl.render) continue;
+
+            for (FsgPost *post : posts) {
+                SArena scratch = tl_scratch_arena();
+                render_compiled_post(&tmpl, *post, cache.tags_html[post->id], scratch);
+            }
+        }
+    }
+    f64 compiled_ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-start).count();
+
+    LOG_INFO("template bench: %d fragments (%.2f MB) x %d iterations", fragments, bytes/(1024.0*1024.0), iterations);
+    LOG_INFO("  interpreted: %.2fms, %.1fns per fragment", interpreted_ms, interpreted_ms*1e6/((f64)fragments*iterations));
+    LOG_INFO("  compiled:    %.2fms, %.1fns per fragment (%.2fx)", compiled_ms, compiled_ms*1e6/((f64)fragments*iterations), interpreted_ms/compiled_ms);
+}
+
+// NOTE(jesper): returns the exit code of the build, which fails when a page is over the
+// budget of the page-weight report
+i32 generate_src_dir(String output, String src_dir, FsgOptions opts)
+{
+    FsgSite site = create_site(output, src_dir, opts);
+    if (!load_site(&site)) return 1;
+
+    if (opts.bench_templates > 0) bench_templates(&site, opts.bench_templates);
+    FsgRenderStats stats = render_site(&site);
+
+    if (stats.report.length > 0) {
+        fwrite(stats.report.data, 1, stats.report.length, stdout);
+        fflush(stdout);
+        destroy_string(stats.report);
+    }
+
+    return stats.over_budget > 0 ? 1 : 0;
+}
+
+#define FSG_MAX_DAEMON_REQUEST (64*1024)
+
+// NOTE(jesper): the options a generate request has to agree with the daemon on, one
+// name=value per line. The client sends its own after the command, since the resident
+// site was loaded and is rendered with the daemon's. The page-weight report's options
+// are the exception, they're sent along with them and apply to that request alone, see
+// append_report_options
+void append_daemon_options(StringBuilder *sb, String output, String src_dir, FsgOptions &opts)
+{
+    append_stringf(sb, "output=%.*s\n", STRFMT(output));
+    append_stringf(sb, "src=%.*s\n", STRFMT(src_dir));
+    append_stringf(sb, "cache=%.*s\n", STRFMT(opts.cache_dir));
+    append_stringf(sb, "pack=%.*s\n", STRFMT(opts.pack_path));
+    append_stringf(sb, "drafts=%d\n", opts.build_drafts);
+    append_stringf(sb, "brief-words=%d\n", opts.brief_max_words);
+    append_stringf(sb, "brief-bytes=%d\n", opts.brief_max_bytes);
+    append_stringf(sb, "minify=%d\n", opts.minify);
+    append_stringf(sb, "fingerprint=%d\n", opts.fingerprint);
+    append_stringf(sb, "bundle=%d\n", opts.bundle);
+    append_stringf(sb, "critical-css=%d\n", opts.critical_css);
+
+    append_string(sb, "image-widths=");
+    for (i32 i = 0; i < opts.image_width_count; i++) {
+        append_stringf(sb, "%s%d", i > 0 ? "," : "", opts.image_widths[i]);
+    }
+    append_string(sb, "\n");
+    append_stringf(sb, "image-sizes=%.*s\n", STRFMT(opts.image_sizes));
+
+    append_stringf(sb, "search=%d\n", opts.search);
+    append_stringf(sb, "search-shards=%d\n", opts.search_shards);
+    append_stringf(sb, "memory-budget=%d\n", opts.memory_budget_mb);
+    append_stringf(sb, "jit=%d\n", opts.jit_templates);
+    append_stringf(sb, "bench-templates=%d\n", opts.bench_templates);
+}
+
+// NOTE(jesper): the report's path is made absolute, since the daemon doesn't share the
+// client's working directory. The budgets are whole kilobytes, as they're given
+void append_report_options(StringBuilder *sb, FsgOptions &opts)
+{
+    String report_path = opts.report_path;
+#if !defined(_WIN32)
+    char cwd[4096];
+    if (report_path.length > 0 && report_path[0] != '/' && getcwd(cwd, sizeof cwd)) {
+        report_path = join_path(String{ cwd, (i32)strlen(cwd) }, report_path, sb->alloc);
+    }
+#endif
+
+    append_stringf(sb, "report=%d\n", opts.report);
+    append_stringf(sb, "report-path=%.*s\n", STRFMT(report_path));
+    append_stringf(sb, "max-html-kb=%d\n", (i32)(opts.max_html_bytes/1024));
+    append_stringf(sb, "max-page-kb=%d\n", (i32)(opts.max_page_bytes/1024));
+}
+
+// NOTE(jesper): applies a line of append_report_options to the options of a request.
+// Returns false for any other line, and for malformed values
+bool parse_report_option(FsgOptions *opts, String line)
+{
+    i32 value = 0;
+    if (starts_with(line, "report=")) {
+        if (!parse_i32(String{ line.data+strlen("report="), line.length-(i32)strlen("report=") }, &value)) return false;
+        opts->report = value != 0;
+    } else if (starts_with(line, "report-path=")) {
+        opts->report_path = { line.data+strlen("report-path="), line.length-(i32)strlen("report-path=") };
+    } else if (starts_with(line, "max-html-kb=")) {
+        if (!parse_i32(String{ line.data+strlen("max-html-kb="), line.length-(i32)strlen("max-html-kb=") }, &value)) return false;
+        opts->max_html_bytes = (i64)value*1024;
+    } else if (starts_with(line, "max-page-kb=")) {
+        if (!parse_i32(String{ line.data+strlen("max-page-kb="), line.length-(i32)strlen("max-page-kb=") }, &value)) return false;
+        opts->max_page_bytes = (i64)value*1024;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+String next_line(String *text)
+{
+    String line{ text->data, 0 };
+    while (line.length < text->length && text->data[line.length] != '\n') line.length++;
+
+    text->data += MIN(line.length+1, text->length);
+    text->length -= MIN(line.length+1, text->length);
+    return line;
+}
+
+#if !defined(_WIN32)
+bool send_all(int fd, const char *data, i32 length)
+{
+#if defined(MSG_NOSIGNAL)
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    while (length > 0) {
+        ssize_t sent = send(fd, data, (size_t)length, flags);
+        if (sent == -1 && errno == EINTR) continue;
+        if (sent <= 0) return false;
+
+        data += sent;
+        length -= (i32)sent;
+    }
+
+    return true;
 }
 
-bool parse_bool(Lexer *lexer, bool *bool_out, Token *t_out)
+bool init_socket_address(String socket_path, sockaddr_un *addr)
 {
-    String str;
-    if (parse_string(lexer, &str, t_out)) {
-        if (str == "yes" || str == "true") {
-            *bool_out = true;
-            return true;
-        } else if (str == "no" || str == "false") {
-            *bool_out = false;
-            return true;
-        }
-        PARSE_ERRORF(lexer, "unexpected identifier parsing bool: '%.*s'", STRFMT(str));
+    *addr = {};
+    addr->sun_family = AF_UNIX;
+
+    if (socket_path.length >= (i32)sizeof addr->sun_path) {
+        LOG_ERROR("socket path too long: '%.*s'", STRFMT(socket_path));
         return false;
     }
-    return false;
+
+    memcpy(addr->sun_path, socket_path.data, socket_path.length);
+    return true;
 }
 
-void append_post(StringBuilder *sb, FsgTemplate *tmpl, FsgPost post)
+// NOTE(jesper): keeps the parsed site resident and serves generate requests over a unix
+// domain socket, one request at a time. A request revalidates the inputs and re-renders
+// only the outputs they affect, see update_site. Requests made with other options than the
+// daemon's are refused rather than rendered with the wrong ones
+i32 run_daemon(String output, String src_dir, FsgOptions opts)
 {
-    for (FsgPart s : tmpl->parts) {
-        switch (s.type) {
-        case FSG_PART_VARIABLE:
-            append_string(sb, String{ tmpl->contents.data+s.offset, s.length });
-
-            if (s.variable == "post.created") {
-                append_string(sb, post.created);
-            } else if (s.variable == "post.title") {
-                append_string(sb, post.title);
-            } else if (s.variable == "post.url") {
-                append_string(sb, post.url);
-            } else if (s.variable == "post.brief") {
-                append_string(sb, post.brief);
-            } else if (s.variable == "post.content") {
-                append_string(sb, post.content);
-            } else if (s.variable == "post.tags") {
-                if (post.tags.count > 0) {
-                    append_string(sb, "<i class=\"fa fa-tag\"></i>");
-
-                    for (i32 i = 0; i < post.tags.count-1; i++) {
-                        append_stringf(
-                            sb,
-                            "<a href=\"/posts/tag/%.*s.html\">%.*s</a>, ",
-                            STRFMT(post.tags[i]),
-                            STRFMT(post.tags[i]));
-                    }
+    FsgSite site = create_site(output, src_dir, opts);
 
-                    append_stringf(
-                        sb,
-                        "<a href=\"/posts/tag/%.*s.html\">%.*s</a>",
-                        STRFMT(post.tags[post.tags.count-1]),
-                        STRFMT(post.tags[post.tags.count-1]));
-
-                }
-            } else if(s.variable.length > 0) {
-                LOG_ERROR("unhandled section '%.*s'", STRFMT(s.variable));
-            }
-            break;
+    sockaddr_un addr;
+    if (!init_socket_address(site.opts.socket_path, &addr)) return 1;
 
-        case FSG_PART_CHUNK:
-            append_string(sb, String{ tmpl->contents.data+s.offset, s.length });
-            break;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        LOG_ERROR("failed creating socket: %s", strerror(errno));
+        return 1;
+    }
+    defer { close(fd); };
 
-        }
+    if (connect(fd, (sockaddr*)&addr, sizeof addr) == 0) {
+        LOG_ERROR("a daemon is already listening on '%.*s'", STRFMT(site.opts.socket_path));
+        return 1;
     }
-}
 
-void generate_src_dir(String output, String src_dir, bool build_drafts)
-{
-    SArena scratch = tl_scratch_arena();
+    char sz_cache_dir[4096];
+    snprintf(sz_cache_dir, sizeof sz_cache_dir, "%.*s", STRFMT(site.opts.cache_dir));
+    mkdir(sz_cache_dir, 0755);
 
-    DynamicArray<FsgTemplate> templates{};
-    DynamicArray<FsgPost> posts{};
-    DynamicArray<FsgPage> pages{};
-    DynamicArray<FsgTag> tags{};
+    // NOTE(jesper): the socket file of a daemon that didn't shut down cleanly
+    unlink(addr.sun_path);
 
-    String posts_src_path = join_path(src_dir, "_posts", mem_dynamic);
-    String posts_dst_path = join_path(output, "posts", mem_dynamic);
+    if (bind(fd, (sockaddr*)&addr, sizeof addr) == -1 || listen(fd, 8) == -1) {
+        LOG_ERROR("failed listening on '%.*s': %s", STRFMT(site.opts.socket_path), strerror(errno));
+        return 1;
+    }
+    defer { unlink(addr.sun_path); };
 
-    DynamicArray<String> page_files = list_files(src_dir, mem_dynamic);
-    DynamicArray<String> post_files = list_files(posts_src_path, mem_dynamic);
-    DynamicArray<String> template_files = list_files(join_path(src_dir, "_templates", mem_dynamic), mem_dynamic);
+    if (!load_site(&site)) return 1;
 
-    remove_files(output);
+    FsgRenderStats stats = render_site(&site);
+    if (stats.report.length > 0) {
+        fwrite(stats.report.data, 1, stats.report.length, stdout);
+        fflush(stdout);
+        destroy_string(stats.report);
+    }
 
-    copy_files(src_dir, "css", output);
-    copy_files(src_dir, "img", output);
-    copy_files(src_dir, "js", output);
-    copy_files(src_dir, "fonts", output);
+    LOG_INFO("daemon listening on '%.*s'", STRFMT(site.opts.socket_path));
 
-    copy_files(src_dir, "assets", output);
+    while (true) {
+        int client = accept(fd, nullptr, nullptr);
+        if (client == -1) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("failed accepting connection: %s", strerror(errno));
+            return 1;
+        }
+        defer { close(client); };
 
-    for (String p : post_files) {
-        String filename{ p.data+posts_src_path.length+1, p.length-posts_src_path.length-1};
+        SArena scratch = tl_scratch_arena();
 
-        FileInfo contents = read_file(p, mem_dynamic);
-        if (!contents.data) {
-            LOG_ERROR("failed reading %.*s", p.length, p.data);
-            continue;
+        // NOTE(jesper): the client shuts down its end once the request is sent
+        StringBuilder request_sb{ .alloc = scratch };
+        i32 request_length = 0;
+        while (request_length <= FSG_MAX_DAEMON_REQUEST) {
+            char buffer[4096];
+            ssize_t received = recv(client, buffer, sizeof buffer, 0);
+            if (received == -1 && errno == EINTR) continue;
+            if (received <= 0) break;
+
+            append_string(&request_sb, String{ buffer, (i32)received });
+            request_length += (i32)received;
         }
 
-        StringBuilder content{};
-
-        Lexer lexer{
-            (char*)contents.data,
-            (char*)contents.data+contents.size,
-            p,
-            (LexerFlags)(LEXER_FLAG_NONE | LEXER_FLAG_ENABLE_ANCHOR)
-        };
-        char *ptr = lexer.at;
+        char response[512];
+        if (request_length > FSG_MAX_DAEMON_REQUEST) {
+            snprintf(response, sizeof response, "error: request too large\n");
+            send_all(client, response, (i32)strlen(response));
+            continue;
+        }
 
-        FsgPost post{};
+        String request = create_string(&request_sb, scratch);
+        String command = next_line(&request);
+        while (command.length > 0 && is_html_whitespace(command[command.length-1])) command.length--;
 
-        Token t = next_token(&lexer);
-        while (t.type != TOKEN_EOF) {
-            if (t.type == TOKEN_COMMENT) {
-                Lexer fsg_lexer{
-                    t.str.data,
-                    t.str.data+t.str.length,
-                    p,
-                    (LexerFlags)(LEXER_FLAG_EAT_NEWLINE | LEXER_FLAG_EAT_WHITESPACE)
-                };
+        if (command == "generate") {
+            StringBuilder options_sb{ .alloc = scratch };
+            append_daemon_options(&options_sb, site.output, site.src_dir, site.opts);
+            String options = create_string(&options_sb, scratch);
 
-                Token t2 = next_token(&fsg_lexer);
-                if (is_identifier(t2, "fsg")) {
-                    if (!require_next_token(&fsg_lexer, ':', &t2)) goto next_post_file;
+            FsgOptions request_opts = site.opts;
+            StringBuilder requested_sb{ .alloc = scratch };
+            while (request.length > 0) {
+                String line = next_line(&request);
+                if (parse_report_option(&request_opts, line)) continue;
 
-                    t2 = next_token(&fsg_lexer);
-                    if (is_identifier(t2, "brief")) {
-                        if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_post_file;
-                        if (!require_next_token(&fsg_lexer, TOKEN_EOF, &t2)) goto next_post_file;
+                append_string(&requested_sb, line);
+                append_char(&requested_sb, '\n');
+            }
+            request = create_string(&requested_sb, scratch);
+
+            if (request != options) {
+                String requested = next_line(&request);
+                String expected = next_line(&options);
+                while (requested == expected && (request.length > 0 || options.length > 0)) {
+                    requested = next_line(&request);
+                    expected = next_line(&options);
+                }
 
-                        post.brief = create_string(&content, mem_dynamic);
-                    } else {
-                        while (t2.type != TOKEN_EOF) {
-                            if (is_identifier(t2, "title")) {
-                                if (!parse_string(&fsg_lexer, &post.title, &t2)) goto next_post_file;
-                                if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_post_file;
-                            } else if (is_identifier(t2, "created")) {
-                                if (!parse_string(&fsg_lexer, &post.created, &t2)) goto next_post_file;
-                                if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_post_file;
-                            } else if (is_identifier(t2, "draft")) {
-                                if (!parse_bool(&fsg_lexer, &post.draft, &t2)) goto next_post_file;
-                                if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_post_file;
-                            } else if (is_identifier(t2, "tags")) {
-                                if (!parse_string_list(&fsg_lexer, &post.tags, &t2)) goto next_post_file;
-                                if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_post_file;
-                            } else {
-                                PARSE_ERRORF(
-                                    &fsg_lexer,
-                                    "unexpected token. expected one of 'title' or 'date', got '%.*s'",
-                                    STRFMT(t2.str));
-                                goto next_post_file;
-                            }
-
-                            t2 = next_token(&fsg_lexer);
+                snprintf(response, sizeof response,
+                         "error: daemon has '%.*s' rather than the requested '%.*s', restart it with the same options\n",
+                         STRFMT(expected), STRFMT(requested));
+                LOG_INFO("%s", response);
+                send_all(client, response, (i32)strlen(response));
+                continue;
+            }
 
-                        }
-                    }
-                }
-            } else if (t.type == TOKEN_CODE_BLOCK) {
-                append_string(&content, "<code class=\"block\">");
-                append_escape_html(&content, t.str);
-                append_string(&content, "</code>");
-            } else if (t.type == TOKEN_CODE_INLINE) {
-                append_string(&content, "<code>");
-                append_escape_html(&content, t.str);
-                append_string(&content, "</code>");
-            } else if (t.type == TOKEN_ANCHOR) {
-                i32 length = (i32)(t.str.data - ptr);
-                if (length > 0) append_string(&content, String{ ptr, length });
-
-                Array<TagProperty> properties = parse_html_tag_properties(t.str);
-                String inner = parse_html_tag_inner(t.str);
-
-                bool has_href = false;
-                append_string(&content, "<a");
-
-                for (TagProperty prop : properties) {
-                    if (prop.key == "href") has_href = true;
-                    append_stringf(&content, " %.*s=\"%.*s\"", STRFMT(prop.key), STRFMT(prop.value));
-                }
 
-                if (!has_href) append_stringf(&content, " href=\"%.*s\"", STRFMT(inner));
-                append_stringf(&content, ">%.*s</a>", STRFMT(inner));
+            // NOTE(jesper): the report path points into the request, so the daemon's own
+            // options are put back once it's handled
+            FsgOptions daemon_opts = site.opts;
+            site.opts = request_opts;
+            defer { site.opts = daemon_opts; };
+
+            auto start = std::chrono::steady_clock::now();
+
+            bool success = update_site(&site);
+            FsgRenderStats stats{};
+            if (success) stats = render_site(&site);
+            defer { if (stats.report.length > 0) destroy_string(stats.report); };
+
+            f64 ms = std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now()-start).count();
+            if (success && stats.over_budget > 0) {
+                snprintf(response, sizeof response,
+                         "error: rendered %d tags, %d pages, %d posts in %.2fms, %d pages over budget\n",
+                         stats.tags, stats.pages, stats.posts, ms, stats.over_budget);
+            } else if (success) {
+                snprintf(response, sizeof response,
+                         "ok: rendered %d tags, %d pages, %d posts in %.2fms\n",
+                         stats.tags, stats.pages, stats.posts, ms);
             } else {
-                i32 length = (i32)(lexer.at - ptr);
-                if (length > 0) append_string(&content, String{ ptr, length });
+                snprintf(response, sizeof response, "error: generate failed, see daemon log\n");
             }
 
-            ptr = lexer.at;
-            t = next_token(&lexer);
+            // NOTE(jesper): a report without a path follows the status line, for the client
+            // to print
+            LOG_INFO("%s", response);
+            send_all(client, response, (i32)strlen(response));
+            send_all(client, stats.report.data, stats.report.length);
+        } else if (command == "shutdown") {
+            snprintf(response, sizeof response, "ok: shutting down\n");
+            send_all(client, response, (i32)strlen(response));
+            break;
+        } else {
+            snprintf(response, sizeof response, "error: unknown command '%.*s'\n", STRFMT(command));
+            send_all(client, response, (i32)strlen(response));
         }
+    }
 
-        post.content = create_string(&content, mem_dynamic);
-        if (post.brief.length == 0) post.brief = post.content;
+    return 0;
+}
 
-        post.path = join_path(posts_dst_path, filename, mem_dynamic);
-        post.url = join_url("/posts", filename);
-        array_add(&posts, post);
+// NOTE(jesper): returns -1 if no daemon is listening on the socket, otherwise 0 or 1
+// depending on whether the daemon handled the request successfully
+i32 request_daemon(String socket_path, String request)
+{
+    sockaddr_un addr;
+    if (!init_socket_address(socket_path, &addr)) return -1;
 
-        for (i32 i = 0; i < post.tags.count; i++) {
-            for (FsgTag &t : tags) {
-                if (t.str == post.tags[i]) {
-                    array_add(&t.posts, post);
-                    LOG_INFO("adding post '%.*s' to existing tag: '%.*s'", STRFMT(post.title), STRFMT(t.str));
-                    goto next_tag;
-                }
-            }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) return -1;
+    defer { close(fd); };
 
-            {
-                FsgTag t{};
-                t.str = post.tags[i];
-                array_add(&t.posts, post);
-                array_add(&tags, t);
-                LOG_INFO("adding post '%.*s' to new tag: '%.*s'", STRFMT(post.title), STRFMT(t.str));
-            }
+    if (connect(fd, (sockaddr*)&addr, sizeof addr) == -1) return -1;
 
-next_tag:;
-        }
+    if (!send_all(fd, request.data, request.length)) return -1;
+    shutdown(fd, SHUT_WR);
 
-next_post_file:;
+    SArena scratch = tl_scratch_arena();
+    StringBuilder response_sb{ .alloc = scratch };
+    while (true) {
+        char buffer[4096];
+        ssize_t received = recv(fd, buffer, sizeof buffer, 0);
+        if (received == -1 && errno == EINTR) continue;
+        if (received <= 0) break;
+
+        append_string(&response_sb, String{ buffer, (i32)received });
     }
 
-    sort_posts(posts);
+    // NOTE(jesper): a status line, followed by the page-weight report when the request
+    // asked for it on stdout
+    String response = create_string(&response_sb, scratch);
+    String status = next_line(&response);
+    while (status.length > 0 && is_html_whitespace(status[status.length-1])) status.length--;
 
-    for (String p : template_files) {
-        FileInfo contents = read_file(p, mem_dynamic);
-        if (!contents.data) {
-            LOG_ERROR("failed reading %.*s", p.length, p.data);
-            return;
-        }
+    if (status.length == 0) {
+        LOG_ERROR("daemon closed the connection without a response");
+        return 1;
+    }
 
-        FsgTemplate tmpl{};
-        tmpl.contents = String{ (char*)contents.data, contents.size };
+    LOG_INFO("daemon: %.*s", STRFMT(status));
+    if (response.length > 0) {
+        fwrite(response.data, 1, response.length, stdout);
+        fflush(stdout);
+    }
 
-        FsgPart tail{};
-        i32 last_section_end = 0;
+    return starts_with(status, "ok") ? 0 : 1;
+}
+#else
+i32 run_daemon(String, String, FsgOptions)
+{
+    LOG_ERROR("daemon mode is not supported on this platform");
+    return 1;
+}
 
+i32 request_daemon(String, String)
+{
+    return -1;
+}
+#endif
+
+
+// NOTE(jesper): limits on a single request. A head that doesn't fit is rejected with a
+// 431, or a 414 if it's the request line that doesn't fit. Bodies are only accepted so
+// that they can be skipped over, nothing served by fsg takes one
+#define HTTP_MAX_HEAD_SIZE (8*1024)
+#define HTTP_MAX_BODY_SIZE (8*1024)
+#define HTTP_MAX_HEADERS 64
+
+enum HttpParseState {
+    HTTP_STATE_REQUEST_LINE = 0,
+    HTTP_STATE_HEADER_LINE,
+    HTTP_STATE_BODY,
+    HTTP_STATE_DONE,
+    HTTP_STATE_ERROR,
+};
 
-        String filename = p;
-        while (filename.length > 0 && filename[filename.length-1] != '.') filename.length--;
-        filename.length = filename.data[filename.length-1] == '.' ? filename.length-1 : filename.length;
+struct HttpHeader {
+    String name;
+    String value;
+};
 
-        filename.data = filename.data + filename.length-1;
-        while (filename.data > p.data && filename.data[0] != '\\' && filename.data[0] != '/') filename.data--;
-        filename.data = *filename.data == '\\' || *filename.data == '/' ? filename.data+1 : filename.data;
-        filename.length -= (i32)(filename.data-p.data);
+struct HttpQueryParam {
+    String key;
+    String value;
+};
 
-        DynamicArray<FsgPart> parts{};
+struct HttpRequest {
+    String method;
+    String target;
+    String version;
 
-        tmpl.name = duplicate_string(filename, mem_dynamic);
+    // NOTE(jesper): path is percent-decoded in place, query is left as received, see
+    // http_split_query
+    String path;
+    String query;
 
-        Lexer lexer{ (char*)contents.data, (char*)contents.data+contents.size, p };
+    HttpHeader headers[HTTP_MAX_HEADERS];
+    i32 header_count;
 
-        Token t = next_token(&lexer);
-        while (t.type != TOKEN_EOF) {
-            if (t.type == TOKEN_COMMENT) {
-                char *comment_start = t.str.data-4;
-                char *comment_end = t.str.data+t.str.length+3;
-
-                Lexer fsg_lexer{
-                    t.str.data,
-                    t.str.data+t.str.length,
-                    p,
-                    (LexerFlags)(LEXER_FLAG_EAT_WHITESPACE | LEXER_FLAG_EAT_NEWLINE)
-                };
+    i64 content_length;
+    bool keep_alive;
+};
 
-                Token t2 = next_token(&fsg_lexer);
-                if (is_identifier(t2, "fsg")) {
-                    FsgPart part{};
+// NOTE(jesper): incremental parser for a single HTTP/1.1 request. It's fed the receive
+// buffer of a connection each time more data arrives and picks up where it left off, so
+// the buffer may be appended to but must not move until the request is complete. The
+// strings in the request point into it
+struct HttpParser {
+    HttpParseState state;
+    i32 status;
 
-                    if (!require_next_token(&fsg_lexer, ':', &t2)) goto next_tmpl_file;
+    i32 at;
+    i32 head_end;
 
-                    t2 = next_token(&fsg_lexer);
-                    while (t2.type != TOKEN_EOF) {
+    HttpRequest request;
+};
 
-                        if (is_identifier(t2, "section")) {
-                            if (!parse_string(&fsg_lexer, &part.variable, &t2)) goto next_tmpl_file;
-                            if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_tmpl_file;
-                            part.type = FSG_PART_VARIABLE;
-                        } else {
-                            PARSE_ERRORF(&fsg_lexer, "unexpected token. expected one of 'section', got '%.*s'", STRFMT(t2.str));
-                            goto next_tmpl_file;
-                        }
+bool is_http_token_char(char c)
+{
+    if (is_alpha(c) || is_number(c)) return true;
 
-                        t2 = next_token(&fsg_lexer);
+    switch (c) {
+    case '!': case '#': case '$': case '%': case '&': case '\'': case '*':
+    case '+': case '-': case '.': case '^': case '_': case '`': case '|': case '~':
+        return true;
+    }
 
-                    }
+    return false;
+}
 
-                    part.offset = last_section_end;
-                    part.length = (i32)(comment_start-(char*)contents.data-last_section_end);
-                    last_section_end = (i32)(comment_end - (char*)contents.data);
-                    array_add(&parts, part);
-                }
+i32 hex_digit_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-            }
+// NOTE(jesper): decodes %XX escapes in place, and + to space for query components.
+// Fails on malformed escapes and on escapes decoding to NUL
+bool http_percent_decode(String *str, bool plus_as_space)
+{
+    i32 dst = 0;
+    for (i32 i = 0; i < str->length; i++) {
+        char c = str->data[i];
 
-            t = next_token(&lexer);
-        }
+        if (c == '%') {
+            if (i+2 >= str->length) return false;
 
-        tail = FsgPart{ 
-            .type = FSG_PART_CHUNK,
-            .offset = last_section_end, 
-            .length = (i32)(lexer.end - ((char*)contents.data + last_section_end)) 
-        };
-        if (tail.length > 0) array_add(&parts, tail);
+            i32 hi = hex_digit_value(str->data[i+1]);
+            i32 lo = hex_digit_value(str->data[i+2]);
+            if (hi == -1 || lo == -1 || (hi == 0 && lo == 0)) return false;
 
-        tmpl.parts = parts;
-        array_add(&templates, tmpl);
+            c = (char)(hi << 4 | lo);
+            i += 2;
+        } else if (c == '+' && plus_as_space) {
+            c = ' ';
+        }
 
-next_tmpl_file:;
+        str->data[dst++] = c;
     }
 
-    for (String p : page_files) {
-        FsgPage page{};
+    str->length = dst;
+    return true;
+}
 
-        String filename{ p.data+src_dir.length+1, p.length-src_dir.length-1};
-        String out_file = join_path(output, filename, mem_dynamic);
+// NOTE(jesper): splits a query string into its key=value pairs, percent-decoding them in
+// place. Returns the number of pairs, which is capped at max_params
+i32 http_split_query(String query, HttpQueryParam *params, i32 max_params)
+{
+    i32 count = 0;
 
-        page.name = filename;
-        page.path = out_file;
+    while (query.length > 0 && count < max_params) {
+        String pair{ query.data, 0 };
+        while (pair.length < query.length && query[pair.length] != '&') pair.length++;
 
-        FileInfo contents = read_file(p, mem_dynamic);
-        if (!contents.data) {
-            LOG_ERROR("failed reading: %.*s", p.length, p.data);
+        query.data += MIN(pair.length+1, query.length);
+        query.length -= MIN(pair.length+1, query.length);
+
+        if (pair.length == 0) continue;
+
+        HttpQueryParam param{};
+        param.key = pair;
+
+        for (i32 i = 0; i < pair.length; i++) {
+            if (pair[i] == '=') {
+                param.key.length = i;
+                param.value = String{ pair.data+i+1, pair.length-i-1 };
+                break;
+            }
+        }
+
+        if (!http_percent_decode(&param.key, true) ||
+            !http_percent_decode(&param.value, true))
+        {
             continue;
         }
 
-        page.contents = String{ (char*)contents.data, contents.size };
+        params[count++] = param;
+    }
 
+    return count;
+}
 
-        DynamicArray<FsgPart> parts{};
-        FsgPart tail{};
+String http_header(HttpRequest *request, String name)
+{
+    for (i32 i = 0; i < request->header_count; i++) {
+        if (eq_ignore_case(request->headers[i].name, name)) return request->headers[i].value;
+    }
 
-        i32 last_section_end = 0;
+    return {};
+}
 
-        Lexer lexer{ (char*)contents.data, (char*)contents.data+contents.size, p };
-        Token t = next_token(&lexer);
-        while (t.type != TOKEN_EOF) {
-            if (t.type == TOKEN_COMMENT) {
-                char *comment_start = t.str.data-4;
-                char *comment_end = t.str.data+t.str.length+3;
-
-                Lexer fsg_lexer{
-                    t.str.data,
-                    t.str.data+t.str.length,
-                    p,
-                    (LexerFlags)(LEXER_FLAG_EAT_WHITESPACE | LEXER_FLAG_EAT_NEWLINE)
-                };
+bool http_parse_error(HttpParser *parser, i32 status)
+{
+    parser->state = HTTP_STATE_ERROR;
+    parser->status = status;
+    return false;
+}
 
-                Token t2 = next_token(&fsg_lexer);
-                if (is_identifier(t2, "fsg")) {
-                    FsgPart part{};
+bool http_parse_request_line(HttpParser *parser, String line)
+{
+    HttpRequest *request = &parser->request;
+
+    i32 i = 0;
+    while (i < line.length && is_http_token_char(line[i])) i++;
+    if (i == 0 || i == line.length || line[i] != ' ') return http_parse_error(parser, 400);
+    request->method = String{ line.data, i };
+
+    i32 target_start = ++i;
+    while (i < line.length && line[i] != ' ') i++;
+    if (i == target_start || i == line.length) return http_parse_error(parser, 400);
+    request->target = String{ line.data+target_start, i-target_start };
+    request->version = String{ line.data+i+1, line.length-i-1 };
+
+    if (request->version == "HTTP/1.1") {
+        request->keep_alive = true;
+    } else if (request->version == "HTTP/1.0") {
+        request->keep_alive = false;
+    } else if (starts_with(request->version, "HTTP/")) {
+        return http_parse_error(parser, 505);
+    } else {
+        return http_parse_error(parser, 400);
+    }
 
-                    if (!require_next_token(&fsg_lexer, ':', &t2)) goto next_page_file;
+    String path = request->target;
 
-                    t2 = next_token(&fsg_lexer);
-                    while (t2.type != TOKEN_EOF) {
-                        if (is_identifier(t2, "template")) {
-                            if (page.tmpl_index == -1) {
-                                if (!require_next_token(&fsg_lexer, TOKEN_IDENTIFIER, &t2)) goto next_page_file;
-                                page.tmpl_index = find_template_index(templates, t2.str);
-
-                                if (!require_next_token(&fsg_lexer, '.', &t2)) goto next_page_file;
-                                if (!require_next_token(&fsg_lexer, TOKEN_IDENTIFIER, &t2)) goto next_page_file;
-                                page.dst_section_name = t2.str;
-
-                                if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_page_file;
-                            } else {
-                                PARSE_ERROR(&fsg_lexer, "duplicate template properties");
-                                goto next_page_file;
-                            }
-                        } else if (is_identifier(t2, "section")) {
-                            if (!parse_string(&fsg_lexer, &part.variable, &t2)) goto next_page_file;
-                            if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_page_file;
-                            part.type = FSG_PART_VARIABLE;
-                        } else if (is_identifier(t2, "title")) {
-                            if (!parse_string(&fsg_lexer, &page.title, &t2)) goto next_page_file;
-                            if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_page_file;
-                        } else if (is_identifier(t2, "subtitle")) {
-                            if (!parse_string(&fsg_lexer, &page.subtitle, &t2)) goto next_page_file;
-                            if (!require_next_token(&fsg_lexer, ';', &t2)) goto next_page_file;
-                        } else {
-                            PARSE_ERRORF(
-                                &fsg_lexer,
-                                "unexpected identifier. expected one of 'template', 'section' - got '%.*s'",
-                                STRFMT(t2.str));
-                            goto next_page_file;
-                        }
+    // NOTE(jesper): absolute-form, as sent to proxies, which servers must accept too
+    if (starts_with(path, "http://") || starts_with(path, "https://")) {
+        i32 scheme_end = path[4] == ':' ? 7 : 8;
 
-                        t2 = next_token(&fsg_lexer);
-                    }
+        i32 j = scheme_end;
+        while (j < path.length && path[j] != '/') j++;
+        path = String{ path.data+j, path.length-j };
+        if (path.length == 0) path = "/";
+    }
 
-                    part.offset = last_section_end;
-                    part.length = (i32)(comment_start-(char*)contents.data-last_section_end);
-                    last_section_end = (i32)(comment_end-(char*)contents.data);
-                    array_add(&parts, part);
-                }
-            }
+    if (path.length == 0 || path[0] != '/') return http_parse_error(parser, 400);
 
-            t = next_token(&lexer);
+    for (i32 j = 0; j < path.length; j++) {
+        if (path[j] == '?') {
+            request->query = String{ path.data+j+1, path.length-j-1 };
+            path.length = j;
+            break;
         }
+    }
 
-        tail = FsgPart{ 
-            .type = FSG_PART_CHUNK,
-            .offset = last_section_end, 
-            .length = (i32)(lexer.end - ((char*)contents.data + last_section_end)) };
-        if (tail.length > 0) array_add(&parts, tail);
-
-        page.parts = parts;
-        array_add(&pages, page);
+    if (!http_percent_decode(&path, false)) return http_parse_error(parser, 400);
 
-next_page_file:;
+    // NOTE(jesper): paths are joined onto the output directory, so any segment that
+    // would walk out of it is rejected, escaped or not
+    for (i32 j = 0; j < path.length; j++) {
+        if (path[j] == '\\') return http_parse_error(parser, 400);
+        if ((j == 0 || path[j-1] == '/') &&
+            starts_with(String{ path.data+j, path.length-j }, "..") &&
+            (j+2 == path.length || path[j+2] == '/'))
+        {
+            return http_parse_error(parser, 400);
+        }
     }
 
-    FsgTemplate *brief_tmpl = find_template(templates, "post_brief_inline");
-    FsgTemplate *brief_block_tmpl = find_template(templates, "post_brief_block");
-    FsgTemplate *full_tmpl = find_template(templates, "post_full_block");
+    request->path = path;
+    return true;
+}
 
-    FsgTemplate *tag_tmpl = find_template(templates, "posts_tag");
+bool http_parse_header_line(HttpParser *parser, String line)
+{
+    HttpRequest *request = &parser->request;
 
-    if (tag_tmpl) {
-        for (FsgTag tag : tags) {
-            SArena scratch = tl_scratch_arena();
-            StringBuilder sb{ .alloc = scratch };
+    // NOTE(jesper): obsolete line folding, which RFC 9112 lets servers reject
+    if (line[0] == ' ' || line[0] == '\t') return http_parse_error(parser, 400);
 
-            for (FsgPart s : tag_tmpl->parts) {
-                switch (s.type) {
-                case FSG_PART_VARIABLE:
-                    append_string(&sb, String{ tag_tmpl->contents.data+s.offset, s.length });
+    i32 i = 0;
+    while (i < line.length && is_http_token_char(line[i])) i++;
+    if (i == 0 || i == line.length || line[i] != ':') return http_parse_error(parser, 400);
 
-                    if (s.variable == "posts.brief" || s.variable == "posts.full") {
-                        FsgTemplate *post_tmpl = s.variable == "posts.brief" ? brief_block_tmpl : full_tmpl;
+    HttpHeader header{};
+    header.name = String{ line.data, i };
 
-                        sort_posts(tag.posts);
-                        for (FsgPost post : tag.posts) {
-                            if (!build_drafts && post.draft) continue;
-                            append_post(&sb, post_tmpl, post);
-                        }
-                    } else if (s.variable == "tag.str") {
-                        append_string(&sb, tag.str);
-                    } else if (s.variable.length > 0) {
-                        LOG_ERROR("unhandled section '%.*s' in template '%.*s'", STRFMT(s.variable), STRFMT(tag_tmpl->name));
-                    }
-                    break;
+    String value{ line.data+i+1, line.length-i-1 };
+    while (value.length > 0 && (value[0] == ' ' || value[0] == '\t')) {
+        value.data++;
+        value.length--;
+    }
+    while (value.length > 0 && (value[value.length-1] == ' ' || value[value.length-1] == '\t')) {
+        value.length--;
+    }
+    header.value = value;
 
-                case FSG_PART_CHUNK:
-                    append_string(&sb, String{ tag_tmpl->contents.data+s.offset, s.length });
-                    break;
-                }
-            }
+    if (request->header_count == HTTP_MAX_HEADERS) return http_parse_error(parser, 431);
+    request->headers[request->header_count++] = header;
 
-            String path = join_path(output, stringf(mem_dynamic, "/posts/tag/%.*s.html", STRFMT(tag.str)), mem_dynamic);
-            //defer{ destroy_string(path); };
+    if (eq_ignore_case(header.name, "content-length")) {
+        i64 length = 0;
+        if (value.length == 0 || value.length > 18) return http_parse_error(parser, 400);
 
-            write_file(path, &sb);
+        for (i32 j = 0; j < value.length; j++) {
+            if (!is_number(value[j])) return http_parse_error(parser, 400);
+            length = length*10 + (value[j]-'0');
         }
-    }
 
+        if (request->content_length != -1 && request->content_length != length) {
+            return http_parse_error(parser, 400);
+        }
 
-    for (FsgPage page : pages) {
-        SArena scratch = tl_scratch_arena();
-        StringBuilder sb{ .alloc = scratch };
+        if (length > HTTP_MAX_BODY_SIZE) return http_parse_error(parser, 413);
+        request->content_length = length;
+    } else if (eq_ignore_case(header.name, "transfer-encoding")) {
+        return http_parse_error(parser, 501);
+    } else if (eq_ignore_case(header.name, "connection")) {
+        while (value.length > 0) {
+            String option{ value.data, 0 };
+            while (option.length < value.length && value[option.length] != ',') option.length++;
 
-        FsgTemplate *tmpl = &templates[page.tmpl_index];
-        for (FsgPart s : tmpl->parts) {
-            switch (s.type) {
-            case FSG_PART_VARIABLE:
-                append_string(&sb, String{ tmpl->contents.data+s.offset, s.length });
-                if (s.variable == page.dst_section_name) {
-                    for (FsgPart s2 : page.parts) {
-                        append_string(&sb, String{ page.contents.data+s2.offset, s2.length });
-                        if (s2.variable == "posts.brief" || s2.variable == "posts.full") {
-                            FsgTemplate *post_tmpl = s2.variable == "posts.brief" ? brief_tmpl : full_tmpl;
-
-                            for (FsgPost post : posts) {
-                                if (!build_drafts && post.draft) continue;
-                                append_post(&sb, post_tmpl, post);
-                            }
-                        } else if (s2.variable.length > 0) {
-                            LOG_ERROR("unhandled section '%.*s' in page '%.*s'", STRFMT(s2.variable), STRFMT(page.name));
-                        }
-                    }
-                } else if (s.variable == "page.title") {
-                    append_string(&sb, page.title);
-                } else if (s.variable == "page.subtitle") {
-                    append_string(&sb, page.subtitle);
-                } else if (s.variable.length > 0){
-                    LOG_ERROR("unhandled section '%.*s' in template '%.*s'", STRFMT(s.variable), STRFMT(tmpl->name));
-                }
-                break;
+            value.data += MIN(option.length+1, value.length);
+            value.length -= MIN(option.length+1, value.length);
 
-            case FSG_PART_CHUNK:
-                append_string(&sb, String{ tmpl->contents.data+s.offset, s.length });
-                break;
-            }
+            while (option.length > 0 && option[0] == ' ') { option.data++; option.length--; }
+            while (option.length > 0 && option[option.length-1] == ' ') option.length--;
+
+            if (eq_ignore_case(option, "close")) request->keep_alive = false;
+            else if (eq_ignore_case(option, "keep-alive")) request->keep_alive = true;
         }
+    }
+
+    return true;
+}
 
-        write_file(page.path, &sb);
+// NOTE(jesper): continues parsing the request at the start of data. Returns the number of
+// bytes the request occupies once it's complete, after which the caller handles it,
+// discards those bytes and resets the parser for the next pipelined request. Returns 0
+// while the request is incomplete or when parsing failed, in which case parser->state is
+// HTTP_STATE_ERROR and parser->status the response status
+i32 http_parse(HttpParser *parser, char *data, i32 length)
+{
+    if (parser->state == HTTP_STATE_REQUEST_LINE && parser->at == 0) {
+        parser->request = {};
+        parser->request.content_length = -1;
     }
 
-    FsgTemplate *post_tmpl = find_template(templates, "post");
-    if (post_tmpl) {
-    	for (FsgPost post : posts) {
-            if (!build_drafts && post.draft) continue;
+    while (parser->state == HTTP_STATE_REQUEST_LINE ||
+           parser->state == HTTP_STATE_HEADER_LINE)
+    {
+        // NOTE(jesper): tolerate empty lines preceding the request line, as recommended
+        // for robustness against clients sending an extra CRLF after a body
+        char *line_start = data + parser->at;
+        char *end = data + MIN(length, HTTP_MAX_HEAD_SIZE);
+        char *newline = find_char(line_start, end, '\n');
 
-            SArena scratch = tl_scratch_arena();
-            StringBuilder sb{ .alloc = scratch };
-            append_post(&sb, post_tmpl, post);
+        if (newline == end) {
+            if (length < HTTP_MAX_HEAD_SIZE) return 0;
+
+            http_parse_error(parser, parser->state == HTTP_STATE_REQUEST_LINE ? 414 : 431);
+            return 0;
+        }
+
+        String line{ line_start, (i32)(newline - line_start) };
+        if (line.length > 0 && line[line.length-1] == '\r') line.length--;
 
-            write_file(post.path, &sb);
+        parser->at = (i32)(newline - data) + 1;
+
+        if (parser->state == HTTP_STATE_REQUEST_LINE) {
+            if (line.length == 0) continue;
+            if (!http_parse_request_line(parser, line)) return 0;
+            parser->state = HTTP_STATE_HEADER_LINE;
+        } else if (line.length == 0) {
+            parser->head_end = parser->at;
+            parser->state = HTTP_STATE_BODY;
+        } else if (!http_parse_header_line(parser, line)) {
+            return 0;
         }
     }
+
+    if (parser->state == HTTP_STATE_BODY) {
+        i64 body = MAX(parser->request.content_length, 0);
+        if (length - parser->head_end < body) return 0;
+
+        parser->state = HTTP_STATE_DONE;
+    }
+
+    if (parser->state == HTTP_STATE_DONE) {
+        return parser->head_end + (i32)MAX(parser->request.content_length, 0);
+    }
+
+    return 0;
+}
+
+String http_status_str(i32 status)
+{
+    switch (status) {
+    case 200: return "OK";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 413: return "Content Too Large";
+    case 414: return "URI Too Long";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 505: return "HTTP Version Not Supported";
+    }
+
+    return "Unknown";
 }
 
+#if defined(__linux__)
+#include "linux_fsg_server.cpp"
+#endif
 
 int main(Array<String> args)
 {
     if (args.count < 3) {
-        LOG_INFO("usage: fsg generate|server -src=path -output=path [-drafts]");
+        LOG_INFO("usage: fsg generate|server|daemon -src=path -output=path [-daemon] [-socket=path] [-pack=path] [-port=N] [-workers=N] [-pin] [-drafts] [-brief-words=N] [-brief-bytes=N] [-minify] [-fingerprint] [-bundle] [-critical-css] [-image-widths=N,...] [-image-sizes=str] [-cache=path] [-search] [-search-shards=N] [-jit] [-bench-templates=N] [-memory-budget=MB] [-report[=path]] [-max-html-kb=N] [-max-page-kb=N]");
         return 1;
     }
 
@@ -1120,41 +6718,163 @@ int main(Array<String> args)
     enum {
         RUN_MODE_NONE,
         RUN_MODE_GENERATE,
-        RUN_MODE_SERVER
+        RUN_MODE_SERVER,
+        RUN_MODE_DAEMON
     } run_mode = RUN_MODE_NONE;
 
-    bool build_drafts = false;
+    FsgOptions opts{};
+    bool use_daemon = false;
 
     for (i32 i = 0; i < args.count; i++) {
         String a = args[i];
         if (starts_with(a, "generate")) {
             if (run_mode != 0) {
-                LOG_ERROR("can only supply one of generate|server");
+                LOG_ERROR("can only supply one of generate|server|daemon");
                 return 1;
             }
             run_mode = RUN_MODE_GENERATE;
         } else if (starts_with(a, "server")) {
             if (run_mode != 0) {
-                LOG_ERROR("can only supply one of generate|server");
+                LOG_ERROR("can only supply one of generate|server|daemon");
                 return 1;
             }
             run_mode = RUN_MODE_SERVER;
+        } else if (starts_with(a, "daemon")) {
+            if (run_mode != 0) {
+                LOG_ERROR("can only supply one of generate|server|daemon");
+                return 1;
+            }
+            run_mode = RUN_MODE_DAEMON;
         } else if (starts_with(a, "-output=")) {
             output = { a.data+strlen("-output="), a.length-(i32)strlen("-output=") };
         } else if (starts_with(a, "-src=")) {
             src_dir = { a.data+strlen("-src="), a.length-(i32)strlen("-src=") };
+        } else if (starts_with(a, "-daemon")) {
+            use_daemon = true;
+        } else if (starts_with(a, "-socket=")) {
+            opts.socket_path = { a.data+strlen("-socket="), a.length-(i32)strlen("-socket=") };
+        } else if (starts_with(a, "-pack=")) {
+            opts.pack_path = { a.data+strlen("-pack="), a.length-(i32)strlen("-pack=") };
+        } else if (starts_with(a, "-port=")) {
+            String value{ a.data+strlen("-port="), a.length-(i32)strlen("-port=") };
+            if (!parse_i32(value, &opts.port) || opts.port == 0 || opts.port > 65535) {
+                LOG_ERROR("invalid -port value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-workers=")) {
+            String value{ a.data+strlen("-workers="), a.length-(i32)strlen("-workers=") };
+            if (!parse_i32(value, &opts.workers) || opts.workers == 0) {
+                LOG_ERROR("invalid -workers value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-pin")) {
+            opts.pin_workers = true;
         } else if (starts_with(a, "-drafts")) {
-            build_drafts = true;
+            opts.build_drafts = true;
+        } else if (starts_with(a, "-minify")) {
+            opts.minify = true;
+        } else if (starts_with(a, "-fingerprint")) {
+            opts.fingerprint = true;
+        } else if (starts_with(a, "-bundle")) {
+            opts.bundle = true;
+        } else if (starts_with(a, "-critical-css")) {
+            opts.critical_css = true;
+        } else if (starts_with(a, "-image-widths=")) {
+#if !defined(FSG_STB_IMAGE)
+            LOG_ERROR("-image-widths requires fsg built with the image stage, see configure.py --images");
+            return 1;
+#endif
+            String value{ a.data+strlen("-image-widths="), a.length-(i32)strlen("-image-widths=") };
+            while (value.length > 0) {
+                String width{ value.data, 0 };
+                while (width.length < value.length && value[width.length] != ',') width.length++;
+
+                if (opts.image_width_count == FSG_MAX_IMAGE_WIDTHS ||
+                    !parse_i32(width, &opts.image_widths[opts.image_width_count]) ||
+                    opts.image_widths[opts.image_width_count++] <= 0)
+                {
+                    LOG_ERROR("invalid -image-widths value: '%.*s'", STRFMT(width));
+                    return 1;
+                }
+
+                value.data += MIN(width.length+1, value.length);
+                value.length -= MIN(width.length+1, value.length);
+            }
+        } else if (starts_with(a, "-image-sizes=")) {
+            opts.image_sizes = { a.data+strlen("-image-sizes="), a.length-(i32)strlen("-image-sizes=") };
+        } else if (starts_with(a, "-cache=")) {
+            opts.cache_dir = { a.data+strlen("-cache="), a.length-(i32)strlen("-cache=") };
+        } else if (a == "-jit") {
+            opts.jit_templates = true;
+        } else if (starts_with(a, "-bench-templates=")) {
+            String value{ a.data+strlen("-bench-templates="), a.length-(i32)strlen("-bench-templates=") };
+            if (!parse_i32(value, &opts.bench_templates) || opts.bench_templates <= 0) {
+                LOG_ERROR("invalid -bench-templates value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+            opts.jit_templates = true;
+        } else if (starts_with(a, "-report=")) {
+            opts.report = true;
+            opts.report_path = { a.data+strlen("-report="), a.length-(i32)strlen("-report=") };
+        } else if (a == "-report") {
+            opts.report = true;
+        } else if (starts_with(a, "-max-html-kb=") || starts_with(a, "-max-page-kb=")) {
+            bool html = starts_with(a, "-max-html-kb=");
+            String value{ a.data+strlen("-max-html-kb="), a.length-(i32)strlen("-max-html-kb=") };
+
+            i32 kb = 0;
+            if (!parse_i32(value, &kb) || kb <= 0) {
+                LOG_ERROR("invalid %s value: '%.*s'", html ? "-max-html-kb" : "-max-page-kb", STRFMT(value));
+                return 1;
+            }
+
+            if (html) opts.max_html_bytes = (i64)kb*1024;
+            else opts.max_page_bytes = (i64)kb*1024;
+        } else if (starts_with(a, "-memory-budget=")) {
+            String value{ a.data+strlen("-memory-budget="), a.length-(i32)strlen("-memory-budget=") };
+            if (!parse_i32(value, &opts.memory_budget_mb) || opts.memory_budget_mb <= 0) {
+                LOG_ERROR("invalid -memory-budget value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-search-shards=")) {
+            String value{ a.data+strlen("-search-shards="), a.length-(i32)strlen("-search-shards=") };
+            if (!parse_i32(value, &opts.search_shards) || opts.search_shards <= 0) {
+                LOG_ERROR("invalid -search-shards value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+            opts.search = true;
+        } else if (starts_with(a, "-search")) {
+            opts.search = true;
+        } else if (starts_with(a, "-brief-words=")) {
+            String value{ a.data+strlen("-brief-words="), a.length-(i32)strlen("-brief-words=") };
+            if (!parse_i32(value, &opts.brief_max_words)) {
+                LOG_ERROR("invalid -brief-words value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-brief-bytes=")) {
+            String value{ a.data+strlen("-brief-bytes="), a.length-(i32)strlen("-brief-bytes=") };
+            if (!parse_i32(value, &opts.brief_max_bytes)) {
+                LOG_ERROR("invalid -brief-bytes value: '%.*s'", STRFMT(value));
+                return 1;
+            }
         } else {
             LOG_INFO("usage: fsg -output=path");
         }
     }
 
     if (run_mode == 0) {
-        LOG_ERROR("must supply one of generate|server");
+        LOG_ERROR("must supply one of generate|server|daemon");
         return 1;
     }
 
+#if defined(__linux__)
+    // NOTE(jesper): a pack holds everything the server needs, so one generated elsewhere
+    // can be served without the sources
+    if (run_mode == RUN_MODE_SERVER && opts.pack_path.length > 0 && src_dir.length == 0) {
+        return run_server(output, src_dir, opts);
+    }
+#endif
+
     if (output.length == 0) {
         LOG_ERROR("empty output path");
         return 1;
@@ -1168,12 +6888,33 @@ int main(Array<String> args)
     canonicalise_path(output);
     canonicalise_path(src_dir);
 
-    generate_src_dir(output, src_dir, build_drafts);
+    resolve_options(&opts, src_dir);
+
+    if (run_mode == RUN_MODE_DAEMON) return run_daemon(output, src_dir, opts);
 
+    if (use_daemon) {
+        SArena scratch = tl_scratch_arena();
+        StringBuilder request{ .alloc = scratch };
+        append_string(&request, "generate\n");
+        append_daemon_options(&request, output, src_dir, opts);
+        append_report_options(&request, opts);
+
+        i32 result = request_daemon(opts.socket_path, create_string(&request, scratch));
+        if (result != -1) return result;
+
+        LOG_INFO("no daemon listening on '%.*s', generating in-process", STRFMT(opts.socket_path));
+    }
+
+    i32 result = generate_src_dir(output, src_dir, opts);
+
+#if defined(__linux__)
+    if (run_mode == RUN_MODE_SERVER) return run_server(output, src_dir, opts);
+#else
     // if (run_mode == RUN_MODE_SERVER) {
     //     extern void run_server();
     //     run_server();
     // }
+#endif
 
-    return 0;
+    return result;
 }
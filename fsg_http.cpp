@@ -0,0 +1,19 @@
+// NOTE(jesper): the files fsg serves, by extension. Anything else in the output is refused
+// by the servers, left out of packs and not requested by fsg_loadgen
+String http_content_type(String path)
+{
+    if (ends_with(path, ".html")) return "text/html";
+    if (ends_with(path, ".css")) return "text/css";
+    if (ends_with(path, ".js")) return "application/javascript";
+    if (ends_with(path, ".json")) return "application/json";
+    if (ends_with(path, ".xml")) return "application/xml";
+    if (ends_with(path, ".txt")) return "text/plain";
+    if (ends_with(path, ".ttf") || ends_with(path, ".woff") || ends_with(path, ".woff2")) return "application/octet-stream";
+    if (ends_with(path, ".png")) return "image/png";
+    if (ends_with(path, ".jpg") || ends_with(path, ".jpeg")) return "image/jpeg";
+    if (ends_with(path, ".gif")) return "image/gif";
+    if (ends_with(path, ".svg")) return "image/svg+xml";
+    if (ends_with(path, ".webp")) return "image/webp";
+    if (ends_with(path, ".ico")) return "image/x-icon";
+    return {};
+}
@@ -0,0 +1,531 @@
+#include "core/core.h"
+#include "core/string.h"
+#include "core/file.h"
+
+#include <stdio.h>
+#include <math.h>
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+
+// NOTE(jesper): an open-loop load generator for the fsg server. Every connection sends on
+// a fixed schedule derived from the target rate, whether or not the server kept up, and
+// latency is measured from when a request was scheduled rather than when it was sent so
+// that a stalled server can't hide its stalls by slowing the client down
+
+// NOTE(jesper): log-linear histogram in the style of HdrHistogram. Values are bucketed by
+// their power of two, with each power split linearly into HDR_SUB_BUCKETS/2, which bounds
+// the relative error to 2/HDR_SUB_BUCKETS regardless of magnitude
+#define HDR_SUB_BUCKET_BITS 7
+#define HDR_SUB_BUCKETS (1 << HDR_SUB_BUCKET_BITS)
+#define HDR_MAX_EXPONENT 40
+#define HDR_BUCKET_COUNT ((HDR_MAX_EXPONENT+1) * HDR_SUB_BUCKETS)
+
+#define LOADGEN_MAX_CONNECTIONS 4096
+#define LOADGEN_RESPONSE_BUFFER (64*1024)
+
+struct Histogram {
+    u64 counts[HDR_BUCKET_COUNT];
+    u64 total;
+    u64 max;
+};
+
+i32 hdr_bucket_index(u64 value)
+{
+    if (value < HDR_SUB_BUCKETS) return (i32)value;
+
+    i32 exponent = 63 - __builtin_clzll(value) - HDR_SUB_BUCKET_BITS + 1;
+    if (exponent > HDR_MAX_EXPONENT) return HDR_BUCKET_COUNT-1;
+
+    i32 sub_bucket = (i32)(value >> exponent) & (HDR_SUB_BUCKETS-1);
+    return exponent*HDR_SUB_BUCKETS + sub_bucket;
+}
+
+u64 hdr_bucket_value(i32 index)
+{
+    i32 exponent = index / HDR_SUB_BUCKETS;
+    i32 sub_bucket = index % HDR_SUB_BUCKETS;
+    if (exponent == 0) return (u64)sub_bucket;
+
+    // NOTE(jesper): the highest value that maps into the bucket, so percentiles are
+    // reported conservatively
+    return ((u64)sub_bucket << exponent) + ((u64)1 << exponent) - 1;
+}
+
+void hdr_record(Histogram *h, u64 value)
+{
+    h->counts[hdr_bucket_index(value)]++;
+    h->total++;
+    h->max = MAX(h->max, value);
+}
+
+void hdr_merge(Histogram *dst, Histogram *src)
+{
+    for (i32 i = 0; i < HDR_BUCKET_COUNT; i++) dst->counts[i] += src->counts[i];
+    dst->total += src->total;
+    dst->max = MAX(dst->max, src->max);
+}
+
+u64 hdr_percentile(Histogram *h, f64 percentile)
+{
+    if (h->total == 0) return 0;
+
+    u64 target = (u64)ceil(percentile / 100.0 * (f64)h->total);
+    target = MAX(target, 1);
+
+    u64 seen = 0;
+    for (i32 i = 0; i < HDR_BUCKET_COUNT; i++) {
+        seen += h->counts[i];
+        if (seen >= target) return MIN(hdr_bucket_value(i), h->max);
+    }
+
+    return h->max;
+}
+
+enum ConnectionState {
+    CONNECTION_IDLE = 0,
+    CONNECTION_SENDING,
+    CONNECTION_RECEIVING,
+};
+
+struct LoadConnection {
+    int fd;
+    ConnectionState state;
+
+    // NOTE(jesper): the schedule this connection sends on, in ns since the start
+    i64 interval;
+    i64 next_send;
+    i64 scheduled;
+
+    String request;
+    i32 sent;
+
+    char *buffer;
+    i32 received;
+    i32 head_length;
+    i64 content_length;
+    i64 remaining;
+};
+
+struct LoadOptions {
+    i32 port = 8080;
+    i32 connections = 64;
+    i32 threads = 0;
+    f64 rate = 10000;
+    f64 duration = 10;
+};
+
+struct LoadThread {
+    Histogram *histogram;
+    u64 completed;
+    u64 unfinished;
+    u64 errors;
+    u64 bytes;
+};
+
+std::atomic<u64> g_url_cursor{ 0 };
+
+i64 now_ns(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool parse_f64(String str, f64 *out)
+{
+    char sz[64];
+    if (str.length == 0 || str.length >= (i32)sizeof sz) return false;
+    memcpy(sz, str.data, str.length);
+    sz[str.length] = '\0';
+
+    char *end = nullptr;
+    *out = strtod(sz, &end);
+    return end == sz + str.length;
+}
+
+bool parse_i32(String str, i32 *out)
+{
+    f64 value;
+    if (!parse_f64(str, &value) || value != (f64)(i32)value) return false;
+    *out = (i32)value;
+    return true;
+}
+
+#include "fsg_http.cpp"
+
+int connect_to_server(i32 port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((u16)port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    if (connect(fd, (sockaddr*)&addr, sizeof addr) == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// NOTE(jesper): parses the status and Content-Length out of a complete response head
+bool parse_response_head(LoadConnection *conn, i32 *status)
+{
+    String head{ conn->buffer, conn->head_length };
+    if (!starts_with(head, "HTTP/1.1 ") || head.length < 12) return false;
+
+    *status = (head[9]-'0')*100 + (head[10]-'0')*10 + (head[11]-'0');
+    conn->content_length = 0;
+
+    const char *name = "\r\ncontent-length:";
+    i32 name_length = (i32)strlen(name);
+
+    for (i32 i = 0; i + name_length <= head.length; i++) {
+        bool match = true;
+        for (i32 j = 0; j < name_length && match; j++) {
+            char c = head[i+j];
+            if (c >= 'A' && c <= 'Z') c = c - 'A' + 'a';
+            match = c == name[j];
+        }
+
+        if (match) {
+            i32 at = i + name_length;
+            while (at < head.length && head[at] == ' ') at++;
+            while (at < head.length && is_number(head[at])) {
+                conn->content_length = conn->content_length*10 + (head[at++]-'0');
+            }
+            break;
+        }
+    }
+
+    return true;
+}
+
+// NOTE(jesper): a closed connection is only reopened when it's next due to send, so a
+// server that refuses connections costs one attempt per scheduled request rather than a
+// busy loop of reconnects
+void close_connection(LoadConnection *conn, int epoll_fd)
+{
+    if (conn->fd != -1) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+    }
+
+    conn->fd = -1;
+    conn->state = CONNECTION_IDLE;
+    conn->received = 0;
+    conn->head_length = 0;
+}
+
+bool open_connection(LoadConnection *conn, int epoll_fd, i32 port)
+{
+    conn->fd = connect_to_server(port);
+    if (conn->fd == -1) return false;
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = conn;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, conn->fd, &event);
+    return true;
+}
+
+void load_thread(LoadThread *thread, Array<String> requests, LoadOptions opts, i32 connection_count, std::chrono::steady_clock::time_point start)
+{
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    defer { close(epoll_fd); };
+
+    i64 end = (i64)(opts.duration * 1e9);
+    i64 interval = (i64)(1e9 / (opts.rate / opts.connections));
+
+    LoadConnection *connections = (LoadConnection*)calloc(connection_count, sizeof *connections);
+    defer { free(connections); };
+
+    for (i32 i = 0; i < connection_count; i++) {
+        LoadConnection *conn = &connections[i];
+        conn->fd = -1;
+        conn->interval = interval;
+        // NOTE(jesper): spread the first sends so the connections don't fire in lockstep
+        conn->next_send = interval * i / MAX(connection_count, 1);
+        conn->buffer = (char*)malloc(LOADGEN_RESPONSE_BUFFER);
+        open_connection(conn, epoll_fd, opts.port);
+    }
+
+    epoll_event events[256];
+    while (true) {
+        i64 now = now_ns(start);
+
+        // NOTE(jesper): requests still in flight at the end, and those that were due but
+        // not sent because their connection was still busy, took at least until the end of
+        // the run. They're recorded as such, otherwise a server that stalls towards the end
+        // of the run gets its slowest requests dropped
+        if (now >= end) {
+            for (i32 i = 0; i < connection_count; i++) {
+                LoadConnection *conn = &connections[i];
+                if (conn->state != CONNECTION_IDLE) {
+                    hdr_record(thread->histogram, (u64)((end - conn->scheduled) / 1000));
+                    thread->unfinished++;
+                }
+
+                for (i64 scheduled = conn->next_send; scheduled < end; scheduled += conn->interval) {
+                    hdr_record(thread->histogram, (u64)((end - scheduled) / 1000));
+                    thread->unfinished++;
+                }
+            }
+            break;
+        }
+
+        i64 wake = end;
+        for (i32 i = 0; i < connection_count; i++) {
+            LoadConnection *conn = &connections[i];
+            if (conn->state != CONNECTION_IDLE) continue;
+
+            if (conn->next_send > now) {
+                wake = MIN(wake, conn->next_send);
+                continue;
+            }
+
+            conn->scheduled = conn->next_send;
+            conn->next_send += conn->interval;
+
+            if (conn->fd == -1 && !open_connection(conn, epoll_fd, opts.port)) {
+                thread->errors++;
+                wake = MIN(wake, conn->next_send);
+                continue;
+            }
+
+            conn->request = requests[(i32)(g_url_cursor.fetch_add(1, std::memory_order_relaxed) % requests.count)];
+            conn->sent = 0;
+            conn->state = CONNECTION_SENDING;
+
+            ssize_t written = send(conn->fd, conn->request.data, conn->request.length, MSG_NOSIGNAL);
+            if (written > 0) conn->sent = (i32)written;
+            if (written == -1 && errno != EAGAIN) {
+                thread->errors++;
+                close_connection(conn, epoll_fd);
+                continue;
+            }
+
+            if (conn->sent == conn->request.length) {
+                conn->state = CONNECTION_RECEIVING;
+            } else {
+                epoll_event event{};
+                event.events = EPOLLIN | EPOLLOUT;
+                event.data.ptr = conn;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+            }
+        }
+
+        i64 timeout_ms = MAX((wake - now_ns(start)) / 1000000, 0);
+        int count = epoll_wait(epoll_fd, events, 256, (int)MIN(timeout_ms, 100));
+
+        for (i32 i = 0; i < count; i++) {
+            LoadConnection *conn = (LoadConnection*)events[i].data.ptr;
+            if (conn->fd == -1) continue;
+
+            if (conn->state == CONNECTION_SENDING && events[i].events & EPOLLOUT) {
+                ssize_t written = send(conn->fd, conn->request.data+conn->sent, conn->request.length-conn->sent, MSG_NOSIGNAL);
+                if (written > 0) conn->sent += (i32)written;
+
+                if (conn->sent == conn->request.length) {
+                    conn->state = CONNECTION_RECEIVING;
+
+                    epoll_event event{};
+                    event.events = EPOLLIN;
+                    event.data.ptr = conn;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+                }
+            }
+
+            if (!(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))) continue;
+
+            while (true) {
+                if (conn->received == LOADGEN_RESPONSE_BUFFER) {
+                    LOG_ERROR("response head exceeds %d bytes", LOADGEN_RESPONSE_BUFFER);
+                    thread->errors++;
+                    close_connection(conn, epoll_fd);
+                    break;
+                }
+
+                ssize_t received = recv(conn->fd, conn->buffer+conn->received, LOADGEN_RESPONSE_BUFFER-conn->received, 0);
+                if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+                if (received <= 0) {
+                    if (conn->state != CONNECTION_IDLE) thread->errors++;
+                    close_connection(conn, epoll_fd);
+                    break;
+                }
+
+                thread->bytes += received;
+                conn->received += (i32)received;
+
+                if (conn->head_length == 0) {
+                    for (i32 j = 3; j < conn->received; j++) {
+                        if (conn->buffer[j-3] == '\r' && conn->buffer[j-2] == '\n' &&
+                            conn->buffer[j-1] == '\r' && conn->buffer[j] == '\n')
+                        {
+                            conn->head_length = j+1;
+                            break;
+                        }
+                    }
+
+                    if (conn->head_length == 0) continue;
+
+                    i32 status = 0;
+                    if (!parse_response_head(conn, &status) || status != 200) thread->errors++;
+                    conn->remaining = conn->head_length + conn->content_length - conn->received;
+                } else {
+                    conn->remaining -= received;
+                }
+
+                // NOTE(jesper): the body is only counted, so it's discarded as it arrives
+                conn->received = conn->head_length;
+                if (conn->remaining > 0) continue;
+
+                hdr_record(thread->histogram, (u64)((now_ns(start) - conn->scheduled) / 1000));
+                thread->completed++;
+
+                conn->state = CONNECTION_IDLE;
+                conn->received = 0;
+                conn->head_length = 0;
+                break;
+            }
+        }
+    }
+
+    for (i32 i = 0; i < connection_count; i++) {
+        if (connections[i].fd != -1) close(connections[i].fd);
+        free(connections[i].buffer);
+    }
+}
+
+int main(Array<String> args)
+{
+    LoadOptions opts{};
+    String output{};
+
+    for (i32 i = 0; i < args.count; i++) {
+        String a = args[i];
+        if (starts_with(a, "-output=")) {
+            output = { a.data+strlen("-output="), a.length-(i32)strlen("-output=") };
+        } else if (starts_with(a, "-port=")) {
+            String value{ a.data+strlen("-port="), a.length-(i32)strlen("-port=") };
+            if (!parse_i32(value, &opts.port) || opts.port <= 0 || opts.port > 65535) {
+                LOG_ERROR("invalid -port value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-connections=")) {
+            String value{ a.data+strlen("-connections="), a.length-(i32)strlen("-connections=") };
+            if (!parse_i32(value, &opts.connections) || opts.connections <= 0 || opts.connections > LOADGEN_MAX_CONNECTIONS) {
+                LOG_ERROR("invalid -connections value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-threads=")) {
+            String value{ a.data+strlen("-threads="), a.length-(i32)strlen("-threads=") };
+            if (!parse_i32(value, &opts.threads) || opts.threads <= 0) {
+                LOG_ERROR("invalid -threads value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-rate=")) {
+            String value{ a.data+strlen("-rate="), a.length-(i32)strlen("-rate=") };
+            if (!parse_f64(value, &opts.rate) || opts.rate <= 0) {
+                LOG_ERROR("invalid -rate value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        } else if (starts_with(a, "-duration=")) {
+            String value{ a.data+strlen("-duration="), a.length-(i32)strlen("-duration=") };
+            if (!parse_f64(value, &opts.duration) || opts.duration <= 0) {
+                LOG_ERROR("invalid -duration value: '%.*s'", STRFMT(value));
+                return 1;
+            }
+        }
+    }
+
+    if (output.length == 0) {
+        LOG_INFO("usage: fsg_loadgen -output=path [-port=N] [-connections=N] [-threads=N] [-rate=requests/s] [-duration=seconds]");
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    // NOTE(jesper): the url mix is every servable file in the generated site, requested
+    // round robin across all connections
+    DynamicArray<String> requests{};
+    DynamicArray<String> files = list_files(output, mem_dynamic, FILE_LIST_RECURSIVE);
+    for (String p : files) {
+        String url{ p.data+output.length, p.length-output.length };
+        if (http_content_type(url).length == 0) continue;
+
+        StringBuilder sb{ .alloc = mem_dynamic };
+        append_string(&sb, "GET ");
+        for (i32 i = 0; i < url.length; i++) append_char(&sb, url[i] == '\\' ? '/' : url[i]);
+        append_string(&sb, " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        array_add(&requests, create_string(&sb, mem_dynamic));
+    }
+
+    if (requests.count == 0) {
+        LOG_ERROR("no servable files found in '%.*s'", STRFMT(output));
+        return 1;
+    }
+
+    i32 thread_count = opts.threads > 0 ? opts.threads : MAX((i32)std::thread::hardware_concurrency(), 1);
+    thread_count = MIN(thread_count, opts.connections);
+
+    LOG_INFO("%d urls, %d connections on %d threads, %.0f requests/s for %.1fs",
+             requests.count, opts.connections, thread_count, opts.rate, opts.duration);
+
+    LoadThread *threads = (LoadThread*)calloc(thread_count, sizeof *threads);
+    std::thread **handles = (std::thread**)calloc(thread_count, sizeof *handles);
+
+    // NOTE(jesper): each thread gets a share of the connections and of the rate, so every
+    // connection sends at the same interval
+    auto start = std::chrono::steady_clock::now();
+    for (i32 i = 0; i < thread_count; i++) {
+        i32 connection_count = opts.connections / thread_count + (i < opts.connections % thread_count ? 1 : 0);
+
+        LoadOptions thread_opts = opts;
+        thread_opts.rate = opts.rate * connection_count / opts.connections;
+        thread_opts.connections = connection_count;
+
+        threads[i].histogram = (Histogram*)calloc(1, sizeof(Histogram));
+        handles[i] = new std::thread(load_thread, &threads[i], (Array<String>)requests, thread_opts, connection_count, start);
+    }
+
+    Histogram *total = (Histogram*)calloc(1, sizeof(Histogram));
+    u64 completed = 0, unfinished = 0, errors = 0, bytes = 0;
+
+    for (i32 i = 0; i < thread_count; i++) {
+        handles[i]->join();
+        hdr_merge(total, threads[i].histogram);
+        completed += threads[i].completed;
+        unfinished += threads[i].unfinished;
+        errors += threads[i].errors;
+        bytes += threads[i].bytes;
+    }
+
+    f64 elapsed = std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+
+    LOG_INFO("requests:   %llu in %.2fs, %llu unfinished, %llu errors",
+             (unsigned long long)completed, elapsed, (unsigned long long)unfinished, (unsigned long long)errors);
+    LOG_INFO("throughput: %.0f requests/s, %.2f MB/s", completed / elapsed, bytes / elapsed / (1024.0*1024.0));
+    LOG_INFO("latency:    p50 %.3fms, p99 %.3fms, p999 %.3fms, max %.3fms",
+             hdr_percentile(total, 50.0) / 1000.0,
+             hdr_percentile(total, 99.0) / 1000.0,
+             hdr_percentile(total, 99.9) / 1000.0,
+             total->max / 1000.0);
+
+    return errors > 0 ? 1 : 0;
+}
@@ -0,0 +1,1003 @@
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+
+struct FsgResponse {
+    String url;
+    String etag;
+
+    // NOTE(jesper): served from memory, or when the snapshot is a pack, sent from the pack
+    // file at body_offset
+    String body;
+    i64 body_offset;
+
+    // NOTE(jesper): the status line and headers, indexed by whether the connection is kept
+    // alive, built once along with the snapshot
+    String head[2];
+    String not_modified[2];
+};
+
+// NOTE(jesper): every file in the output with its response prebuilt, sorted by url. It's
+// immutable once built, which is what lets the workers share it without any locking
+struct FsgSnapshot {
+    FsgResponse *responses;
+    i32 count;
+
+    // NOTE(jesper): the mapped pack the urls point into, pack_fd is -1 when serving the
+    // output directory
+    int pack_fd;
+    u8 *pack_data;
+    u64 pack_size;
+    dev_t pack_dev;
+    ino_t pack_ino;
+
+    // NOTE(jesper): connections with a response from this snapshot still being written. A
+    // snapshot that was replaced is destroyed once it drops to 0, see reload_pack
+    std::atomic<i32> users;
+};
+
+// NOTE(jesper): requests are counted by a coarse route rather than by url, to keep the
+// number of series bounded regardless of the size of the site
+enum FsgRoute {
+    FSG_ROUTE_INDEX = 0,
+    FSG_ROUTE_PAGES,
+    FSG_ROUTE_POSTS,
+    FSG_ROUTE_TAGS,
+    FSG_ROUTE_SEARCH,
+    FSG_ROUTE_ASSETS,
+    FSG_ROUTE_METRICS,
+    FSG_ROUTE_OTHER,
+    FSG_ROUTE_COUNT,
+};
+
+const char *route_names[] = { "index", "pages", "posts", "tags", "search", "assets", "metrics", "other" };
+static_assert(sizeof route_names / sizeof route_names[0] == FSG_ROUTE_COUNT);
+
+// NOTE(jesper): the status codes the server answers with, anything else is counted as the
+// last, which should stay at 0
+const i32 metric_status_codes[] = { 200, 304, 400, 403, 404, 405, 413, 414, 431, 501, 505, 0 };
+#define FSG_METRIC_STATUS_COUNT (i32)(sizeof metric_status_codes / sizeof metric_status_codes[0])
+
+// NOTE(jesper): upper bounds of the latency buckets in nanoseconds, followed by +Inf
+const u64 latency_buckets_ns[] = {
+    25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 25000000,
+    50000000, 100000000, 250000000, 1000000000,
+};
+#define FSG_LATENCY_BUCKET_COUNT (i32)(sizeof latency_buckets_ns / sizeof latency_buckets_ns[0] + 1)
+
+// NOTE(jesper): each worker owns one of these and is the only one writing to it, so a
+// counter is bumped with a relaxed load and store rather than a locked read-modify-write,
+// and no cache line is shared between workers. The metrics endpoint sums them up, reading
+// with relaxed loads, which may see one worker a request ahead of another but never a
+// torn value
+struct alignas(64) FsgWorkerMetrics {
+    std::atomic<u64> requests[FSG_ROUTE_COUNT][FSG_METRIC_STATUS_COUNT];
+    std::atomic<u64> bytes_sent[FSG_ROUTE_COUNT];
+    std::atomic<u64> latency[FSG_ROUTE_COUNT][FSG_LATENCY_BUCKET_COUNT];
+    std::atomic<u64> latency_sum_ns[FSG_ROUTE_COUNT];
+
+    std::atomic<u64> connections_opened;
+    std::atomic<u64> connections_closed;
+
+    std::atomic<u64> snapshot_hits;
+    std::atomic<u64> snapshot_misses;
+};
+
+struct FsgServer {
+    std::atomic<FsgSnapshot*> snapshot;
+    i32 port;
+
+    FsgWorkerMetrics *metrics;
+    i32 worker_count;
+
+    // NOTE(jesper): the snapshot each worker is in the middle of acquiring, indexed like
+    // metrics, see acquire_snapshot
+    std::atomic<FsgSnapshot*> *snapshot_hazards;
+
+    // NOTE(jesper): the snapshot is the server's response cache, built on startup from the
+    // generated output or the pack, and again whenever the pack is replaced. Only the
+    // thread that builds them writes these
+    std::atomic<u64> snapshot_builds;
+    std::atomic<u64> snapshot_build_ns;
+    std::atomic<i32> snapshot_entries;
+
+    // NOTE(jesper): the identity of the pack file last looked at, see reload_pack
+    dev_t pack_dev;
+    ino_t pack_ino;
+};
+
+// NOTE(jesper): this worker's slot in server->snapshot_hazards
+thread_local std::atomic<FsgSnapshot*> *tl_snapshot_hazard;
+
+struct LinuxConnection {
+    int fd;
+    bool want_write;
+    bool close_after_write;
+
+    char buffer[HTTP_MAX_HEAD_SIZE + HTTP_MAX_BODY_SIZE];
+    i32 buffered;
+    HttpParser parser;
+
+    // NOTE(jesper): the response being written, pointing into the snapshot or at error,
+    // followed by file_remain bytes of the pack from file_offset. The snapshot is held
+    // until the response has been written
+    FsgSnapshot *snapshot;
+    iovec iov[2];
+    i32 iov_count;
+    char error[512];
+
+    int file_fd;
+    off_t file_offset;
+    u64 file_remain;
+
+    // NOTE(jesper): the response being written, recorded in the worker's metrics once it's
+    // been written in full. The latency is measured from when the request was parsed
+    bool tracking;
+    FsgRoute route;
+    i32 status;
+    u64 response_bytes;
+    u64 request_start_ns;
+
+    // NOTE(jesper): the body of a metrics response, owned by the connection
+    String metrics_body;
+};
+
+u64 metrics_now_ns()
+{
+    return (u64)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void metric_add(std::atomic<u64> *counter, u64 value)
+{
+    counter->store(counter->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+u64 metric_sum(FsgServer *server, std::atomic<u64> FsgWorkerMetrics::*counter)
+{
+    u64 sum = 0;
+    for (i32 i = 0; i < server->worker_count; i++) {
+        sum += (server->metrics[i].*counter).load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+FsgRoute url_route(String url)
+{
+    if (url == "/index.html") return FSG_ROUTE_INDEX;
+    if (url == "/__fsg/metrics") return FSG_ROUTE_METRICS;
+    if (starts_with(url, "/posts/tag/")) return FSG_ROUTE_TAGS;
+    if (starts_with(url, "/posts/")) return FSG_ROUTE_POSTS;
+    if (starts_with(url, "/search/")) return FSG_ROUTE_SEARCH;
+    if (ends_with(url, ".html")) return FSG_ROUTE_PAGES;
+    if (http_content_type(url).length > 0) return FSG_ROUTE_ASSETS;
+    return FSG_ROUTE_OTHER;
+}
+
+void record_response(FsgWorkerMetrics *metrics, LinuxConnection *conn)
+{
+    conn->tracking = false;
+
+    i32 status_index = FSG_METRIC_STATUS_COUNT-1;
+    for (i32 i = 0; i < FSG_METRIC_STATUS_COUNT-1; i++) {
+        if (metric_status_codes[i] == conn->status) status_index = i;
+    }
+
+    u64 latency_ns = metrics_now_ns() - conn->request_start_ns;
+
+    i32 bucket = 0;
+    while (bucket < FSG_LATENCY_BUCKET_COUNT-1 && latency_ns > latency_buckets_ns[bucket]) bucket++;
+
+    metric_add(&metrics->requests[conn->route][status_index], 1);
+    metric_add(&metrics->bytes_sent[conn->route], conn->response_bytes);
+    metric_add(&metrics->latency[conn->route][bucket], 1);
+    metric_add(&metrics->latency_sum_ns[conn->route], latency_ns);
+}
+
+// NOTE(jesper): the Prometheus text exposition format
+String build_metrics(FsgServer *server, Allocator mem)
+{
+    SArena scratch = tl_scratch_arena(mem);
+    StringBuilder sb{ .alloc = scratch };
+
+    u64 requests[FSG_ROUTE_COUNT][FSG_METRIC_STATUS_COUNT]{};
+    u64 bytes_sent[FSG_ROUTE_COUNT]{};
+    u64 latency[FSG_ROUTE_COUNT][FSG_LATENCY_BUCKET_COUNT]{};
+    u64 latency_sum_ns[FSG_ROUTE_COUNT]{};
+
+    for (i32 w = 0; w < server->worker_count; w++) {
+        FsgWorkerMetrics &metrics = server->metrics[w];
+
+        for (i32 r = 0; r < FSG_ROUTE_COUNT; r++) {
+            for (i32 s = 0; s < FSG_METRIC_STATUS_COUNT; s++) {
+                requests[r][s] += metrics.requests[r][s].load(std::memory_order_relaxed);
+            }
+            for (i32 b = 0; b < FSG_LATENCY_BUCKET_COUNT; b++) {
+                latency[r][b] += metrics.latency[r][b].load(std::memory_order_relaxed);
+            }
+
+            bytes_sent[r] += metrics.bytes_sent[r].load(std::memory_order_relaxed);
+            latency_sum_ns[r] += metrics.latency_sum_ns[r].load(std::memory_order_relaxed);
+        }
+    }
+
+    append_string(&sb, "# HELP fsg_http_requests_total Requests answered, by route and status code.\n");
+    append_string(&sb, "# TYPE fsg_http_requests_total counter\n");
+    for (i32 r = 0; r < FSG_ROUTE_COUNT; r++) {
+        for (i32 s = 0; s < FSG_METRIC_STATUS_COUNT; s++) {
+            if (requests[r][s] == 0) continue;
+
+            if (metric_status_codes[s] == 0) {
+                append_stringf(&sb, "fsg_http_requests_total{route=\"%s\",code=\"other\"} %llu\n",
+                               route_names[r], (unsigned long long)requests[r][s]);
+            } else {
+                append_stringf(&sb, "fsg_http_requests_total{route=\"%s\",code=\"%d\"} %llu\n",
+                               route_names[r], metric_status_codes[s], (unsigned long long)requests[r][s]);
+            }
+        }
+    }
+
+    append_string(&sb, "# HELP fsg_http_response_bytes_total Bytes of responses written, heads included.\n");
+    append_string(&sb, "# TYPE fsg_http_response_bytes_total counter\n");
+    for (i32 r = 0; r < FSG_ROUTE_COUNT; r++) {
+        append_stringf(&sb, "fsg_http_response_bytes_total{route=\"%s\"} %llu\n",
+                       route_names[r], (unsigned long long)bytes_sent[r]);
+    }
+
+    append_string(&sb, "# HELP fsg_http_request_duration_seconds Time from a request being parsed to its response being written.\n");
+    append_string(&sb, "# TYPE fsg_http_request_duration_seconds histogram\n");
+    for (i32 r = 0; r < FSG_ROUTE_COUNT; r++) {
+        u64 count = 0;
+        for (i32 b = 0; b < FSG_LATENCY_BUCKET_COUNT; b++) {
+            count += latency[r][b];
+
+            if (b < FSG_LATENCY_BUCKET_COUNT-1) {
+                append_stringf(&sb, "fsg_http_request_duration_seconds_bucket{route=\"%s\",le=\"%g\"} %llu\n",
+                               route_names[r], latency_buckets_ns[b]*1e-9, (unsigned long long)count);
+            } else {
+                append_stringf(&sb, "fsg_http_request_duration_seconds_bucket{route=\"%s\",le=\"+Inf\"} %llu\n",
+                               route_names[r], (unsigned long long)count);
+            }
+        }
+
+        append_stringf(&sb, "fsg_http_request_duration_seconds_sum{route=\"%s\"} %.9f\n", route_names[r], latency_sum_ns[r]*1e-9);
+        append_stringf(&sb, "fsg_http_request_duration_seconds_count{route=\"%s\"} %llu\n", route_names[r], (unsigned long long)count);
+    }
+
+    u64 opened = metric_sum(server, &FsgWorkerMetrics::connections_opened);
+    u64 closed = metric_sum(server, &FsgWorkerMetrics::connections_closed);
+
+    append_string(&sb, "# HELP fsg_http_active_connections Connections currently open.\n");
+    append_string(&sb, "# TYPE fsg_http_active_connections gauge\n");
+    append_stringf(&sb, "fsg_http_active_connections %lld\n", (long long)(opened - closed));
+
+    append_string(&sb, "# HELP fsg_http_connections_total Connections accepted.\n");
+    append_string(&sb, "# TYPE fsg_http_connections_total counter\n");
+    append_stringf(&sb, "fsg_http_connections_total %llu\n", (unsigned long long)opened);
+
+    append_string(&sb, "# HELP fsg_response_cache_hits_total Requests answered from the prebuilt responses.\n");
+    append_string(&sb, "# TYPE fsg_response_cache_hits_total counter\n");
+    append_stringf(&sb, "fsg_response_cache_hits_total %llu\n",
+                   (unsigned long long)metric_sum(server, &FsgWorkerMetrics::snapshot_hits));
+
+    append_string(&sb, "# HELP fsg_response_cache_misses_total Requests for urls without a prebuilt response.\n");
+    append_string(&sb, "# TYPE fsg_response_cache_misses_total counter\n");
+    append_stringf(&sb, "fsg_response_cache_misses_total %llu\n",
+                   (unsigned long long)metric_sum(server, &FsgWorkerMetrics::snapshot_misses));
+
+    append_string(&sb, "# HELP fsg_response_cache_entries Prebuilt responses.\n");
+    append_string(&sb, "# TYPE fsg_response_cache_entries gauge\n");
+    append_stringf(&sb, "fsg_response_cache_entries %d\n", server->snapshot_entries.load(std::memory_order_relaxed));
+
+    append_string(&sb, "# HELP fsg_regenerations_total Builds of the prebuilt responses.\n");
+    append_string(&sb, "# TYPE fsg_regenerations_total counter\n");
+    append_stringf(&sb, "fsg_regenerations_total %llu\n", (unsigned long long)server->snapshot_builds.load(std::memory_order_relaxed));
+
+    append_string(&sb, "# HELP fsg_regeneration_duration_seconds_total Time spent building the prebuilt responses.\n");
+    append_string(&sb, "# TYPE fsg_regeneration_duration_seconds_total counter\n");
+    append_stringf(&sb, "fsg_regeneration_duration_seconds_total %.9f\n", server->snapshot_build_ns.load(std::memory_order_relaxed)*1e-9);
+
+    return create_string(&sb, mem);
+}
+
+String build_response_head(i32 code, String content_type, i64 content_length, String etag, bool immutable, bool keep_alive)
+{
+    SArena scratch = tl_scratch_arena();
+    StringBuilder sb{ .alloc = scratch };
+
+    append_stringf(&sb, "HTTP/1.1 %d %.*s\r\n", code, STRFMT(http_status_str(code)));
+
+    // NOTE(jesper): a 304 has no body, nor any headers describing one
+    if (code != 304) {
+        if (starts_with(content_type, "text") || content_type == "application/javascript") {
+            append_stringf(&sb, "Content-Type: %.*s;charset=UTF-8\r\n", STRFMT(content_type));
+        } else {
+            append_stringf(&sb, "Content-Type: %.*s\r\n", STRFMT(content_type));
+        }
+
+        append_stringf(&sb, "Content-Length: %lld\r\n", (long long)content_length);
+    }
+
+    append_stringf(&sb, "ETag: %.*s\r\n", STRFMT(etag));
+    if (immutable) append_string(&sb, "Cache-Control: " FSG_IMMUTABLE_CACHE_CONTROL "\r\n");
+
+    append_string(&sb, "Server: FSG\r\n");
+    append_string(&sb, keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n");
+    append_string(&sb, "\r\n");
+
+    return create_string(&sb, mem_dynamic);
+}
+
+void build_response_heads(FsgResponse *response, String content_type, i64 content_length, u64 hash, bool immutable)
+{
+    response->etag = stringf(mem_dynamic, "\"%016llx\"", (unsigned long long)hash);
+
+    for (i32 keep_alive = 0; keep_alive < 2; keep_alive++) {
+        response->head[keep_alive] = build_response_head(200, content_type, content_length, response->etag, immutable, keep_alive);
+        response->not_modified[keep_alive] = build_response_head(304, content_type, content_length, response->etag, immutable, keep_alive);
+    }
+}
+
+int compare_responses(const void *lhs, const void *rhs)
+{
+    FsgResponse *a = (FsgResponse*)lhs;
+    FsgResponse *b = (FsgResponse*)rhs;
+    return a->url < b->url ? -1 : b->url < a->url ? 1 : 0;
+}
+
+FsgSnapshot* create_snapshot(String output)
+{
+    SArena scratch = tl_scratch_arena();
+
+    DynamicArray<String> files = list_files(output, scratch, FILE_LIST_RECURSIVE);
+
+    FsgSnapshot *snapshot = (FsgSnapshot*)calloc(1, sizeof *snapshot);
+    snapshot->responses = (FsgResponse*)calloc(MAX(files.count, 1), sizeof *snapshot->responses);
+    snapshot->pack_fd = -1;
+
+    for (String p : files) {
+        String url = asset_url(output, p, mem_dynamic);
+
+        String content_type = http_content_type(url);
+        if (content_type.length == 0) {
+            destroy_string(url);
+            continue;
+        }
+
+        FileInfo contents = read_file(p, mem_dynamic);
+        if (!contents.data) {
+            LOG_ERROR("failed reading %.*s", STRFMT(p));
+            destroy_string(url);
+            continue;
+        }
+
+        FsgResponse response{};
+        response.url = url;
+        response.body = String{ (char*)contents.data, contents.size };
+        build_response_heads(&response, content_type, contents.size, hash_bytes(contents.data, contents.size), is_fingerprinted_path(url));
+
+        snapshot->responses[snapshot->count++] = response;
+    }
+
+    qsort(snapshot->responses, snapshot->count, sizeof *snapshot->responses, compare_responses);
+    return snapshot;
+}
+
+bool is_valid_pack(u8 *data, u64 size)
+{
+    if (size < sizeof(FsgPackHeader)) return false;
+
+    FsgPackHeader *header = (FsgPackHeader*)data;
+    if (memcmp(header->magic, FSG_PACK_MAGIC, sizeof header->magic) != 0) return false;
+    if (header->version != FSG_PACK_VERSION) return false;
+
+    u64 entries_end = sizeof *header + (u64)header->entry_count*sizeof(FsgPackEntry);
+    if (entries_end > size || header->strings_offset < entries_end) return false;
+    if (header->strings_offset > size || header->strings_size > size - header->strings_offset) return false;
+
+    FsgPackEntry *entries = (FsgPackEntry*)(data + sizeof *header);
+    for (u32 i = 0; i < header->entry_count; i++) {
+        FsgPackEntry &entry = entries[i];
+        if ((u64)entry.url_offset + entry.url_length > header->strings_size) return false;
+        if ((u64)entry.content_type_offset + entry.content_type_length > header->strings_size) return false;
+        if (entry.body_offset > size || entry.body_size > size - entry.body_offset) return false;
+    }
+
+    return true;
+}
+
+// NOTE(jesper): maps the pack rather than reading it, the urls point straight into the
+// mapping and the bodies are never read by the server at all, they're sent from the file
+FsgSnapshot* create_pack_snapshot(String pack_path)
+{
+    char sz_path[4096];
+    snprintf(sz_path, sizeof sz_path, "%.*s", STRFMT(pack_path));
+
+    int fd = open(sz_path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        LOG_ERROR("failed opening pack '%s': %s", sz_path, strerror(errno));
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        LOG_ERROR("invalid pack '%s'", sz_path);
+        close(fd);
+        return nullptr;
+    }
+
+    u64 size = (u64)st.st_size;
+    u8 *data = (u8*)mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("failed mapping pack '%s': %s", sz_path, strerror(errno));
+        close(fd);
+        return nullptr;
+    }
+
+    if (!is_valid_pack(data, size)) {
+        LOG_ERROR("invalid pack '%s'", sz_path);
+        munmap(data, size);
+        close(fd);
+        return nullptr;
+    }
+
+    FsgPackHeader *header = (FsgPackHeader*)data;
+    FsgPackEntry *entries = (FsgPackEntry*)(data + sizeof *header);
+    char *strings = (char*)data + header->strings_offset;
+
+    FsgSnapshot *snapshot = (FsgSnapshot*)calloc(1, sizeof *snapshot);
+    snapshot->responses = (FsgResponse*)calloc(MAX(header->entry_count, 1), sizeof *snapshot->responses);
+    snapshot->pack_fd = fd;
+    snapshot->pack_data = data;
+    snapshot->pack_size = size;
+    snapshot->pack_dev = st.st_dev;
+    snapshot->pack_ino = st.st_ino;
+
+    for (u32 i = 0; i < header->entry_count; i++) {
+        FsgPackEntry &entry = entries[i];
+
+        FsgResponse response{};
+        response.url = String{ strings+entry.url_offset, (i32)entry.url_length };
+        response.body_offset = entry.body_offset;
+        response.body.length = (i32)entry.body_size;
+
+        String content_type{ strings+entry.content_type_offset, (i32)entry.content_type_length };
+        build_response_heads(&response, content_type, entry.body_size, entry.etag, entry.flags & FSG_PACK_IMMUTABLE);
+
+        snapshot->responses[snapshot->count++] = response;
+    }
+
+    qsort(snapshot->responses, snapshot->count, sizeof *snapshot->responses, compare_responses);
+    return snapshot;
+}
+
+void destroy_snapshot(FsgSnapshot *snapshot)
+{
+    for (i32 i = 0; i < snapshot->count; i++) {
+        FsgResponse &response = snapshot->responses[i];
+        destroy_string(response.etag);
+        for (i32 keep_alive = 0; keep_alive < 2; keep_alive++) {
+            destroy_string(response.head[keep_alive]);
+            destroy_string(response.not_modified[keep_alive]);
+        }
+
+        // NOTE(jesper): the urls and bodies of a pack point into the mapping
+        if (snapshot->pack_fd == -1) {
+            destroy_string(response.url);
+            destroy_string(response.body);
+        }
+    }
+
+    if (snapshot->pack_fd != -1) {
+        munmap(snapshot->pack_data, snapshot->pack_size);
+        close(snapshot->pack_fd);
+    }
+
+    free(snapshot->responses);
+    free(snapshot);
+}
+
+// NOTE(jesper): the snapshot is published in the worker's hazard slot before it's counted
+// as used, and only counted if it's still the server's current one by then, so a replaced
+// snapshot is never destroyed between a worker loading it and counting itself as a user
+FsgSnapshot* acquire_snapshot(FsgServer *server)
+{
+    FsgSnapshot *snapshot;
+    do {
+        snapshot = server->snapshot.load();
+        tl_snapshot_hazard->store(snapshot);
+    } while (server->snapshot.load() != snapshot);
+
+    snapshot->users.fetch_add(1);
+    tl_snapshot_hazard->store(nullptr);
+    return snapshot;
+}
+
+void release_snapshot(LinuxConnection *conn)
+{
+    if (conn->snapshot) conn->snapshot->users.fetch_sub(1);
+    conn->snapshot = nullptr;
+}
+
+// NOTE(jesper): write_pack renames a new pack over the old one, so a pack was rebuilt
+// when the file at the path is no longer the one last looked at. The snapshot it replaces
+// is destroyed once no connection uses it and no worker is acquiring it
+void reload_pack(FsgServer *server, String pack_path, DynamicArray<FsgSnapshot*> *retired)
+{
+    char sz_path[4096];
+    snprintf(sz_path, sizeof sz_path, "%.*s", STRFMT(pack_path));
+
+    struct stat st;
+    if (stat(sz_path, &st) == 0 && (st.st_dev != server->pack_dev || st.st_ino != server->pack_ino)) {
+        server->pack_dev = st.st_dev;
+        server->pack_ino = st.st_ino;
+
+        u64 build_start = metrics_now_ns();
+        FsgSnapshot *snapshot = create_pack_snapshot(pack_path);
+        if (snapshot) {
+            array_add(retired, server->snapshot.exchange(snapshot));
+            server->snapshot_entries.store(snapshot->count, std::memory_order_relaxed);
+            metric_add(&server->snapshot_builds, 1);
+            metric_add(&server->snapshot_build_ns, metrics_now_ns() - build_start);
+            LOG_INFO("serving %d files from rebuilt pack '%.*s'", snapshot->count, STRFMT(pack_path));
+        }
+    }
+
+    i32 kept = 0;
+    for (FsgSnapshot *snapshot : *retired) {
+        bool in_use = snapshot->users.load() > 0;
+        for (i32 i = 0; i < server->worker_count && !in_use; i++) {
+            in_use = server->snapshot_hazards[i].load() == snapshot;
+        }
+
+        if (in_use) retired->data[kept++] = snapshot;
+        else destroy_snapshot(snapshot);
+    }
+    retired->count = kept;
+}
+
+FsgResponse* find_response(FsgSnapshot *snapshot, String url)
+{
+    i32 lo = 0, hi = snapshot->count;
+    while (lo < hi) {
+        i32 mid = lo + (hi-lo)/2;
+        if (snapshot->responses[mid].url < url) lo = mid+1;
+        else hi = mid;
+    }
+
+    if (lo < snapshot->count && snapshot->responses[lo].url == url) return &snapshot->responses[lo];
+    return nullptr;
+}
+
+void prepare_error(LinuxConnection *conn, i32 code, bool keep_alive)
+{
+    String status = http_status_str(code);
+
+    char body[256];
+    i32 body_length = snprintf(
+        body, sizeof body,
+        "<html><body><h1>Error: %d - %.*s</h1></body></html>",
+        code, STRFMT(status));
+
+    i32 length = snprintf(
+        conn->error, sizeof conn->error,
+        "HTTP/1.1 %d %.*s\r\n"
+        "Content-Type: text/html;charset=UTF-8\r\n"
+        "Content-Length: %d\r\n"
+        "Server: FSG\r\n"
+        "Connection: %s\r\n"
+        "\r\n"
+        "%s",
+        code, STRFMT(status), body_length, keep_alive ? "keep-alive" : "close", body);
+
+    conn->iov[0] = { conn->error, (size_t)length };
+    conn->iov_count = 1;
+    conn->file_remain = 0;
+    conn->close_after_write = !keep_alive;
+    conn->status = code;
+}
+
+void prepare_metrics(FsgServer *server, LinuxConnection *conn, HttpRequest *request)
+{
+    bool keep_alive = request->keep_alive;
+
+    if (conn->metrics_body.data) destroy_string(conn->metrics_body);
+    conn->metrics_body = build_metrics(server, mem_dynamic);
+
+    i32 length = snprintf(
+        conn->error, sizeof conn->error,
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %d\r\n"
+        "Cache-Control: no-store\r\n"
+        "Server: FSG\r\n"
+        "Connection: %s\r\n"
+        "\r\n",
+        conn->metrics_body.length, keep_alive ? "keep-alive" : "close");
+
+    conn->iov[0] = { conn->error, (size_t)length };
+    conn->iov_count = 1;
+    conn->file_remain = 0;
+    conn->close_after_write = !keep_alive;
+    conn->status = 200;
+
+    if (request->method == "GET") {
+        conn->iov[1] = { conn->metrics_body.data, (size_t)conn->metrics_body.length };
+        conn->iov_count = 2;
+    }
+}
+
+// NOTE(jesper): weak comparison, as If-None-Match calls for
+bool etag_matches(String if_none_match, String etag)
+{
+    while (if_none_match.length > 0) {
+        String tag{ if_none_match.data, 0 };
+        while (tag.length < if_none_match.length && if_none_match[tag.length] != ',') tag.length++;
+
+        if_none_match.data += MIN(tag.length+1, if_none_match.length);
+        if_none_match.length -= MIN(tag.length+1, if_none_match.length);
+
+        while (tag.length > 0 && tag[0] == ' ') { tag.data++; tag.length--; }
+        while (tag.length > 0 && tag[tag.length-1] == ' ') tag.length--;
+        if (starts_with(tag, "W/")) { tag.data += 2; tag.length -= 2; }
+
+        if (tag == "*" || tag == etag) return true;
+    }
+
+    return false;
+}
+
+void prepare_response(FsgServer *server, FsgWorkerMetrics *metrics, LinuxConnection *conn, HttpRequest *request)
+{
+    bool keep_alive = request->keep_alive;
+
+    String url = request->path;
+    if (url == "/") url = "/index.html";
+    conn->route = url_route(url);
+
+    if (request->method != "GET" && request->method != "HEAD") {
+        prepare_error(conn, 405, keep_alive);
+        return;
+    }
+
+    if (conn->route == FSG_ROUTE_METRICS) {
+        prepare_metrics(server, conn, request);
+        return;
+    }
+
+    conn->snapshot = acquire_snapshot(server);
+
+    FsgResponse *response = find_response(conn->snapshot, url);
+    if (!response) {
+        metric_add(&metrics->snapshot_misses, 1);
+        release_snapshot(conn);
+        prepare_error(conn, http_content_type(url).length == 0 ? 403 : 404, keep_alive);
+        return;
+    }
+
+    metric_add(&metrics->snapshot_hits, 1);
+
+    conn->close_after_write = !keep_alive;
+    conn->file_remain = 0;
+
+    if (etag_matches(http_header(request, "if-none-match"), response->etag)) {
+        String head = response->not_modified[keep_alive];
+        conn->iov[0] = { head.data, (size_t)head.length };
+        conn->iov_count = 1;
+        conn->status = 304;
+        return;
+    }
+
+    String head = response->head[keep_alive];
+    conn->iov[0] = { head.data, (size_t)head.length };
+    conn->iov_count = 1;
+    conn->status = 200;
+
+    if (request->method != "GET") return;
+
+    if (conn->snapshot->pack_fd != -1) {
+        conn->file_fd = conn->snapshot->pack_fd;
+        conn->file_offset = response->body_offset;
+        conn->file_remain = response->body.length;
+    } else {
+        conn->iov[1] = { response->body.data, (size_t)response->body.length };
+        conn->iov_count = 2;
+    }
+}
+
+bool response_pending(LinuxConnection *conn)
+{
+    return conn->iov_count > 0 || conn->file_remain > 0;
+}
+
+// NOTE(jesper): writes as much of the pending response as the socket takes. Returns false
+// if the connection failed, the response is done once response_pending is false
+bool flush_connection(LinuxConnection *conn)
+{
+    while (conn->iov_count > 0) {
+        msghdr msg{};
+        msg.msg_iov = conn->iov;
+        msg.msg_iovlen = conn->iov_count;
+
+        // NOTE(jesper): hold the head back until the body from the pack follows it, rather
+        // than sending it as a segment of its own
+        ssize_t written = sendmsg(conn->fd, &msg, conn->file_remain > 0 ? MSG_MORE : 0);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        while (written > 0 && conn->iov_count > 0) {
+            if ((size_t)written >= conn->iov[0].iov_len) {
+                written -= conn->iov[0].iov_len;
+                conn->iov[0] = conn->iov[1];
+                conn->iov_count--;
+            } else {
+                conn->iov[0].iov_base = (char*)conn->iov[0].iov_base + written;
+                conn->iov[0].iov_len -= written;
+                written = 0;
+            }
+        }
+    }
+
+    while (conn->file_remain > 0) {
+        ssize_t written = sendfile(conn->fd, conn->file_fd, &conn->file_offset, conn->file_remain);
+        if (written == -1) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        if (written == 0) return false;
+
+        conn->file_remain -= written;
+    }
+
+    release_snapshot(conn);
+    return true;
+}
+
+// NOTE(jesper): reads what's available, then answers the complete requests in the buffer
+// in order until one can't be written in full. Returns false when the connection should
+// be closed
+bool service_connection(FsgServer *server, FsgWorkerMetrics *metrics, LinuxConnection *conn)
+{
+    if (!flush_connection(conn)) return false;
+    if (conn->tracking && !response_pending(conn)) record_response(metrics, conn);
+    if (!response_pending(conn) && conn->close_after_write) return false;
+
+    bool peer_closed = false;
+    while (!response_pending(conn) && conn->buffered < (i32)sizeof conn->buffer) {
+        ssize_t received = recv(conn->fd, conn->buffer+conn->buffered, sizeof conn->buffer - conn->buffered, 0);
+        if (received == -1 && errno == EINTR) continue;
+        if (received == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (received <= 0) {
+            peer_closed = true;
+            break;
+        }
+
+        conn->buffered += (i32)received;
+    }
+
+    while (!response_pending(conn)) {
+        i32 used = http_parse(&conn->parser, conn->buffer, conn->buffered);
+
+        if (conn->parser.state == HTTP_STATE_ERROR) {
+            conn->route = FSG_ROUTE_OTHER;
+            conn->request_start_ns = metrics_now_ns();
+            prepare_error(conn, conn->parser.status, false);
+        } else if (used == 0) {
+            break;
+        } else {
+            conn->request_start_ns = metrics_now_ns();
+            prepare_response(server, metrics, conn, &conn->parser.request);
+
+            memmove(conn->buffer, conn->buffer+used, conn->buffered-used);
+            conn->buffered -= used;
+            conn->parser = {};
+        }
+
+        conn->tracking = true;
+        conn->response_bytes = conn->file_remain;
+        for (i32 i = 0; i < conn->iov_count; i++) conn->response_bytes += conn->iov[i].iov_len;
+
+        if (!flush_connection(conn)) return false;
+        if (!response_pending(conn)) record_response(metrics, conn);
+        if (!response_pending(conn) && conn->close_after_write) return false;
+    }
+
+    return !peer_closed || response_pending(conn);
+}
+
+int create_listen_socket(i32 port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        LOG_ERROR("socket creation failed: %s", strerror(errno));
+        return -1;
+    }
+
+    // NOTE(jesper): every worker binds its own socket to the same port and the kernel
+    // spreads incoming connections across them
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof one) == -1) {
+        LOG_ERROR("SO_REUSEPORT failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    sockaddr_in service{};
+    service.sin_family = AF_INET;
+    inet_pton(AF_INET, "127.0.0.1", &service.sin_addr);
+    service.sin_port = htons((u16)port);
+
+    if (bind(fd, (sockaddr*)&service, sizeof service) == -1) {
+        LOG_ERROR("bind failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    if (listen(fd, SOMAXCONN) == -1) {
+        LOG_ERROR("listen failed: %s", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+void server_worker(FsgServer *server, FsgWorkerMetrics *metrics, std::atomic<FsgSnapshot*> *snapshot_hazard, int lis_socket)
+{
+    tl_snapshot_hazard = snapshot_hazard;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        LOG_ERROR("epoll_create1 failed: %s", strerror(errno));
+        return;
+    }
+    defer { close(epoll_fd); };
+
+    epoll_event lis_event{};
+    lis_event.events = EPOLLIN;
+    lis_event.data.ptr = nullptr;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, lis_socket, &lis_event);
+
+    epoll_event events[64];
+    while (true) {
+        int count = epoll_wait(epoll_fd, events, 64, -1);
+        if (count == -1) {
+            if (errno == EINTR) continue;
+            LOG_ERROR("epoll_wait failed: %s", strerror(errno));
+            return;
+        }
+
+        for (i32 i = 0; i < count; i++) {
+            LinuxConnection *conn = (LinuxConnection*)events[i].data.ptr;
+
+            if (!conn) {
+                while (true) {
+                    int fd = accept4(lis_socket, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if (fd == -1) break;
+
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+
+                    LinuxConnection *c = (LinuxConnection*)malloc(sizeof *c);
+                    c->fd = fd;
+                    c->want_write = false;
+                    c->close_after_write = false;
+                    c->buffered = 0;
+                    c->parser = {};
+                    c->snapshot = nullptr;
+                    c->iov_count = 0;
+                    c->file_remain = 0;
+                    c->tracking = false;
+                    c->metrics_body = {};
+                    metric_add(&metrics->connections_opened, 1);
+
+                    epoll_event event{};
+                    event.events = EPOLLIN | EPOLLRDHUP;
+                    event.data.ptr = c;
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event);
+                }
+                continue;
+            }
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP) || !service_connection(server, metrics, conn)) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+                close(conn->fd);
+                release_snapshot(conn);
+                if (conn->metrics_body.data) destroy_string(conn->metrics_body);
+                free(conn);
+                metric_add(&metrics->connections_closed, 1);
+                continue;
+            }
+
+            // NOTE(jesper): while a response is pending the connection waits for the
+            // socket to be writable rather than reading more requests
+            bool want_write = response_pending(conn);
+            if (want_write != conn->want_write) {
+                epoll_event event{};
+                event.events = want_write ? EPOLLOUT : (EPOLLIN | EPOLLRDHUP);
+                event.data.ptr = conn;
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+                conn->want_write = want_write;
+            }
+        }
+    }
+}
+
+i32 run_server(String output, String src_dir, FsgOptions opts)
+{
+    (void)src_dir;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    FsgServer server{};
+    server.port = opts.port;
+
+    u64 build_start = metrics_now_ns();
+    FsgSnapshot *snapshot = nullptr;
+    if (opts.pack_path.length > 0) {
+        snapshot = create_pack_snapshot(opts.pack_path);
+        if (!snapshot) return 1;
+        LOG_INFO("serving %d files from pack '%.*s'", snapshot->count, STRFMT(opts.pack_path));
+
+        server.pack_dev = snapshot->pack_dev;
+        server.pack_ino = snapshot->pack_ino;
+    } else {
+        snapshot = create_snapshot(output);
+        LOG_INFO("serving %d files from '%.*s'", snapshot->count, STRFMT(output));
+    }
+    server.snapshot.store(snapshot);
+    server.snapshot_entries.store(snapshot->count);
+    metric_add(&server.snapshot_builds, 1);
+    metric_add(&server.snapshot_build_ns, metrics_now_ns() - build_start);
+
+    i32 cpu_count = (i32)std::thread::hardware_concurrency();
+    i32 worker_count = MAX(opts.workers, 1);
+
+    server.worker_count = worker_count;
+    server.metrics = new FsgWorkerMetrics[worker_count]{};
+    server.snapshot_hazards = new std::atomic<FsgSnapshot*>[worker_count]{};
+
+    DynamicArray<std::thread*> workers{};
+    for (i32 i = 0; i < worker_count; i++) {
+        int lis_socket = create_listen_socket(server.port);
+        if (lis_socket == -1) return 1;
+
+        std::thread *worker = new std::thread(server_worker, &server, &server.metrics[i], &server.snapshot_hazards[i], lis_socket);
+
+        if (opts.pin_workers && cpu_count > 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % cpu_count, &cpus);
+
+            int result = pthread_setaffinity_np(worker->native_handle(), sizeof cpus, &cpus);
+            if (result != 0) LOG_ERROR("failed pinning worker %d: %s", i, strerror(result));
+        }
+
+        array_add(&workers, worker);
+    }
+
+    LOG_INFO("listening on 127.0.0.1:%d with %d workers", server.port, worker_count);
+
+    if (opts.pack_path.length > 0) {
+        DynamicArray<FsgSnapshot*> retired{};
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+            reload_pack(&server, opts.pack_path, &retired);
+        }
+    }
+
+    for (std::thread *worker : workers) worker->join();
+    return 0;
+}
@@ -9,7 +9,7 @@ struct HttpBuilder {
 struct GeneratorThreadData {
     String output;
     String src_dir;
-    bool build_drafts;
+    FsgOptions opts;
 };
 
 void append_stringf(HttpBuilder *hb, const char *fmt, ...)
@@ -82,7 +82,7 @@ bool send_data(SOCKET dst_socket, String str)
 }
 
 
-void send_header(SOCKET dst_socket, i32 code, String content_type, i32 content_length)
+void send_header(SOCKET dst_socket, i32 code, String content_type, i32 content_length, bool immutable)
 {
     HttpBuilder sb{ dst_socket, 0, 0 };
     append_stringf(&sb, "HTTP/1.1 %d ", code);
@@ -105,6 +105,10 @@ void send_header(SOCKET dst_socket, i32 code, String content_type, i32 content_l
         append_stringf(&sb, "Content-Length: %d\n", content_length);
     }
 
+    if (immutable) {
+        append_string(&sb, "Cache-Control: " FSG_IMMUTABLE_CACHE_CONTROL "\n");
+    }
+
     append_string(&sb, "Server: FSG\n");
     append_string(&sb, "Accept-Ranges: bytes\n");
     append_string(&sb, "Connection: close\n");
@@ -145,7 +149,7 @@ DWORD generate_proc(void *data)
 
         WaitForSingleObject(g_generate_mutex, INFINITE);
         Sleep(1000);
-        generate_src_dir(gtd->output, gtd->src_dir, gtd->build_drafts);
+        generate_src_dir(gtd->output, gtd->src_dir, gtd->opts);
         html_dirty = true;
         ReleaseMutex(g_generate_mutex);
     }
@@ -156,7 +160,7 @@ DWORD generate_proc(void *data)
 void run_server()
 {
     g_generate_mutex = CreateMutex(NULL, FALSE, NULL);
-    GeneratorThreadData gen_thread_data{ output, src_dir, build_drafts };
+    GeneratorThreadData gen_thread_data{ output, src_dir, opts };
     HANDLE gen_thread = CreateThread(NULL, 8*1024*1024, &generate_proc, &gen_thread_data, 0, nullptr);
     (void)gen_thread;
 
@@ -271,7 +275,7 @@ void run_server()
                     content_type = "image/jpeg";
                 } else {
                     LOG_INFO("requested unsupported file type: %.*s", path.length, path.data);
-                    send_header(in_socket, 403, "text/html", http_403_body.length);
+                    send_header(in_socket, 403, "text/html", http_403_body.length, false);
                     send_data(in_socket, http_403_body);
                     goto req_end;
                 }
@@ -281,14 +285,14 @@ void run_server()
                 FileInfo contents = read_file(path, mem_dynamic);
                 if (!contents.data) {
                     LOG_INFO("respond: 404: %.*s", path.length, path.data);
-                    send_header(in_socket, 404, "text/html", http_404_body.length);
+                    send_header(in_socket, 404, "text/html", http_404_body.length, false);
                     send_data(in_socket, http_404_body);
                     goto req_end;
                 }
                 defer{ destroy_string(contents); };
 
                 LOG_INFO("respond: 200");
-                send_header(in_socket, 200, content_type, contents.length);
+                send_header(in_socket, 200, content_type, contents.length, is_fingerprinted_path(path));
                 send_data(in_socket, contents);
 
                 ReleaseMutex(g_generate_mutex);